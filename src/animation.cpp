@@ -1,8 +1,28 @@
 #include "animation.hpp"
 #include <cmath>
+#include <algorithm>
+#include <string>
+#include <cstdint>
 #include <utility>
 #include "image.hpp"
 #include "terminal.hpp"
+#include "palette.hpp"
+#include "wavekernel.hpp"
+#include "shading.hpp"
+#include "fixedwave.hpp"
+
+// Blocks filling the lower 1/8 to 7/8 of a cell
+#ifdef _WIN32
+    // NOTE: The console code page has no eighth blocks, edge smoothing is
+    // turned down by the argument parser
+    static const char* LOWER_EIGHTH_CHARS[] = {
+        " ", " ", BOTTOM_HALF_CHAR, BOTTOM_HALF_CHAR, BOTTOM_HALF_CHAR, FULL_BLOCK_CHAR, FULL_BLOCK_CHAR
+    };
+#else
+    static const char* LOWER_EIGHTH_CHARS[] = {
+        "\u2581", "\u2582", "\u2583", "\u2584", "\u2585", "\u2586", "\u2587"
+    };
+#endif
 
 SineWave::SineWave(float amplitude, float wavelength, float speed, float phase)
     : amplitude(amplitude), wavelength(wavelength), speed(speed), phase(phase) {}
@@ -21,63 +41,943 @@ Canvas& Canvas::getInstance() {
 }
 
 Canvas::Canvas()
-    : m_prevCanvas(0, 0), m_currCanvas(0, 0), m_term(TerminalController::getInstance()) {
+    : m_prevCanvas(0, 0), m_currCanvas(0, 0), m_term(TerminalController::getInstance())
+    , m_isDithering(false), m_isSmoothingEdges(false), m_backend(RenderBackend::CELLS)
+    , m_isFixedPoint(false), m_diffThreshold(0), m_frameCount(0), m_prevFlag(0, 0) {
+    setGlyphMode(GlyphMode::HALF);
+}
+
+void Canvas::setDithering(bool isEnabled) {
+    m_isDithering = isEnabled;
+}
+
+void Canvas::setDiffThreshold(int threshold) {
+    m_diffThreshold = threshold;
+}
+
+// NOTE: Only used with half blocks, the other glyph modes already draw edges
+// in finer steps
+void Canvas::setEdgeSmoothing(bool isEnabled) {
+    m_isSmoothingEdges = isEnabled;
+}
+
+void Canvas::setBackend(RenderBackend backend) {
+    m_backend = backend;
+    m_kitty.reset();
+    m_sixel.reset();
+}
+
+// Draws the flag with integer math only, see FixedWave. Shading gives the
+// same colors either way, the light levels may differ by a step.
+void Canvas::setFixedPoint(bool isEnabled) {
+    m_isFixedPoint = isEnabled;
+}
+
+// Images outlive the program in terminals with graphics, delete them before
+// exiting
+void Canvas::releaseGraphics() {
+    if (m_backend == RenderBackend::KITTY) {
+        std::string out;
+        KittyEncoder::writeDeleteAll(&out);
+        m_term.getStream() << out;
+    }
+}
+
+// NOTE: Quadrant and sextant glyphs are only in Unicode, the Windows console
+// code page has half blocks alone
+void Canvas::setGlyphMode(GlyphMode mode) {
+    m_glyphMode = mode;
+    m_cellWidth = mode == GlyphMode::HALF ? 1 : 2;
+    m_cellHeight = mode == GlyphMode::SEXTANT ? 3 : 2;
+    m_fitCache.clear();
+
+    // Indexed by mask, bit 0 is the top left pixel
+    m_glyphs.assign(size_t(1) << (m_cellWidth * m_cellHeight), std::string());
+    m_glyphs.front() = " ";
+    m_glyphs.back() = FULL_BLOCK_CHAR;
+    if (mode == GlyphMode::HALF) {
+        m_glyphs.at(0x1) = TOP_HALF_CHAR;
+        m_glyphs.at(0x2) = BOTTOM_HALF_CHAR;
+    }
+#ifndef _WIN32
+    else if (mode == GlyphMode::QUADRANT) {
+        const char* quadrants[] = {
+            "\u2598", "\u259D", "\u2580", "\u2596", "\u258C", "\u259E", "\u259B",
+            "\u2597", "\u259A", "\u2590", "\u259C", "\u2584", "\u2599", "\u259F"
+        };
+        for (size_t mask = 1; mask < 15; mask++) {
+            m_glyphs.at(mask) = quadrants[mask - 1];
+        }
+    }
+    else {
+        // Sextants are in order from U+1FB00, leaving out the ones that
+        // already exist as half blocks
+        for (size_t mask = 1; mask < 63; mask++) {
+            if (mask == 0x15) {
+                m_glyphs.at(mask) = "\u258C";
+                continue;
+            }
+            if (mask == 0x2A) {
+                m_glyphs.at(mask) = "\u2590";
+                continue;
+            }
+            uint32_t codepoint = 0x1FB00 + static_cast<uint32_t>(mask - 1)
+                - (mask > 0x15 ? 1 : 0) - (mask > 0x2A ? 1 : 0);
+            std::string glyph;
+            glyph += static_cast<char>(0xF0 | (codepoint >> 18));
+            glyph += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+            glyph += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+            glyph += static_cast<char>(0x80 | (codepoint & 0x3F));
+            m_glyphs.at(mask) = glyph;
+        }
+    }
+#endif
+
     std::pair<int, int> termSize = m_term.getSize();
-    m_prevCanvas.resize(termSize.first, termSize.second * ROWS_PER_CHAR);
-    m_currCanvas.resize(termSize.first, termSize.second * ROWS_PER_CHAR);
+    m_prevCanvas = Image(termSize.first * m_cellWidth, termSize.second * m_cellHeight, Color());
+    m_currCanvas = m_prevCanvas;
+    m_edges.assign(termSize.first * termSize.second, CellEdge());
+    m_prevEdges = m_edges;
+    // NOTE: Nothing drawn before is left to copy flag columns from
+    m_sceneKey.clear();
+    m_kitty.reset();
+    m_sixel.reset();
 }
 
 void Canvas::beginDrawing(Color bg) {
-    m_prevCanvas = m_currCanvas;
+    std::swap(m_prevCanvas, m_currCanvas);
+    m_prevTextSpans.swap(m_textSpans);
+    m_textSpans.clear();
     std::pair<int, int> termSize = m_term.getSize();
-    m_currCanvas.resize(termSize.first, termSize.second * ROWS_PER_CHAR);
+    m_currCanvas.resize(termSize.first * m_cellWidth, termSize.second * m_cellHeight);
     m_currCanvas.clear(bg);
-    m_term.setCursorHome();
+    m_prevEdges.swap(m_edges);
+    m_edges.assign(termSize.first * termSize.second, CellEdge());
+    m_prevFlagColumns.swap(m_flagColumns);
+    m_flagColumns.assign(m_currCanvas.getWidth(), FlagColumn());
+    m_prevSceneKey.swap(m_sceneKey);
+    m_sceneKey = {
+        termSize.first, termSize.second, bg.r, bg.g, bg.b, bg.a,
+        static_cast<int>(m_glyphMode), static_cast<int>(m_backend), m_isSmoothingEdges
+    };
 }
 
 void Canvas::endDrawing() {
+    // Terminals reflow or cut lines when the width changes, what they show
+    // then is nothing to diff against and the frame is drawn from scratch
+    bool isFullRedraw = m_prevCanvas.getWidth() != m_currCanvas.getWidth();
     if (m_prevCanvas.getSize() != m_currCanvas.getSize()) {
-        m_term.clearScreen();
+        if (isFullRedraw) {
+            m_prevCanvas = Image(m_currCanvas.getWidth(), m_currCanvas.getHeight(), Color());
+            m_prevEdges.assign(m_edges.size(), CellEdge());
+        }
+        else {
+            relayoutPrevCanvas();
+        }
+        m_kitty.reset();
+        m_sixel.reset();
+    }
+
+    // Every once in a while diff exactly, so cells that stayed within the
+    // threshold of what is shown still converge to their true color
+    m_frameCount++;
+    int threshold = m_frameCount % LOSSY_DIFF_REFRESH_FRAMES == 0 ? 0 : m_diffThreshold;
+
+    size_t rowCount = m_currCanvas.getHeight() / m_cellHeight;
+    size_t colCount = m_currCanvas.getWidth() / m_cellWidth;
+    m_dirtyCells.assign(colCount * rowCount, false);
+    bool hasDirtyCells = false;
+    std::vector<bool> unchangedCols = getUnchangedCellColumns();
+    for (size_t row = 0; row < rowCount; row++) {
+        Color* currRows[MAX_PIXELS_PER_CELL];
+        const Color* prevRows[MAX_PIXELS_PER_CELL];
+        for (size_t y = 0; y < m_cellHeight; y++) {
+            currRows[y] = m_currCanvas.getRow(row * m_cellHeight + y);
+            prevRows[y] = m_prevCanvas.getRow(row * m_cellHeight + y);
+        }
+        for (size_t col = 0; col < colCount; col++) {
+            if (unchangedCols.at(col)) {
+                continue;
+            }
+            size_t cellX = col * m_cellWidth;
+            bool isCellEqual = true;
+            for (size_t y = 0; y < m_cellHeight && isCellEqual; y++) {
+                for (size_t x = cellX; x < cellX + m_cellWidth && isCellEqual; x++) {
+                    isCellEqual = areColorsClose(currRows[y][x], prevRows[y][x], threshold);
+                }
+            }
+            if (!isCellEqual || !(m_edges.at(col + row * colCount) == m_prevEdges.at(col + row * colCount))) {
+                m_dirtyCells.at(col + row * colCount) = true;
+                hasDirtyCells = true;
+            }
+            else if (threshold > 0) {
+                // NOTE: Keep what is actually on screen as the reference for
+                // the next frame, otherwise small changes could add up unseen
+                for (size_t y = 0; y < m_cellHeight; y++) {
+                    std::copy(prevRows[y] + cellX, prevRows[y] + cellX + m_cellWidth, currRows[y] + cellX);
+                }
+            }
+        }
+    }
+
+    if (clearStaleTextSpans(m_backend != RenderBackend::CELLS)) {
+        hasDirtyCells = true;
+    }
+
+    // Price a diff (each row picking between a diff and a rewrite) against
+    // clearing the screen and drawing every non-blank cell, then emit the
+    // cheaper one
+    TermState& state = m_term.getState();
+    std::string out;
+    if (m_backend == RenderBackend::KITTY) {
+        // NOTE: Deleting the images leaves the text layer, which may hold
+        // reflowed message text
+        if (isFullRedraw) {
+            m_term.resetFGAndBG();
+            m_term.clearScreen();
+        }
+        m_kitty.encodeFrame(
+            m_currCanvas,
+            std::pair<size_t, size_t>(m_cellWidth, m_cellHeight),
+            m_dirtyCells,
+            m_term.getCellPixelSize(),
+            m_term,
+            state,
+            &out
+        );
+    }
+    else if (m_backend == RenderBackend::SIXEL) {
+        m_sixel.encodeFrame(
+            m_currCanvas,
+            std::pair<size_t, size_t>(m_cellWidth, m_cellHeight),
+            m_dirtyCells,
+            m_term.getCellPixelSize(),
+            m_term,
+            state,
+            &out
+        );
+    }
+    else if (isFullRedraw) {
+        encodeFullFrame(state, &out);
+    }
+    else if (hasDirtyCells) {
+        TermState diffState = state;
+        size_t diffCost = 0;
+        for (size_t row = 0; row < rowCount; row++) {
+            diffCost += encodeRow(row, diffState, nullptr);
+        }
+        TermState fullState = state;
+        size_t fullCost = encodeFullFrame(fullState, nullptr, diffCost);
+
+        if (fullCost < diffCost) {
+            encodeFullFrame(state, &out);
+        }
+        else {
+            for (size_t row = 0; row < rowCount; row++) {
+                encodeRow(row, state, &out);
+            }
+        }
+    }
+    // Nothing changed, not even an empty synchronized update is sent
+    if (out.empty() && !hasDirtyCells && m_textSpans == m_prevTextSpans
+        && m_term.getStream().tellp() <= 0) {
+        return;
+    }
+    m_term.getStream() << out;
+
+    // Text goes last so cells rewritten under it don't erase it
+    if (!m_textSpans.empty()) {
+        m_term.usePreferredFGandBG();
+        for (const TextSpan& span : m_textSpans) {
+            m_term.setCursor(span.x, span.y);
+            m_term.writeText(span.text);
+        }
+    }
+    // NOTE: With the cursor on the last row a terminal that gets shorter
+    // scrolls the screen up, from the top left it cuts off the bottom rows
+    if (state.cursorX != 0 || state.cursorY != 0) {
         m_term.setCursorHome();
-        for (size_t y = 0; y < m_currCanvas.getHeight(); y += 2) {
-            m_term.setCursor(1, static_cast<int>(y)/2 + 1);
-            for (size_t x = 0; x < m_currCanvas.getWidth(); x++) {
-                outputPixelPair(std::pair<size_t, size_t>(x, y));
+    }
+    m_term.flushFrame();
+}
+
+// Takes what was drawn since beginDrawing as already shown, nothing is sent.
+// Used when the screen was updated without the canvas. The graphics encoders
+// can't tell which images that left behind, they start over.
+void Canvas::assumeDrawn() {
+    m_kitty.reset();
+    m_sixel.reset();
+}
+
+size_t Canvas::encodeRow(size_t row, TermState& state, std::string* out) {
+    size_t width = m_currCanvas.getWidth() / m_cellWidth;
+    bool isRowDirty = false;
+    for (size_t x = 0; x < width && !isRowDirty; x++) {
+        isRowDirty = m_dirtyCells.at(x + row * width);
+    }
+    if (!isRowDirty) {
+        return 0;
+    }
+
+    TermState diffState = state;
+    size_t diffCost = encodeRowCells(row, false, diffState, nullptr);
+    TermState rewriteState = state;
+    size_t rewriteCost = rewriteRow(row, rewriteState, nullptr, diffCost);
+    if (rewriteCost < diffCost) {
+        return rewriteRow(row, state, out);
+    }
+    return encodeRowCells(row, false, state, out);
+}
+
+// Like encodeFullFrame, pricing stops at maxCost
+size_t Canvas::rewriteRow(size_t row, TermState& state, std::string* out, size_t maxCost) {
+    size_t cost = m_term.writeMove(state, 0, static_cast<int>(row), out);
+    for (size_t x = 0; x < m_currCanvas.getWidth() / m_cellWidth;) {
+        if (out == nullptr && cost >= maxCost) {
+            break;
+        }
+        size_t runLen = getRunLength(x, row);
+        cost += encodeRun(x, row, runLen, state, out);
+        x += runLen;
+    }
+    return cost;
+}
+
+// Writes the dirty cells of the row, or with isAfterClear every cell that
+// isn't blank. Gaps between them are either skipped with a cursor move or
+// rewritten, whichever is cheaper.
+size_t Canvas::encodeRowCells(size_t row, bool isAfterClear, TermState& state, std::string* out) {
+    size_t width = m_currCanvas.getWidth() / m_cellWidth;
+    size_t cost = 0;
+    for (size_t x = 0; x < width; x++) {
+        bool needsWrite = isAfterClear
+            ? !isCellBlank(x, row)
+            : static_cast<bool>(m_dirtyCells.at(x + row * width));
+        if (!needsWrite) {
+            continue;
+        }
+
+        if (state.cursorY == static_cast<int>(row) && state.cursorX >= 0
+            && static_cast<size_t>(state.cursorX) < x) {
+            TermState moveState = state;
+            size_t moveCost = m_term.writeMove(moveState, static_cast<int>(x), moveState.cursorY, nullptr);
+            TermState gapState = state;
+            size_t gapCost = 0;
+            for (size_t gapX = state.cursorX; gapX < x && gapCost < moveCost; gapX++) {
+                gapCost += encodeCell(gapX, row, gapState, nullptr);
             }
+            if (gapCost < moveCost) {
+                for (size_t gapX = state.cursorX; gapX < x; gapX++) {
+                    cost += encodeCell(gapX, row, state, out);
+                }
+            }
+        }
+        // Cells that don't need writing at the end of a run of identical
+        // cells are left alone, the ones in the middle are rewritten for free
+        size_t runLen = getRunLength(x, row);
+        while (runLen > 1) {
+            bool lastNeedsWrite = isAfterClear
+                ? !isCellBlank(x + runLen - 1, row)
+                : static_cast<bool>(m_dirtyCells.at(x + runLen - 1 + row * width));
+            if (lastNeedsWrite) {
+                break;
+            }
+            runLen--;
+        }
+        cost += m_term.writeMove(state, static_cast<int>(x), static_cast<int>(row), out);
+        cost += encodeRun(x, row, runLen, state, out);
+        x += runLen - 1;
+    }
+    return cost;
+}
+
+size_t Canvas::getRunLength(size_t x, size_t row) const {
+    CellColors first = getCellColors(x, row);
+    size_t runLen = 1;
+    size_t width = m_currCanvas.getWidth() / m_cellWidth;
+    while (x + runLen < width && getCellColors(x + runLen, row) == first) {
+        runLen++;
+    }
+    return runLen;
+}
+
+// Writes len identical cells starting at the cursor. Besides spelling them
+// out, runs can be repeated with REP after the first cell or, when the cells
+// are just a background color, erased to it with ECH.
+size_t Canvas::encodeRun(size_t x, size_t row, size_t len, TermState& state, std::string* out) {
+    if (len == 1) {
+        return encodeCell(x, row, state, out);
+    }
+
+    enum { PLAIN, REPEAT, ERASE } bestMethod = PLAIN;
+    TermState plainState = state;
+    size_t bestCost = 0;
+    for (size_t i = 0; i < len; i++) {
+        bestCost += encodeCell(x + i, row, plainState, nullptr);
+    }
+
+    const TermCaps& caps = m_term.getCaps();
+    if (caps.hasREP) {
+        TermState repState = state;
+        size_t repCost = encodeCell(x, row, repState, nullptr)
+            + m_term.writeRepeat(repState, static_cast<int>(len - 1), nullptr);
+        if (repCost < bestCost) {
+            bestCost = repCost;
+            bestMethod = REPEAT;
         }
     }
+
+    CellColors colors = getCellColors(x, row);
+    if (caps.hasECH && colors.isUniform()) {
+        TermState eraseState = state;
+        size_t eraseCost = eraseRun(x, row, len, colors.restColor, eraseState, nullptr);
+        if (eraseCost < bestCost) {
+            bestCost = eraseCost;
+            bestMethod = ERASE;
+        }
+    }
+
+    if (bestMethod == REPEAT) {
+        return encodeCell(x, row, state, out)
+            + m_term.writeRepeat(state, static_cast<int>(len - 1), out);
+    }
+    if (bestMethod == ERASE) {
+        return eraseRun(x, row, len, colors.restColor, state, out);
+    }
+    size_t cost = 0;
+    for (size_t i = 0; i < len; i++) {
+        cost += encodeCell(x + i, row, state, out);
+    }
+    return cost;
+}
+
+// NOTE: ECH doesn't move the cursor, so move past the erased cells like
+// writing them would have
+size_t Canvas::eraseRun(
+    size_t x,
+    size_t row,
+    size_t len,
+    TermColor bg,
+    TermState& state,
+    std::string* out
+) {
+    size_t cost = m_term.writeSGR(state, TermColor(), bg, out)
+        + m_term.writeErase(state, static_cast<int>(len), out);
+    if (x + len < m_currCanvas.getWidth() / m_cellWidth) {
+        cost += m_term.writeMove(state, static_cast<int>(x + len), static_cast<int>(row), out);
+    }
     else {
-        for (size_t y = 0; y < m_currCanvas.getHeight(); y += 2) {
-            for (size_t x = 0; x < m_currCanvas.getWidth(); x++) {
-                bool topsEqual = m_currCanvas.getPixel(x, y) == m_prevCanvas.getPixel(x, y);
-                bool bottomsEqual = y + 1 >= m_currCanvas.getHeight()
-                    || (m_currCanvas.getPixel(x, y + 1) == m_prevCanvas.getPixel(x, y + 1));
-                if (!topsEqual || !bottomsEqual) {
-                    m_term.setCursor(static_cast<int>(x) + 1, static_cast<int>(y)/2 + 1);
-                    outputPixelPair(std::pair<size_t, size_t>(x, y));
+        state.cursorX = -1;
+        state.cursorY = -1;
+    }
+    return cost;
+}
+
+// Pricing stops once the cost reaches maxCost, a small diff then doesn't pay
+// for pricing every cell of the screen
+size_t Canvas::encodeFullFrame(TermState& state, std::string* out, size_t maxCost) {
+    // NOTE: Erasing fills with the current background, so set it first
+    size_t cost = m_term.writeSGR(state, TermColor(), m_term.getPreferredBG(), out);
+    if (out != nullptr) {
+        *out += CSI "2J";
+    }
+    cost += 4;
+    for (size_t row = 0; row < m_currCanvas.getHeight() / m_cellHeight; row++) {
+        if (out == nullptr && cost >= maxCost) {
+            break;
+        }
+        cost += encodeRowCells(row, true, state, out);
+    }
+    return cost;
+}
+
+bool Canvas::isCellBlank(size_t x, size_t row) const {
+    const CellEdge& edge = m_edges.at(x + row * (m_currCanvas.getWidth() / m_cellWidth));
+    if (edge.eighths != 0 && (edge.lowerColor.a || edge.upperColor.a)) {
+        return false;
+    }
+    for (size_t y = row * m_cellHeight; y < (row + 1) * m_cellHeight; y++) {
+        const Color* pixels = m_currCanvas.getRow(y);
+        for (size_t pixelX = x * m_cellWidth; pixelX < (x + 1) * m_cellWidth; pixelX++) {
+            if (pixels[pixelX].a) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+CellColors Canvas::getCellColors(size_t x, size_t row) const {
+    TermColor prefBG = m_term.getPreferredBG();
+    const CellEdge& edge = m_edges.at(x + row * (m_currCanvas.getWidth() / m_cellWidth));
+    if (edge.eighths != 0) {
+        Color lower = edge.lowerColor;
+        Color upper = edge.upperColor;
+        if (m_isDithering) {
+            lower = ColorQuantizer::dither(lower, x, row * m_cellHeight + 1, m_term.getColorMode());
+            upper = ColorQuantizer::dither(upper, x, row * m_cellHeight, m_term.getColorMode());
+        }
+        CellColors colors;
+        colors.mask = 0;
+        colors.eighths = edge.eighths;
+        colors.maskColor = lower.a ? m_term.toTermColor(lower) : prefBG;
+        colors.restColor = upper.a ? m_term.toTermColor(upper) : prefBG;
+        colors.isMaskBG = !lower.a;
+        colors.isRestBG = !upper.a;
+        if (colors.maskColor == colors.restColor || (colors.isMaskBG && colors.isRestBG)) {
+            colors.eighths = 0;
+            colors.maskColor = colors.restColor;
+            colors.isMaskBG = colors.isRestBG;
+        }
+        return colors;
+    }
+
+    Color pixels[MAX_PIXELS_PER_CELL];
+    size_t count = 0;
+    for (size_t y = row * m_cellHeight; y < (row + 1) * m_cellHeight; y++) {
+        const Color* rowPixels = m_currCanvas.getRow(y);
+        for (size_t pixelX = x * m_cellWidth; pixelX < (x + 1) * m_cellWidth; pixelX++) {
+            Color c = rowPixels[pixelX];
+            if (m_isDithering) {
+                c = ColorQuantizer::dither(c, pixelX, y, m_term.getColorMode());
+            }
+            pixels[count++] = c;
+        }
+    }
+
+    // Half blocks show both pixels as they are, more pixels have to be fit
+    // into two colors
+    CellFit fit;
+    if (m_glyphMode == GlyphMode::HALF) {
+        fit.mask = 0x1;
+        fit.maskColor = pixels[0];
+        fit.restColor = pixels[1];
+    }
+    else {
+        CellPixels key;
+        key.packed.fill(0);
+        for (size_t i = 0; i < count; i++) {
+            const Color& c = pixels[i];
+            key.packed.at(i) = c.r | (c.g << 8) | (c.b << 16) | (uint32_t(c.a) << 24);
+        }
+        auto cached = m_fitCache.find(key);
+        if (cached != m_fitCache.end()) {
+            fit = cached->second;
+        }
+        else {
+            fit = fitCell(pixels, count);
+            if (m_fitCache.size() >= CELL_FIT_CACHE_MAX_ENTRIES) {
+                m_fitCache.clear();
+            }
+            m_fitCache.emplace(key, fit);
+        }
+    }
+
+    uint8_t fullMask = static_cast<uint8_t>((1 << count) - 1);
+    CellColors colors;
+    colors.mask = fit.mask;
+    colors.eighths = 0;
+    colors.maskColor = fit.maskColor.a ? m_term.toTermColor(fit.maskColor) : prefBG;
+    colors.restColor = fit.restColor.a ? m_term.toTermColor(fit.restColor) : prefBG;
+    colors.isMaskBG = !fit.maskColor.a;
+    colors.isRestBG = !fit.restColor.a;
+    if (colors.mask == fullMask) {
+        colors.mask = 0;
+        colors.restColor = colors.maskColor;
+        colors.isRestBG = colors.isMaskBG;
+    }
+    if (colors.maskColor == colors.restColor || (colors.isMaskBG && colors.isRestBG)) {
+        colors.mask = 0;
+    }
+    if (colors.mask == 0) {
+        colors.maskColor = colors.restColor;
+        colors.isMaskBG = colors.isRestBG;
+    }
+    return colors;
+}
+
+// Splits the pixels into the two groups that are closest to their average
+// colors. Transparent pixels can only be drawn as the background, so then
+// the opaque ones share a single color.
+CellFit Canvas::fitCell(const Color* pixels, size_t count) {
+    uint8_t opaqueMask = 0;
+    for (size_t i = 0; i < count; i++) {
+        opaqueMask |= pixels[i].a ? (1 << i) : 0;
+    }
+
+    auto getAverage = [&](uint8_t mask) {
+        int sums[3] = { 0, 0, 0 };
+        int n = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (mask & (1 << i)) {
+                sums[0] += pixels[i].r;
+                sums[1] += pixels[i].g;
+                sums[2] += pixels[i].b;
+                n++;
+            }
+        }
+        if (n == 0) {
+            return Color();
+        }
+        return Color(
+            static_cast<uint8_t>((sums[0] + n / 2) / n),
+            static_cast<uint8_t>((sums[1] + n / 2) / n),
+            static_cast<uint8_t>((sums[2] + n / 2) / n)
+        );
+    };
+
+    uint8_t fullMask = static_cast<uint8_t>((1 << count) - 1);
+    CellFit fit;
+    if (opaqueMask != fullMask) {
+        fit.mask = opaqueMask;
+        fit.maskColor = getAverage(opaqueMask);
+        fit.restColor = Color();
+        return fit;
+    }
+
+    // NOTE: Squared error of a group is sum(p^2) - sum(p)^2 / n, the top
+    // pixel is kept out of the mask since swapping the groups is the same split
+    int64_t bestError = INT64_MAX;
+    uint8_t bestMask = 0;
+    for (uint8_t mask = 0; mask < (fullMask >> 1) + 1; mask++) {
+        uint8_t groups[2] = { static_cast<uint8_t>(mask << 1), static_cast<uint8_t>(fullMask & ~(mask << 1)) };
+        int64_t error = 0;
+        for (uint8_t group : groups) {
+            int64_t sums[3] = { 0, 0, 0 };
+            int64_t sumSquares = 0;
+            int n = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (group & (1 << i)) {
+                    const Color& c = pixels[i];
+                    sums[0] += c.r;
+                    sums[1] += c.g;
+                    sums[2] += c.b;
+                    sumSquares += c.r * c.r + c.g * c.g + c.b * c.b;
+                    n++;
                 }
             }
+            if (n > 0) {
+                error += sumSquares - (sums[0] * sums[0] + sums[1] * sums[1] + sums[2] * sums[2]) / n;
+            }
+        }
+        if (error < bestError) {
+            bestError = error;
+            bestMask = static_cast<uint8_t>(mask << 1);
         }
     }
-    m_term.flush();
+    fit.mask = bestMask;
+    fit.maskColor = getAverage(bestMask);
+    fit.restColor = getAverage(fullMask & ~bestMask);
+    return fit;
 }
 
-void Canvas::drawRect(std::pair<int, int> origin, std::pair<size_t, size_t> size, Color fill) {
-    for (size_t yOff = 0; yOff < size.second; yOff++) {
-        for (size_t xOff = 0; xOff < size.first; xOff++) {
-            int targetX = origin.first + static_cast<int>(xOff);
-            int targetY = origin.second + static_cast<int>(yOff);
-            if (static_cast<int>(m_currCanvas.getHeight()) > targetY && targetY >= 0
-                && static_cast<int>(m_currCanvas.getWidth()) > targetX && targetX >= 0) {
-                m_currCanvas.setPixel(origin.first + xOff, origin.second + yOff, fill);
+std::pair<size_t, size_t> Canvas::getCellCount() const {
+    return std::pair<size_t, size_t>(
+        m_currCanvas.getWidth() / m_cellWidth,
+        m_currCanvas.getHeight() / m_cellHeight
+    );
+}
+
+const std::vector<TextSpan>& Canvas::getTextSpans() const {
+    return m_textSpans;
+}
+
+CellColors Canvas::getExpectedColors(size_t x, size_t row) const {
+    return normalizeColors(getCellColors(x, row));
+}
+
+// Reads a cell back into pixel colors, in the same form as getExpectedColors.
+// A default foreground never matches, cells are only ever drawn with the
+// preferred background as default.
+bool Canvas::readCellColors(
+    const std::string& glyph,
+    TermColor fg,
+    TermColor bg,
+    bool isReversed,
+    CellColors* outColors
+) const {
+    TermColor ink = isReversed ? bg : fg;
+    TermColor paper = isReversed ? fg : bg;
+    if (fg.kind == TermColor::DEFAULT) {
+        (isReversed ? paper : ink) = TermColor();
+    }
+
+    CellColors colors;
+    colors.maskColor = ink;
+    colors.restColor = paper;
+    colors.isMaskBG = false;
+    colors.isRestBG = false;
+    colors.mask = 0;
+    colors.eighths = 0;
+    auto match = std::find(m_glyphs.begin(), m_glyphs.end(), glyph);
+    if (match != m_glyphs.end()) {
+        colors.mask = static_cast<uint8_t>(match - m_glyphs.begin());
+        *outColors = normalizeColors(colors);
+        return true;
+    }
+    for (size_t i = 0; i < sizeof(LOWER_EIGHTH_CHARS) / sizeof(LOWER_EIGHTH_CHARS[0]); i++) {
+        if (glyph == LOWER_EIGHTH_CHARS[i]) {
+            colors.eighths = static_cast<uint8_t>(i + 1);
+            *outColors = normalizeColors(colors);
+            return true;
+        }
+    }
+    return false;
+}
+
+// One form per look: full masks become uniform, cells of one color lose
+// their mask, and masks have the top left pixel unlit
+CellColors Canvas::normalizeColors(CellColors colors) const {
+    uint8_t fullMask = static_cast<uint8_t>(m_glyphs.size() - 1);
+    // NOTE: Four eighths is the same glyph as the lower half block
+    if (colors.eighths == 4 && m_cellHeight == 2) {
+        colors.eighths = 0;
+        colors.mask = fullMask & ~static_cast<uint8_t>((1 << m_cellWidth) - 1);
+    }
+    if (colors.eighths != 0) {
+        if (colors.maskColor == colors.restColor) {
+            colors.eighths = 0;
+        }
+        return colors;
+    }
+    if (colors.mask == fullMask) {
+        colors.mask = 0;
+        colors.restColor = colors.maskColor;
+    }
+    if (colors.mask != 0 && colors.maskColor == colors.restColor) {
+        colors.mask = 0;
+    }
+    if (colors.mask & 0x1) {
+        colors.mask = fullMask & ~colors.mask;
+        std::swap(colors.maskColor, colors.restColor);
+    }
+    return colors;
+}
+
+bool CellColors::isUniform() const {
+    return mask == 0 && eighths == 0;
+}
+
+bool CellColors::operator==(const CellColors& other) const {
+    return mask == other.mask && eighths == other.eighths
+        && maskColor == other.maskColor && restColor == other.restColor
+        && isMaskBG == other.isMaskBG && isRestBG == other.isRestBG;
+}
+
+bool CellEdge::operator==(const CellEdge& other) const {
+    return eighths == other.eighths
+        && (eighths == 0 || (lowerColor == other.lowerColor && upperColor == other.upperColor));
+}
+
+bool TextSpan::operator==(const TextSpan& other) const {
+    return x == other.x && y == other.y && text == other.text;
+}
+
+bool FlagColumn::operator==(const FlagColumn& other) const {
+    if (!isDrawn || !other.isDrawn) {
+        return isDrawn == other.isDrawn;
+    }
+    return isKeyed && other.isKeyed
+        && imgX == other.imgX
+        && yStart == other.yStart
+        && light == other.light
+        && topRow == other.topRow
+        && topEighths == other.topEighths
+        && bottomRow == other.bottomRow
+        && bottomEighths == other.bottomEighths;
+}
+
+bool CellPixels::operator==(const CellPixels& other) const {
+    return packed == other.packed;
+}
+
+size_t CellPixelsHash::operator()(const CellPixels& pixels) const {
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t packed : pixels.packed) {
+        hash ^= packed;
+        hash *= 1099511628211ull;
+    }
+    return static_cast<size_t>(hash);
+}
+
+// Picks the glyph and colors that draw the cell for the fewest bytes from the
+// current state. A glyph draws its lit pixels in the foreground color, so the
+// mask can be drawn as is or inverted with the colors swapped. Eighth blocks
+// have no inverted glyphs, reverse video swaps their colors instead.
+size_t Canvas::encodeCell(size_t x, size_t row, TermState& state, std::string* out) {
+    CellColors colors = getCellColors(x, row);
+    bool canPrefBGBeFG = m_term.getPreferredBG().kind != TermColor::DEFAULT;
+    uint8_t fullMask = static_cast<uint8_t>(m_glyphs.size() - 1);
+
+    CellCandidate candidates[2];
+    size_t candidateCount = 0;
+    if (colors.eighths != 0) {
+        const char* glyph = LOWER_EIGHTH_CHARS[colors.eighths - 1];
+        if (!colors.isMaskBG || canPrefBGBeFG) {
+            candidates[candidateCount++] = CellCandidate{
+                glyph, colors.maskColor, colors.restColor, false
+            };
+        }
+        if (!colors.isRestBG || canPrefBGBeFG) {
+            candidates[candidateCount++] = CellCandidate{
+                glyph, colors.restColor, colors.maskColor, true
+            };
+        }
+    }
+    else if (colors.mask == 0) {
+        candidates[candidateCount++] = CellCandidate{ " ", TermColor(), colors.restColor, false };
+        if (!colors.isRestBG || canPrefBGBeFG) {
+            candidates[candidateCount++] = CellCandidate{
+                m_glyphs.back().c_str(), colors.restColor, TermColor(), false
+            };
+        }
+    }
+    else {
+        if (!colors.isMaskBG || canPrefBGBeFG) {
+            candidates[candidateCount++] = CellCandidate{
+                m_glyphs.at(colors.mask).c_str(), colors.maskColor, colors.restColor, false
+            };
+        }
+        if (!colors.isRestBG || canPrefBGBeFG) {
+            candidates[candidateCount++] = CellCandidate{
+                m_glyphs.at(fullMask & ~colors.mask).c_str(), colors.restColor, colors.maskColor, false
+            };
+        }
+    }
+    size_t bestIdx = 0;
+    size_t bestCost = SIZE_MAX;
+    for (size_t i = 0; i < candidateCount && candidateCount > 1; i++) {
+        const CellCandidate& trial = candidates[i];
+        TermState trialState = state;
+        size_t trialCost = m_term.writeSGR(trialState, trial.fg, trial.bg, nullptr, trial.isReversed)
+            + m_term.writeGlyph(trialState, trial.glyph, nullptr);
+        if (trialCost < bestCost) {
+            bestCost = trialCost;
+            bestIdx = i;
+        }
+    }
+
+    const CellCandidate& best = candidates[bestIdx];
+    return m_term.writeSGR(state, best.fg, best.bg, out, best.isReversed)
+        + m_term.writeGlyph(state, best.glyph, out);
+}
+
+// Compares colors in YCoCg space where luma differences weigh double. With a
+// threshold of 0 this is an exact comparison.
+bool Canvas::areColorsClose(Color a, Color b, int threshold) {
+    if (threshold == 0 || a.a != b.a) {
+        return a == b;
+    }
+    if (!a.a) {
+        return true;
+    }
+    int dr = a.r - b.r;
+    int dg = a.g - b.g;
+    int db = a.b - b.b;
+    int dY = (dr + 2 * dg + db) / 4;
+    int dCo = (dr - db) / 2;
+    int dCg = (2 * dg - dr - db) / 4;
+    return 4 * dY * dY + dCo * dCo + dCg * dCg <= threshold * threshold;
+}
+
+// After the height changes the terminal keeps the rows that still fit and
+// newly exposed rows are blank, so rather than clearing the screen the
+// previous frame is laid out for the new height and diffed as usual. Message
+// text that moved is cleared as stale text.
+void Canvas::relayoutPrevCanvas() {
+    Image prev(m_currCanvas.getWidth(), m_currCanvas.getHeight(), Color());
+    size_t height = std::min(m_prevCanvas.getHeight(), prev.getHeight());
+    for (size_t y = 0; y < height; y++) {
+        prev.blitRow(0, static_cast<int>(y), m_prevCanvas.getRow(y), prev.getWidth());
+    }
+    m_prevCanvas = std::move(prev);
+    // NOTE: Rows of cells are kept in order, so the width being the same the
+    // rows that fit are a prefix
+    m_prevEdges.resize(m_edges.size(), CellEdge());
+}
+
+// Text that isn't drawn again this frame has to go, so the cells under it are
+// marked dirty. Images don't cover the text layer, so with isErasing the
+// text is also blanked out. Sixel images get erased along with it, those
+// cells are then drawn again.
+bool Canvas::clearStaleTextSpans(bool isErasing) {
+    size_t colCount = m_currCanvas.getWidth() / m_cellWidth;
+    size_t rowCount = m_currCanvas.getHeight() / m_cellHeight;
+    bool hasStaleSpans = false;
+    bool hasErased = false;
+    for (const TextSpan& prevSpan : m_prevTextSpans) {
+        bool isStale = true;
+        for (const TextSpan& span : m_textSpans) {
+            if (span == prevSpan) {
+                isStale = false;
+                break;
             }
         }
+        if (!isStale) {
+            continue;
+        }
+        size_t row = static_cast<size_t>(prevSpan.y - 1);
+        size_t startCol = static_cast<size_t>(prevSpan.x - 1);
+        if (isErasing && row < rowCount && startCol < colCount) {
+            if (!hasErased) {
+                m_term.resetFGAndBG();
+                hasErased = true;
+            }
+            size_t len = std::min(prevSpan.text.size(), colCount - startCol);
+            m_term.setCursor(prevSpan.x, prevSpan.y);
+            m_term.writeText(std::string(len, ' '));
+        }
+        hasStaleSpans = true;
+        for (size_t i = 0; i < prevSpan.text.size() && row < rowCount; i++) {
+            if (startCol + i < colCount) {
+                m_dirtyCells.at(startCol + i + row * colCount) = true;
+            }
+        }
+    }
+    return hasStaleSpans;
+}
+
+// True while everything drawn so far this frame was drawn the same way in the
+// previous one. A lossy diff keeps what is shown in the previous canvas
+// instead of what was drawn, its columns can't be reused.
+bool Canvas::isSceneUnchanged() const {
+    return m_diffThreshold == 0
+        && m_sceneKey.size() <= m_prevSceneKey.size()
+        && std::equal(m_sceneKey.begin(), m_sceneKey.end(), m_prevSceneKey.begin());
+}
+
+// Cell columns whose pixel columns were all drawn as in the previous frame,
+// they need no diff
+std::vector<bool> Canvas::getUnchangedCellColumns() const {
+    size_t colCount = m_currCanvas.getWidth() / m_cellWidth;
+    std::vector<bool> unchangedCols(colCount, false);
+    if (m_sceneKey != m_prevSceneKey || !isSceneUnchanged()
+        || m_flagColumns.size() != m_prevFlagColumns.size()) {
+        return unchangedCols;
+    }
+    for (size_t col = 0; col < colCount; col++) {
+        bool isUnchanged = true;
+        for (size_t x = col * m_cellWidth; x < (col + 1) * m_cellWidth && isUnchanged; x++) {
+            isUnchanged = m_flagColumns.at(x) == m_prevFlagColumns.at(x);
+        }
+        unchangedCols.at(col) = isUnchanged;
     }
+    return unchangedCols;
+}
+
+void Canvas::drawRect(std::pair<int, int> origin, std::pair<size_t, size_t> size, Color fill) {
+    m_sceneKey.insert(m_sceneKey.end(), {
+        origin.first, origin.second, static_cast<int>(size.first), static_cast<int>(size.second),
+        fill.r, fill.g, fill.b, fill.a
+    });
+    m_currCanvas.fillRect(origin.first, origin.second, size.first, size.second, fill);
 }
 
 // TODO: Make it so parameters of the sinewave are scaled according to the base
 // size. For example if base size is 16 and flag is 32 pixels wide, then
 // everything should be twice as large. Also make base size 2D.
+// NOTE: Flag pixels are scaled to cover the same area as a half block pixel,
+// glyphs with more pixels per cell draw the waves in finer steps
 void Canvas::drawWavedImage(
     const Image& img,
     std::pair<int, int> origin,
@@ -85,81 +985,310 @@ void Canvas::drawWavedImage(
     float ambientLight,
     float time
 ) {
-    int yPadding = waveConfig.getTotalAmpl();
-
-    float yShiftPrev = 0;
-    float yShiftCurr = 0;
-    float yShiftNext = 0;
-    float yShiftSecNext = 0;
-
-    // NOTE: Start from -3 so that when we get to 0, necessary values of yShifts are ready
-    for (int x = -3; x < static_cast<int>(img.getWidth()); x++) {
-        yShiftPrev = yShiftCurr;
-        yShiftCurr = yShiftNext;
-        yShiftNext = yShiftSecNext;
-        yShiftSecNext = 0;
-        int secNextX = x + 2;
-
-        for (size_t i = 0; i < waveConfig.waves.size(); i++) {
-            const SineWave& w = waveConfig.waves.at(i);
-            float secNextAngle = 2 * static_cast<float>(PI)
-                * (secNextX - time * waveConfig.speedMultiplier * w.speed) / w.wavelength + w.phase;
-            yShiftSecNext += w.amplitude * sin(secNextAngle) * waveConfig.amplitudeMultiplier;
-        }
-
-        if (waveConfig.keepLeftFixed) {
-            yShiftSecNext *= static_cast<float>(secNextX) / (img.getWidth() - 1)
-                * (secNextX < 0 ? -1 : 1);
-            // TODO: Make this a flag in WaveConfig
-            float xNormal = static_cast<float>(secNextX) / (img.getWidth() - 1);
-            float gravity = 1.0f * xNormal * waveConfig.gravityMultiplier;
-            yShiftNext += gravity;
-        }
-
-        if (x < 0) {
-            continue;
+    int scaleX = static_cast<int>(m_cellWidth);
+    float scaleY = m_cellHeight / 2.0f;
+    int yPadding = static_cast<int>(round(waveConfig.getTotalAmpl() * scaleY));
+    int width = static_cast<int>(img.getWidth()) * scaleX;
+    size_t height = static_cast<size_t>(round(img.getHeight() * scaleY));
+
+    std::vector<ColumnShape> shapes;
+    getColumnShapes(img, origin.second, waveConfig, ambientLight, time, m_isFixedPoint, &shapes);
+
+    // Columns that would come out as they were in the previous frame are
+    // copied from it instead of drawn again
+    m_sceneKey.insert(m_sceneKey.end(), {
+        origin.first, origin.second, width, static_cast<int>(height), yPadding
+    });
+    bool isReusingColumns = isSceneUnchanged();
+    // A flag that kept its generation is the same flag, only a new one is
+    // compared pixel by pixel
+    std::vector<bool> changedImgCols(img.getWidth(), false);
+    if (img.getGeneration() != m_prevFlag.getGeneration()) {
+        std::vector<Color> rowBuffer;
+        std::vector<Color> prevRowBuffer;
+        if (img.getSize() != m_prevFlag.getSize()) {
+            changedImgCols.assign(img.getWidth(), true);
+        }
+        else {
+            for (size_t imgY = 0; imgY < img.getHeight(); imgY++) {
+                const Color* row = img.getRowColors(imgY, &rowBuffer);
+                const Color* prevRow = m_prevFlag.getRowColors(imgY, &prevRowBuffer);
+                for (size_t imgX = 0; imgX < img.getWidth(); imgX++) {
+                    if (!(row[imgX] == prevRow[imgX])) {
+                        changedImgCols[imgX] = true;
+                    }
+                }
+            }
+        }
+        m_prevFlag = img;
+        m_flagPlanes.assign(img);
+    }
+
+    // Flag rows the canvas rows show, with sextants some show the same one
+    std::vector<size_t> imgRows(height);
+    for (size_t y = 0; y < height; y++) {
+        imgRows.at(y) = std::min(img.getHeight() - 1, static_cast<size_t>(y / scaleY));
+    }
+    bool isRowPerPixel = height == img.getHeight();
+    std::vector<Color> topBuffer;
+    std::vector<Color> bottomBuffer;
+    const Color* topColors = img.getRowColors(0, &topBuffer);
+    const Color* bottomColors = img.getRowColors(img.getHeight() - 1, &bottomBuffer);
+    std::vector<Color> shadedColumn(img.getHeight());
+    std::vector<Color> scaledColumn(height);
+
+    for (int x = 0; x < width; x++) {
+        const ColumnShape& shape = shapes.at(x);
+        int yStart = shape.yStart;
+        int light = shape.light;
+        int topRow = shape.topRow;
+        int bottomRow = shape.bottomRow;
+        float lightLevel = 0;
+        uint32_t fixedLight = 0;
+        if (m_isFixedPoint) {
+            fixedLight = static_cast<uint32_t>(light * SHADING_FIXED_ONE / FLAG_LIGHT_LEVELS);
+        }
+        else {
+            lightLevel = static_cast<float>(light) / FLAG_LIGHT_LEVELS;
+        }
+
+        // The cells the top and bottom edges fall in show the exact shift in
+        // eighths of a cell, over what was there before the flag
+        int targetX = origin.first + x;
+        bool isSmoothingColumn = m_isSmoothingEdges && m_glyphMode == GlyphMode::HALF
+            && m_backend == RenderBackend::CELLS
+            && targetX >= 0 && targetX < static_cast<int>(m_currCanvas.getWidth());
+        Color aboveColor;
+        Color belowColor;
+        if (isSmoothingColumn) {
+            int canvasHeight = static_cast<int>(m_currCanvas.getHeight());
+            if (topRow >= 0 && topRow * 2 < canvasHeight) {
+                aboveColor = m_currCanvas.getRow(topRow * 2)[targetX];
+            }
+            if (bottomRow >= 0 && bottomRow * 2 + 1 < canvasHeight) {
+                belowColor = m_currCanvas.getRow(bottomRow * 2 + 1)[targetX];
+            }
+        }
+
+        bool hasEdges = isSmoothingColumn && topRow != bottomRow;
+        int topEighths = hasEdges ? shape.topEighths : 0;
+        int bottomEighths = hasEdges ? shape.bottomEighths : 0;
+
+        bool isColumnReused = false;
+        if (targetX >= 0 && targetX < static_cast<int>(m_currCanvas.getWidth())) {
+            FlagColumn& column = m_flagColumns.at(targetX);
+            // NOTE: Overlapping flags would have to be drawn in order
+            column.isKeyed = !column.isDrawn && !changedImgCols.at(x / scaleX);
+            column.isDrawn = true;
+            column.imgX = x / scaleX;
+            column.yStart = yStart;
+            column.light = light;
+            column.topRow = hasEdges ? topRow : 0;
+            column.topEighths = topEighths;
+            column.bottomRow = hasEdges ? bottomRow : 0;
+            column.bottomEighths = bottomEighths;
+            isColumnReused = isReusingColumns && column == m_prevFlagColumns.at(targetX);
+        }
+
+        int top = origin.second + yStart;
+        int yBegin = std::max(0, top);
+        int yEnd = std::min(static_cast<int>(m_currCanvas.getHeight()), top + static_cast<int>(height));
+        bool isColumnVisible = targetX >= 0 && targetX < static_cast<int>(m_currCanvas.getWidth())
+            && yBegin < yEnd;
+        if (isColumnVisible && isColumnReused) {
+            m_currCanvas.blitColumn(
+                targetX, yBegin, m_prevCanvas.getRow(yBegin) + targetX, yEnd - yBegin, m_prevCanvas.getWidth()
+            );
+        }
+        else if (isColumnVisible) {
+            if (m_isFixedPoint) {
+                Shading::shadeColumnFixed(m_flagPlanes, x / scaleX, fixedLight, shadedColumn.data());
+            }
+            else {
+                Shading::shadeColumn(m_flagPlanes, x / scaleX, lightLevel, shadedColumn.data());
+            }
+            const Color* column = shadedColumn.data();
+            if (!isRowPerPixel) {
+                for (size_t y = 0; y < height; y++) {
+                    scaledColumn[y] = shadedColumn[imgRows[y]];
+                }
+                column = scaledColumn.data();
+            }
+            m_currCanvas.blitColumn(targetX, top, column, height);
+        }
+
+        if (hasEdges) {
+            Color topColor = topColors[x];
+            Color bottomColor = bottomColors[x];
+            if (m_isFixedPoint) {
+                topColor = Shading::shadePixelFixed(topColor, fixedLight);
+                bottomColor = Shading::shadePixelFixed(bottomColor, fixedLight);
+            }
+            else {
+                topColor = topColor * lightLevel;
+                bottomColor = bottomColor * lightLevel;
+            }
+            setEdge(targetX, topRow, topEighths, topColor, aboveColor);
+            setEdge(targetX, bottomRow, bottomEighths, belowColor, bottomColor);
+        }
+    }
+}
+
+// Shape of every canvas column of the flag, drawn at originY. The fixed
+// point one follows the float one step by step in integers, its light
+// levels and positions are at most a step off.
+void Canvas::getColumnShapes(
+    const Image& img,
+    int originY,
+    const WaveConfig& waveConfig,
+    float ambientLight,
+    float time,
+    bool isFixedPoint,
+    std::vector<ColumnShape>* outShapes
+) const {
+    int scaleX = static_cast<int>(m_cellWidth);
+    float scaleY = m_cellHeight / 2.0f;
+    int yPadding = static_cast<int>(round(waveConfig.getTotalAmpl() * scaleY));
+    int width = static_cast<int>(img.getWidth()) * scaleX;
+    size_t height = static_cast<size_t>(round(img.getHeight() * scaleY));
+    outShapes->resize(width);
+
+    // Shifts of every column from one flag pixel before the flag to two
+    // after, with and without gravity
+    if (isFixedPoint) {
+        std::vector<int32_t> waveShifts(width + 3 * scaleX);
+        std::vector<int32_t> shifts(waveShifts.size());
+        FixedWave::getShifts(
+            waveConfig, img.getWidth(), time, scaleX, waveShifts.size(), waveShifts.data(), shifts.data()
+        );
+        int ambientLevel = static_cast<int>(round(ambientLight * FLAG_LIGHT_LEVELS));
+        int64_t edgeOffset = static_cast<int64_t>(originY + yPadding) * FIXED_ONE;
+        int64_t edgeHeight = static_cast<int64_t>(height) * FIXED_ONE;
+        for (int x = 0; x < width; x++) {
+            int64_t yShiftPrev = shifts.at(x);
+            int64_t yShiftCurr = shifts.at(x + scaleX);
+            int64_t yShiftNext = shifts.at(x + 2 * scaleX);
+            int64_t yShiftSecNext = waveShifts.at(x + 3 * scaleX);
+
+            // The slopes weighed by 0.15, 0.7 and 0.15 in 256ths, each slope
+            // being half the difference
+            int64_t slope = (
+                38 * (yShiftCurr - yShiftPrev)
+                + 180 * (yShiftNext - yShiftCurr)
+                + 38 * (yShiftSecNext - yShiftNext)
+            ) >> 9;
+            int64_t lightFixed = FixedWave::getLight(static_cast<int32_t>(slope));
+
+            // Rounded to the nearest by adding a half before shifting down
+            ColumnShape& shape = outShapes->at(x);
+            shape.yStart = yPadding + static_cast<int>(
+                (yShiftCurr * static_cast<int64_t>(m_cellHeight) + FIXED_ONE) >> (FIXED_SHIFT + 1)
+            );
+            shape.light = std::max(ambientLevel, static_cast<int>(
+                (lightFixed * FLAG_LIGHT_LEVELS + FIXED_ONE / 2) >> FIXED_SHIFT
+            ));
+
+            // Edges in cells of two pixels, eighths are quarter pixels
+            int64_t edgeTop = edgeOffset + yShiftCurr;
+            int64_t edgeBottom = edgeTop + edgeHeight;
+            shape.topRow = static_cast<int>(edgeTop >> (FIXED_SHIFT + 1));
+            shape.bottomRow = static_cast<int>(edgeBottom >> (FIXED_SHIFT + 1));
+            int64_t topRowEnd = static_cast<int64_t>(shape.topRow + 1) * 2 * FIXED_ONE;
+            int64_t bottomRowStart = static_cast<int64_t>(shape.bottomRow) * 2 * FIXED_ONE;
+            shape.topEighths = static_cast<int>(
+                (topRowEnd - edgeTop + (FIXED_ONE / 8)) >> (FIXED_SHIFT - 2)
+            );
+            shape.bottomEighths = 8 - static_cast<int>(
+                (edgeBottom - bottomRowStart + (FIXED_ONE / 8)) >> (FIXED_SHIFT - 2)
+            );
         }
+        return;
+    }
+
+    std::vector<float> waveShifts(width + 3 * scaleX);
+    std::vector<float> shifts(waveShifts.size());
+    WaveKernel::select(waveConfig)(
+        WaveKernel::getParams(waveConfig, img.getWidth(), time),
+        scaleX,
+        waveShifts.size(),
+        waveShifts.data(),
+        shifts.data()
+    );
+    for (int x = 0; x < width; x++) {
+        float yShiftPrev = shifts.at(x);
+        float yShiftCurr = shifts.at(x + scaleX);
+        float yShiftNext = shifts.at(x + 2 * scaleX);
+        // NOTE: The furthest sample never had gravity added, keep it that way
+        // so the shading doesn't change
+        float yShiftSecNext = waveShifts.at(x + 3 * scaleX);
 
         float prevSlope = (yShiftCurr - yShiftPrev) / 2;
         float currSlope = (yShiftNext - yShiftCurr) / 2;
         float nextSlope = (yShiftSecNext - yShiftNext) / 2;
         float slope = 0.15f * prevSlope + 0.7f * currSlope + 0.15f * nextSlope;
-        int yStart = yPadding + static_cast<int>(round(yShiftCurr));
         float tangentLen = sqrt(1 + slope*slope);
         float normalX = -1 * slope / tangentLen;
         float normalY = 1 / tangentLen;
         float lightX = 1 / sqrt(2.0f);
         float lightY = -1 / sqrt(2.0f);
-        float lightLevel = fmax(ambientLight, normalX * -lightX + normalY * -lightY);
-
-        for (size_t y = 0; y < img.getHeight(); y++) {
-            Color color = img.getPixel(x, y) * lightLevel;
-            int targetX = origin.first + x;
-            int targetY = origin.second + yStart + static_cast<int>(y);
-            if (static_cast<int>(m_currCanvas.getHeight()) > targetY && targetY >= 0
-                && static_cast<int>(m_currCanvas.getWidth()) > targetX && targetX >= 0) {
-                m_currCanvas.setPixel(origin.first + x, origin.second + yStart + y, color);
-            }
-        }
+
+        ColumnShape& shape = outShapes->at(x);
+        shape.yStart = yPadding + static_cast<int>(round(yShiftCurr * scaleY));
+        shape.light = static_cast<int>(round(
+            fmax(ambientLight, normalX * -lightX + normalY * -lightY) * FLAG_LIGHT_LEVELS
+        ));
+
+        float edgeTop = originY + yPadding + yShiftCurr;
+        float edgeBottom = edgeTop + height;
+        shape.topRow = static_cast<int>(floor(edgeTop / 2));
+        shape.bottomRow = static_cast<int>(floor(edgeBottom / 2));
+        shape.topEighths = static_cast<int>(round((2 * (shape.topRow + 1) - edgeTop) * 4));
+        shape.bottomEighths = 8 - static_cast<int>(round((edgeBottom - 2 * shape.bottomRow) * 4));
     }
 }
 
-void Canvas::drawSceneFlagOnly(
+// Edges that land exactly on a cell border need no smoothing
+void Canvas::setEdge(int x, int y, int eighths, Color lowerColor, Color upperColor) {
+    int colCount = static_cast<int>(m_currCanvas.getWidth() / m_cellWidth);
+    int rowCount = static_cast<int>(m_currCanvas.getHeight() / m_cellHeight);
+    if (eighths <= 0 || eighths >= 8 || x < 0 || x >= colCount || y < 0 || y >= rowCount) {
+        return;
+    }
+    CellEdge& edge = m_edges.at(x + y * colCount);
+    edge.eighths = static_cast<uint8_t>(eighths);
+    edge.lowerColor = lowerColor;
+    edge.upperColor = upperColor;
+}
+
+std::pair<int, int> Canvas::getFlagOrigin(
     const Image& img,
     const WaveConfig& waveConfig,
     float hPosNormal,
-    float vPosNormal,
-    float ambientLight,
-    float time
-) {
-    std::pair<int, int> origin(
+    float vPosNormal
+) const {
+    float scaleY = m_cellHeight / 2.0f;
+    size_t width = img.getWidth() * m_cellWidth;
+    size_t height = static_cast<size_t>(round(img.getHeight() * scaleY));
+    int totalAmpl = static_cast<int>(round(waveConfig.getTotalAmpl() * scaleY));
+    return std::pair<int, int>(
         static_cast<int>(
-            m_currCanvas.getWidth() * hPosNormal - img.getWidth()/2
+            m_currCanvas.getWidth() * hPosNormal - width/2
         ),
         static_cast<int>(
-            m_currCanvas.getHeight() * vPosNormal - img.getHeight()/2 - waveConfig.getTotalAmpl()
+            m_currCanvas.getHeight() * vPosNormal - height/2 - totalAmpl
         )
     );
+}
+
+void Canvas::drawSceneFlagOnly(
+    const Image& img,
+    const WaveConfig& waveConfig,
+    float hPosNormal,
+    float vPosNormal,
+    float ambientLight,
+    float time
+) {
+    std::pair<int, int> origin = getFlagOrigin(img, waveConfig, hPosNormal, vPosNormal);
     drawWavedImage(img, origin, waveConfig, ambientLight, time);
 }
 
@@ -171,23 +1300,17 @@ void Canvas::drawSceneFlagAndPole(
     float ambientLight,
     float time
 ) {
-    std::pair<int, int> origin(
-        static_cast<int>(
-            m_currCanvas.getWidth() * hPosNormal - img.getWidth()/2
-        ),
-        static_cast<int>(
-            m_currCanvas.getHeight() * vPosNormal - img.getHeight()/2 - WaveConfig.getTotalAmpl()
-        )
-    );
+    std::pair<int, int> origin = getFlagOrigin(img, WaveConfig, hPosNormal, vPosNormal);
     drawWavedImage(img, origin, WaveConfig, ambientLight, time);
+    int poleWidth = static_cast<int>(m_cellWidth);
     drawRect(
-        std::pair<int, int>(origin.first - 1, origin.second),
-        std::pair<int, int>(1, static_cast<int>(m_currCanvas.getHeight()) - origin.second),
+        std::pair<int, int>(origin.first - poleWidth, origin.second),
+        std::pair<int, int>(poleWidth, static_cast<int>(m_currCanvas.getHeight()) - origin.second),
         Color(240, 240, 240)
     );
     drawRect(
-        std::pair<int, int>(origin.first - 2, origin.second),
-        std::pair<int, int>(1, static_cast<int>(m_currCanvas.getHeight()) - origin.second),
+        std::pair<int, int>(origin.first - 2 * poleWidth, origin.second),
+        std::pair<int, int>(poleWidth, static_cast<int>(m_currCanvas.getHeight()) - origin.second),
         Color(220, 220, 220)
     );
 }
@@ -234,7 +1357,6 @@ void Canvas::drawSceneFlagPoleAndMsg(
     }
 
     drawSceneFlagAndPole(img, waveConfig, 0.34f, 0.34f, ambientLight, time);
-    m_term.usePreferredFGandBG();
 
     std::pair<size_t, size_t> termSize = m_term.getSize();
     int textOriginY = static_cast<int>(termSize.second / 3 * 2 - lnBounds.size() / 2 + 1);
@@ -250,34 +1372,10 @@ void Canvas::drawSceneFlagPoleAndMsg(
         size_t lineLen = lnBounds.at(i).second - lnBounds.at(i).first;
         int lineXCursor = textCenterX - static_cast<int>(lineLen) / 2;
         int lineYCursor = textOriginY + static_cast<int>(i);
-        m_term.setCursor(lineXCursor, lineYCursor);
-        m_term.getStream() << msg.substr(lnBounds.at(i).first, lineLen);
-    }
-}
-
-void Canvas::outputPixelPair(std::pair<size_t, size_t> topPixel) {
-    Color topColor = m_currCanvas.getPixel(topPixel.first, topPixel.second);
-    Color bottomColor = Color();
-    if (m_currCanvas.getHeight() > topPixel.second + 1) {
-        bottomColor = m_currCanvas.getPixel(topPixel.first, topPixel.second + 1);
-    }
-
-    if (topColor.a && bottomColor.a) {
-        m_term.setFGAndBG(topColor, bottomColor);
-        m_term.getStream() << TOP_HALF_CHAR;
-    }
-    else if (topColor.a) {
-        m_term.usePreferredFGandBG();
-        m_term.setFG(topColor);
-        m_term.getStream() << TOP_HALF_CHAR;
-    }
-    else if (bottomColor.a) {
-        m_term.usePreferredFGandBG();
-        m_term.setFG(bottomColor);
-        m_term.getStream() << BOTTOM_HALF_CHAR;
-    }
-    else {
-        m_term.usePreferredFGandBG();
-        m_term.getStream() << " ";
+        TextSpan span;
+        span.x = lineXCursor;
+        span.y = lineYCursor;
+        span.text = msg.substr(lnBounds.at(i).first, lineLen);
+        m_textSpans.push_back(span);
     }
 }
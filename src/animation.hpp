@@ -1,21 +1,50 @@
 #pragma once
 #include <utility>
+#include <string>
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <unordered_map>
 #include "terminal.hpp"
 #include "image.hpp"
+#include "kittygraphics.hpp"
+#include "sixelgraphics.hpp"
+#include "shading.hpp"
 
 #define PI 3.14159265358979323846
-#define ROWS_PER_CHAR 2
+#define LOSSY_DIFF_REFRESH_FRAMES 48
+#define MAX_PIXELS_PER_CELL 6
+#define CELL_FIT_CACHE_MAX_ENTRIES 8192
+// Steps the flag's shading is rounded to, so that a slowly turning column
+// keeps its colors for a while
+#define FLAG_LIGHT_LEVELS 64
 
 #ifdef _WIN32
-    #define FULL_BLOCK_CHAR  static_cast<char>(219)
-    #define TOP_HALF_CHAR    static_cast<char>(223)
-    #define BOTTOM_HALF_CHAR static_cast<char>(220)
+    #define FULL_BLOCK_CHAR  "\xDB"
+    #define TOP_HALF_CHAR    "\xDF"
+    #define BOTTOM_HALF_CHAR "\xDC"
 #else
     #define FULL_BLOCK_CHAR  "\u2588"
     #define TOP_HALF_CHAR    "\u2580"
     #define BOTTOM_HALF_CHAR "\u2584"
 #endif
 
+// How many pixels a cell holds. Half blocks split it vertically in 2, quadrant
+// blocks in 2x2 and sextant blocks in 2x3.
+enum class GlyphMode {
+    HALF,
+    QUADRANT,
+    SEXTANT
+};
+
+// How the canvas gets to the terminal, as colored character cells or as
+// images through a graphics protocol
+enum class RenderBackend {
+    CELLS,
+    KITTY,
+    SIXEL
+};
+
 struct SineWave {
     float amplitude;
     float wavelength;
@@ -36,14 +65,114 @@ struct WaveConfig {
     int getTotalAmpl() const;
 };
 
+struct TextSpan {
+    int x;
+    int y;
+    std::string text;
+
+    bool operator==(const TextSpan& other) const;
+};
+
+// Colors of a cell as they would be sent. Pixels whose bit is set in the mask
+// (row-major from the top left) show maskColor, the rest show restColor.
+// Transparent pixels show the preferred background. Cells of a single color
+// have an empty mask. Smoothed edge cells instead show maskColor in their
+// lower eighths.
+struct CellColors {
+    TermColor maskColor;
+    TermColor restColor;
+    bool isMaskBG;
+    bool isRestBG;
+    uint8_t mask;
+    uint8_t eighths;
+
+    bool isUniform() const;
+    bool operator==(const CellColors& other) const;
+};
+
+// A cell on the flag's top or bottom edge, drawn with a lower eighth block
+// so that the edge moves by less than a pixel. Cells with 0 eighths are
+// drawn from their pixels.
+struct CellEdge {
+    uint8_t eighths;
+    Color lowerColor;
+    Color upperColor;
+
+    bool operator==(const CellEdge& other) const;
+};
+
+// What a pixel column of the canvas was drawn from by drawWavedImage. Over an
+// unchanged scene, a column drawn from an equal key holds the same pixels and
+// edges as before. Columns without a flag compare equal to each other,
+// columns that can't be told apart by the key (the flag image changed, or two
+// flags overlap) never compare equal.
+struct FlagColumn {
+    bool isDrawn;
+    bool isKeyed;
+    int imgX;
+    int yStart;
+    int light;
+    int topRow;
+    int topEighths;
+    int bottomRow;
+    int bottomEighths;
+
+    bool operator==(const FlagColumn& other) const;
+};
+
+// Where drawWavedImage puts a flag column and how lit it is. The edges are
+// the rows the flag's top and bottom fall in and how many eighths of those
+// cells the flag covers from below.
+struct ColumnShape {
+    int yStart;
+    int light;
+    int topRow;
+    int topEighths;
+    int bottomRow;
+    int bottomEighths;
+};
+
+// Best two colors for a cell's pixels, a transparent color stands for the
+// background
+struct CellFit {
+    uint8_t mask;
+    Color maskColor;
+    Color restColor;
+};
+
+struct CellPixels {
+    std::array<uint32_t, MAX_PIXELS_PER_CELL> packed;
+
+    bool operator==(const CellPixels& other) const;
+};
+
+struct CellPixelsHash {
+    size_t operator()(const CellPixels& pixels) const;
+};
+
+struct CellCandidate {
+    const char* glyph;
+    TermColor fg;
+    TermColor bg;
+    bool isReversed;
+};
+
 class Canvas {
 public:
     Canvas(Canvas& other) = delete;
     void operator=(const Canvas&) = delete;
     static Canvas& getInstance();
 
+    void setDithering(bool isEnabled);
+    void setDiffThreshold(int threshold);
+    void setGlyphMode(GlyphMode mode);
+    void setEdgeSmoothing(bool isEnabled);
+    void setBackend(RenderBackend backend);
+    void setFixedPoint(bool isEnabled);
+    void releaseGraphics();
     void beginDrawing(Color bg = Color());
     void endDrawing();
+    void assumeDrawn();
     void drawRect(std::pair<int, int> origin, std::pair<size_t, size_t>, Color fill);
     void drawWavedImage(
         const Image& img,
@@ -75,12 +204,98 @@ public:
         const std::string& msg,
         float time
     );
-    void outputPixelPair(std::pair<size_t, size_t> topPixel);
+    void getColumnShapes(
+        const Image& img,
+        int originY,
+        const WaveConfig& waveConfig,
+        float ambientLight,
+        float time,
+        bool isFixedPoint,
+        std::vector<ColumnShape>* outShapes
+    ) const;
+    // What the last frame should look like on the screen, to check output
+    // against. Colors are in one form per look, see normalizeColors.
+    std::pair<size_t, size_t> getCellCount() const;
+    const std::vector<TextSpan>& getTextSpans() const;
+    CellColors getExpectedColors(size_t x, size_t row) const;
+    bool readCellColors(
+        const std::string& glyph,
+        TermColor fg,
+        TermColor bg,
+        bool isReversed,
+        CellColors* outColors
+    ) const;
 private:
+    // NOTE: The tests price and replay each way of encoding a frame
+    friend class SelfCheck;
+
     Image m_prevCanvas;
     Image m_currCanvas;
     TerminalController& m_term;
+    bool m_isDithering;
+    GlyphMode m_glyphMode;
+    bool m_isSmoothingEdges;
+    RenderBackend m_backend;
+    bool m_isFixedPoint;
+    KittyEncoder m_kitty;
+    SixelEncoder m_sixel;
+    size_t m_cellWidth;
+    size_t m_cellHeight;
+    // Glyph for each mask of lit pixels
+    std::vector<std::string> m_glyphs;
+    mutable std::unordered_map<CellPixels, CellFit, CellPixelsHash> m_fitCache;
+    int m_diffThreshold;
+    uint64_t m_frameCount;
+    // Message text is written to the terminal directly after the canvas, at
+    // 1-based cursor positions
+    std::vector<TextSpan> m_textSpans;
+    std::vector<TextSpan> m_prevTextSpans;
+    std::vector<bool> m_dirtyCells;
+    std::vector<CellEdge> m_edges;
+    std::vector<CellEdge> m_prevEdges;
+    // What the frame was drawn with, besides the flag columns. While it matches
+    // the previous frame's, columns equal in m_flagColumns aren't drawn again
+    // or diffed.
+    std::vector<int> m_sceneKey;
+    std::vector<int> m_prevSceneKey;
+    std::vector<FlagColumn> m_flagColumns;
+    std::vector<FlagColumn> m_prevFlagColumns;
+    // Copy of the last waved image, to tell which of its columns changed, and
+    // its channels for shading
+    Image m_prevFlag;
+    ColumnPlanes m_flagPlanes;
 
     Canvas();
     ~Canvas() = default;
+    void relayoutPrevCanvas();
+    bool clearStaleTextSpans(bool isErasing);
+    bool isSceneUnchanged() const;
+    std::vector<bool> getUnchangedCellColumns() const;
+    std::pair<int, int> getFlagOrigin(
+        const Image& img,
+        const WaveConfig& waveConfig,
+        float hPosNormal,
+        float vPosNormal
+    ) const;
+    static bool areColorsClose(Color a, Color b, int threshold);
+    size_t encodeRow(size_t row, TermState& state, std::string* out);
+    size_t rewriteRow(size_t row, TermState& state, std::string* out, size_t maxCost = SIZE_MAX);
+    size_t encodeRowCells(size_t row, bool isAfterClear, TermState& state, std::string* out);
+    size_t encodeFullFrame(TermState& state, std::string* out, size_t maxCost = SIZE_MAX);
+    size_t encodeRun(size_t x, size_t row, size_t len, TermState& state, std::string* out);
+    size_t eraseRun(
+        size_t x,
+        size_t row,
+        size_t len,
+        TermColor bg,
+        TermState& state,
+        std::string* out
+    );
+    size_t encodeCell(size_t x, size_t row, TermState& state, std::string* out);
+    size_t getRunLength(size_t x, size_t row) const;
+    CellColors getCellColors(size_t x, size_t row) const;
+    CellColors normalizeColors(CellColors colors) const;
+    static CellFit fitCell(const Color* pixels, size_t count);
+    void setEdge(int x, int y, int eighths, Color lowerColor, Color upperColor);
+    bool isCellBlank(size_t x, size_t row) const;
 };
@@ -3,9 +3,13 @@
 #include <filesystem>
 #include <string>
 #include <algorithm>
+#include <fstream>
 #include "stb_image.h"
 #include "image.hpp"
 #include "animation.hpp"
+#include "playlist.hpp"
+#include "loopcache.hpp"
+#include "bakedanimation.hpp"
 #include "config.hpp"
 #ifdef _WIN32
     #include <windows.h>
@@ -20,10 +24,15 @@ ArgParser::ArgParser(int argc, const char** argv)
     setDefaults();
     setAssetsDir();
     parseAll();
-    if (m_shouldExitFail || m_shouldExitSuccess) {
+    if (m_shouldExitFail || m_shouldExitSuccess || !m_conf.playPath.empty()) {
         return;
     }
     checkRequiredFields();
+    checkLoop();
+    if (m_shouldExitFail) {
+        return;
+    }
+    loadFlag();
 }
 
 AppConfig ArgParser::getAppConfig() {
@@ -135,7 +144,13 @@ void ArgParser::printHelp() {
         "USAGE: wavet [options...]\n"
         "OPTIONS:\n"
         "  --help, -h, -?                      Print this\n"
-        "  --flag, -f {name or path}           Flag to wave\n"
+        "  --flag, -f {name or path}           Flag to wave. Can be used multiple times\n"
+        "                                      to cycle through flags\n"
+        "  --playlist, -p {file}               Cycle through flags listed in file, one\n"
+        "                                      name or path per line\n"
+        "  --interval, -i {seconds}            Time each flag is shown when cycling\n"
+        "  --transition, -T {none|fade|wipe}   Transition used when cycling flags\n"
+        "  --transition-time {seconds}         Duration of the transition\n"
         "  --list, -l                          List available flag names\n"
         "  --float, -F                         Do not fix the left side of the flag\n"
         "  --gravity, -g {scale}               Set gravity multiplier\n"
@@ -143,6 +158,29 @@ void ArgParser::printHelp() {
         "  --ambient, -a {0 to 1 (e.g 0.5)}    Set ambient light\n"
         "  --background, -b {r} {g} {b}        Set background color\n"
         "  --speed, -s {scale}                 Set speed multiplier\n"
+        "  --fps, -r {frames per second}       Set frame rate (default 24)\n"
+        "  --colors, -C {auto|truecolor|256|16}\n"
+        "                                      Set color escape codes to use\n"
+        "  --dither, -d                        Dither colors in 256 and 16 color modes\n"
+        "  --threshold, -e {distance}          Don't redraw cells whose color changed less\n"
+        "                                      than this (e.g 6). Saves bandwidth\n"
+        "  --loop, -L {pixels}                 Draw one loop of the waves, then resend it\n"
+        "                                      instead of drawing. The loop may jump by\n"
+        "                                      this much where it restarts (e.g 0.5)\n"
+        "  --glyphs, -G {half|quadrant|sextant}\n"
+        "                                      Set block characters used to draw, quadrant\n"
+        "                                      and sextant ones show finer waves\n"
+        "  --smooth-edges, -E                  Move the flag's top and bottom edges in\n"
+        "                                      eighths of a cell (half blocks only)\n"
+        "  --backend, -B {cells|kitty|sixel}   Draw with colored cells or send images with\n"
+        "                                      the kitty graphics protocol or as sixels\n"
+        "  --math, -M {float|fixed}            Draw the flag with floating point or integer\n"
+        "                                      math, fixed is faster without a good FPU\n"
+        "  --bake, -K {file} {cols} {rows}     Encode one loop of the waves for a terminal\n"
+        "                                      of this size into file, then exit. Uses\n"
+        "                                      --loop, or 0.5 pixels without it\n"
+        "  --play, -P {file}                   Play a file made with --bake, other options\n"
+        "                                      are ignored\n"
         "  --wave, -w {ampl.} {wavelen.} {phase} {speed}\n"
         "                                      Add wave. Can be used multiple times\n"
         "  --simple, -S                        Draw flag only\n"
@@ -150,6 +188,8 @@ void ArgParser::printHelp() {
         "  --horizontal-pos, -H {0 to 100}     Horizontal position of the flag's center\n"
         "  --message, -m {text}                Print a message. Overrides -S, -V and -H\n"
         "  --text-color, -t {r} {g} {b}        Set text color for message\n"
+        "  --shared-cache, -c                  Share decoded flags with other wavet\n"
+        "                                      instances through shared memory\n"
     ;
     std::cout << msg;
 }
@@ -175,6 +215,28 @@ void ArgParser::setDefaults() {
     m_conf.fancyScene = true;
     m_conf.msg = std::string();
     m_conf.waveConfig = waveConfig;
+    m_conf.useSharedCache = false;
+    m_conf.flagPaths = std::vector<std::string>();
+    m_conf.playlistInterval = 10;
+    m_conf.transitionType = TransitionType::FADE;
+    m_conf.transitionTime = 1;
+    m_conf.fps = 24;
+    m_conf.colorMode = ColorMode::AUTO;
+    m_conf.dither = false;
+    m_conf.diffThreshold = 0;
+    m_conf.glyphMode = GlyphMode::HALF;
+    m_conf.smoothEdges = false;
+    m_conf.backend = RenderBackend::CELLS;
+#ifdef WAVET_FIXED_POINT
+    m_conf.isFixedPoint = true;
+#else
+    m_conf.isFixedPoint = false;
+#endif
+    m_conf.loopTolerance = 0;
+    m_conf.loopFrames = 0;
+    m_conf.bakePath = std::string();
+    m_conf.bakeSize = std::pair<int, int>(0, 0);
+    m_conf.playPath = std::string();
 }
 
 void ArgParser::setAssetsDir() {
@@ -210,13 +272,47 @@ void ArgParser::setAssetsDir() {
 }
 
 void ArgParser::checkRequiredFields() {
-    if (m_conf.flag.getHeight() == 0) {
+    if (m_conf.flagPaths.empty()) {
         std::cout << "ERROR: A flag must be provided with --flag"
             " <name or file path>. See available flags with --list\n";
         m_shouldExitFail = true;
     }
 }
 
+// NOTE: The loop depends on the waves, speed and frame rate, so it's looked
+// for once every option is in
+void ArgParser::checkLoop() {
+    if (!m_conf.bakePath.empty()) {
+        if (m_conf.backend != RenderBackend::CELLS) {
+            std::cout << "ERROR: --bake only works with the cells backend\n";
+            m_shouldExitFail = true;
+            return;
+        }
+        if (m_conf.loopTolerance <= 0) {
+            m_conf.loopTolerance = BAKE_LOOP_TOLERANCE;
+        }
+    }
+    if (m_conf.loopTolerance <= 0) {
+        return;
+    }
+    if (m_conf.flagPaths.size() > 1) {
+        std::cout << "ERROR: --loop can't be used with more than one flag\n";
+        m_shouldExitFail = true;
+        return;
+    }
+    if (m_conf.diffThreshold > 0) {
+        std::cout << "ERROR: --loop can't be used with --threshold\n";
+        m_shouldExitFail = true;
+        return;
+    }
+    m_conf.loopFrames = LoopCache::findPeriod(m_conf.waveConfig, m_conf.fps, m_conf.loopTolerance);
+    if (m_conf.loopFrames == 0) {
+        std::cout << "ERROR: The waves don't loop within " << m_conf.loopTolerance << " pixels in "
+            << LOOP_CACHE_MAX_SECONDS << " seconds, try a larger value after --loop\n";
+        m_shouldExitFail = true;
+    }
+}
+
 void ArgParser::parseAll() {
     while (m_idx < m_argc && !m_shouldExitFail && !m_shouldExitSuccess) {
         m_label = std::string(expectArg());
@@ -228,6 +324,47 @@ void ArgParser::parseAll() {
         else if (m_label == "--flag" || m_label == "-f") {
             handleFlag();
         }
+        else if (m_label == "--playlist" || m_label == "-p") {
+            handlePlaylist();
+        }
+        else if (m_label == "--interval" || m_label == "-i") {
+            if (!expectFloat(&m_conf.playlistInterval)) {
+                return;
+            }
+            if (m_conf.playlistInterval <= 0) {
+                std::cout << "ERROR: Interval after " << m_label << " must be positive\n";
+                m_shouldExitFail = true;
+            }
+        }
+        else if (m_label == "--transition" || m_label == "-T") {
+            const char* arg = expectArg();
+            if (arg == nullptr) {
+                return;
+            }
+            std::string type = arg;
+            if (type == "none") {
+                m_conf.transitionType = TransitionType::NONE;
+            }
+            else if (type == "fade") {
+                m_conf.transitionType = TransitionType::FADE;
+            }
+            else if (type == "wipe") {
+                m_conf.transitionType = TransitionType::WIPE;
+            }
+            else {
+                std::cout << "ERROR: Unknown transition `" << type << "` after " << m_label << "\n";
+                m_shouldExitFail = true;
+            }
+        }
+        else if (m_label == "--transition-time") {
+            if (!expectFloat(&m_conf.transitionTime)) {
+                return;
+            }
+            if (m_conf.transitionTime <= 0) {
+                std::cout << "ERROR: Duration after " << m_label << " must be positive\n";
+                m_shouldExitFail = true;
+            }
+        }
         else if (m_label == "--list" || m_label == "-l") {
             handleList();
         }
@@ -253,6 +390,155 @@ void ArgParser::parseAll() {
         else if (m_label == "--speed" || m_label == "-s") {
             expectFloat(&m_conf.waveConfig.speedMultiplier);
         }
+        else if (m_label == "--fps" || m_label == "-r") {
+            if (!expectInt(&m_conf.fps)) {
+                return;
+            }
+            if (m_conf.fps < 1 || m_conf.fps > 240) {
+                std::cout << "ERROR: Frame rate after " << m_label << " must be from 1 to 240\n";
+                m_shouldExitFail = true;
+            }
+        }
+        else if (m_label == "--colors" || m_label == "-C") {
+            const char* arg = expectArg();
+            if (arg == nullptr) {
+                return;
+            }
+            std::string mode = arg;
+            if (mode == "auto") {
+                m_conf.colorMode = ColorMode::AUTO;
+            }
+            else if (mode == "truecolor") {
+                m_conf.colorMode = ColorMode::TRUECOLOR;
+            }
+            else if (mode == "256") {
+                m_conf.colorMode = ColorMode::COLOR_256;
+            }
+            else if (mode == "16") {
+                m_conf.colorMode = ColorMode::COLOR_16;
+            }
+            else {
+                std::cout << "ERROR: Unknown color mode `" << mode << "` after " << m_label << "\n";
+                m_shouldExitFail = true;
+            }
+        }
+        else if (m_label == "--dither" || m_label == "-d") {
+            m_conf.dither = true;
+        }
+        else if (m_label == "--threshold" || m_label == "-e") {
+            if (!expectInt(&m_conf.diffThreshold)) {
+                return;
+            }
+            if (m_conf.diffThreshold < 0 || m_conf.diffThreshold > 255) {
+                std::cout << "ERROR: Threshold after " << m_label << " must be from 0 to 255\n";
+                m_shouldExitFail = true;
+            }
+        }
+        else if (m_label == "--loop" || m_label == "-L") {
+            if (expectFloat(&m_conf.loopTolerance) && m_conf.loopTolerance <= 0) {
+                std::cout << "ERROR: Expected a positive number of pixels after " << m_label << "\n";
+                m_shouldExitFail = true;
+            }
+        }
+        else if (m_label == "--glyphs" || m_label == "-G") {
+            const char* arg = expectArg();
+            if (arg == nullptr) {
+                return;
+            }
+            std::string mode = arg;
+            if (mode == "half") {
+                m_conf.glyphMode = GlyphMode::HALF;
+            }
+            else if (mode == "quadrant") {
+                m_conf.glyphMode = GlyphMode::QUADRANT;
+            }
+            else if (mode == "sextant") {
+                m_conf.glyphMode = GlyphMode::SEXTANT;
+            }
+            else {
+                std::cout << "ERROR: Unknown glyph mode `" << mode << "` after " << m_label << "\n";
+                m_shouldExitFail = true;
+            }
+#ifdef _WIN32
+            if (m_conf.glyphMode != GlyphMode::HALF) {
+                std::cout << "ERROR: Only half block glyphs are available on Windows\n";
+                m_shouldExitFail = true;
+            }
+#endif
+        }
+        else if (m_label == "--smooth-edges" || m_label == "-E") {
+#ifdef _WIN32
+            std::cout << "ERROR: Edge smoothing isn't available on Windows\n";
+            m_shouldExitFail = true;
+#else
+            m_conf.smoothEdges = true;
+#endif
+        }
+        else if (m_label == "--bake" || m_label == "-K") {
+            const char* arg = expectArg();
+            if (arg == nullptr
+                || !expectInt(&m_conf.bakeSize.first)
+                || !expectInt(&m_conf.bakeSize.second)) {
+                return;
+            }
+            m_conf.bakePath = arg;
+            if (m_conf.bakeSize.first < 1 || m_conf.bakeSize.first > BAKE_MAX_SIZE
+                || m_conf.bakeSize.second < 1 || m_conf.bakeSize.second > BAKE_MAX_SIZE) {
+                std::cout << "ERROR: Terminal size after " << m_label << " must be from 1 to "
+                    << BAKE_MAX_SIZE << "\n";
+                m_shouldExitFail = true;
+            }
+        }
+        else if (m_label == "--play" || m_label == "-P") {
+            const char* arg = expectArg();
+            if (arg == nullptr) {
+                return;
+            }
+            m_conf.playPath = arg;
+        }
+        else if (m_label == "--backend" || m_label == "-B") {
+            const char* arg = expectArg();
+            if (arg == nullptr) {
+                return;
+            }
+            std::string backend = arg;
+            if (backend == "cells") {
+                m_conf.backend = RenderBackend::CELLS;
+            }
+            else if (backend == "kitty") {
+                m_conf.backend = RenderBackend::KITTY;
+            }
+            else if (backend == "sixel") {
+                m_conf.backend = RenderBackend::SIXEL;
+            }
+            else {
+                std::cout << "ERROR: Unknown backend `" << backend << "` after " << m_label << "\n";
+                m_shouldExitFail = true;
+            }
+#ifdef _WIN32
+            if (m_conf.backend != RenderBackend::CELLS) {
+                std::cout << "ERROR: Only the cells backend is available on Windows\n";
+                m_shouldExitFail = true;
+            }
+#endif
+        }
+        else if (m_label == "--math" || m_label == "-M") {
+            const char* arg = expectArg();
+            if (arg == nullptr) {
+                return;
+            }
+            std::string math = arg;
+            if (math == "float") {
+                m_conf.isFixedPoint = false;
+            }
+            else if (math == "fixed") {
+                m_conf.isFixedPoint = true;
+            }
+            else {
+                std::cout << "ERROR: Unknown math `" << math << "` after " << m_label << "\n";
+                m_shouldExitFail = true;
+            }
+        }
         else if (m_label == "--gravity" || m_label == "-g") {
             expectFloat(&m_conf.waveConfig.gravityMultiplier);
         }
@@ -281,6 +567,9 @@ void ArgParser::parseAll() {
         else if (m_label == "--text-color" || m_label == "-t") {
             expectColor(&m_conf.textColor);
         }
+        else if (m_label == "--shared-cache" || m_label == "-c") {
+            m_conf.useSharedCache = true;
+        }
         else {
             std::cout << "ERROR: Unexpected token " << m_label << "\n";
             m_shouldExitFail = true;
@@ -289,18 +578,13 @@ void ArgParser::parseAll() {
     }
 }
 
-void ArgParser::handleFlag() {
-    const char* arg = expectArg();
-    if (arg == nullptr) {
-        return;
-    }
-
-    std::string path = arg;
+bool ArgParser::findFlag(const char* nameOrPath, std::string* outPath) {
+    std::string path = nameOrPath;
     if (!std::filesystem::exists(path)) {
         path = m_conf.assetsDir + "/" + path + ".png";
     }
     if (!std::filesystem::exists(path)) {
-        std::string fileName = std::string(arg) + ".png";
+        std::string fileName = std::string(nameOrPath) + ".png";
         for (const auto& entry : std::filesystem::recursive_directory_iterator(m_conf.assetsDir)) {
             if (entry.path().filename() == fileName) {
                 path = entry.path().string();
@@ -309,23 +593,63 @@ void ArgParser::handleFlag() {
         }
     }
     if (!std::filesystem::exists(path)) {
-        std::cout << "ERROR: Couldn't find file `" << arg << "`\n";
+        std::cout << "ERROR: Couldn't find file `" << nameOrPath << "`\n";
         m_shouldExitFail = true;
+        return false;
+    }
+
+    *outPath = path;
+    return true;
+}
+
+void ArgParser::handleFlag() {
+    const char* arg = expectArg();
+    if (arg == nullptr) {
         return;
     }
 
-    int width, height;
-    int origChannels;
-    uint8_t* stbiBuffer = stbi_load(
-        path.c_str(), &width, &height, &origChannels, IMG_BUFFER_CHANNELS
-    );
-    if (stbiBuffer == nullptr) {
-        std::cout << "ERROR: Couldn't load image `" << path << "`\n";
+    std::string path;
+    if (findFlag(arg, &path)) {
+        m_conf.flagPaths.push_back(path);
+    }
+}
+
+void ArgParser::handlePlaylist() {
+    const char* arg = expectArg();
+    if (arg == nullptr) {
+        return;
+    }
+
+    std::ifstream file(arg);
+    if (!file) {
+        std::cout << "ERROR: Couldn't open playlist `" << arg << "`\n";
         m_shouldExitFail = true;
         return;
     }
 
-    m_conf.flag = Image(stbiBuffer, width, height);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line.at(first) == '#') {
+            continue;
+        }
+        size_t last = line.find_last_not_of(" \t\r");
+        std::string entry = line.substr(first, last - first + 1);
+
+        std::string path;
+        if (!findFlag(entry.c_str(), &path)) {
+            return;
+        }
+        m_conf.flagPaths.push_back(path);
+    }
+}
+
+void ArgParser::loadFlag() {
+    const std::string& path = m_conf.flagPaths.front();
+    if (!Playlist::loadFlag(path, m_conf.useSharedCache, &m_conf.flag)) {
+        std::cout << "ERROR: Couldn't load image `" << path << "`\n";
+        m_shouldExitFail = true;
+    }
 }
 
 void ArgParser::handleList() {
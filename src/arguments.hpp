@@ -2,8 +2,11 @@
 #include <iostream>
 #include <filesystem>
 #include <string>
+#include <vector>
 #include "image.hpp"
 #include "animation.hpp"
+#include "transition.hpp"
+#include "palette.hpp"
 
 struct AppConfig {
     std::string assetsDir;
@@ -15,6 +18,24 @@ struct AppConfig {
     bool fancyScene;
     std::pair<float, float> normalPos;
     std::string msg;
+    bool useSharedCache;
+    std::vector<std::string> flagPaths;
+    float playlistInterval;
+    TransitionType transitionType;
+    float transitionTime;
+    int fps;
+    ColorMode colorMode;
+    bool dither;
+    int diffThreshold;
+    GlyphMode glyphMode;
+    bool smoothEdges;
+    RenderBackend backend;
+    bool isFixedPoint;
+    float loopTolerance;
+    int loopFrames;
+    std::string bakePath;
+    std::pair<int, int> bakeSize;
+    std::string playPath;
 };
 
 class ArgParser {
@@ -36,13 +57,17 @@ private:
     void setAssetsDir();
     void setDefaults();
     void checkRequiredFields();
+    void checkLoop();
+    void loadFlag();
     const char* expectArg();
     bool expectFloat(float* outVal);
     bool expectInt(int* outVal);
     bool expectColor(Color* outVal);
     void printHelp();
     void parseAll();
+    bool findFlag(const char* nameOrPath, std::string* outPath);
     void handleFlag();
+    void handlePlaylist();
     void handleList();
     void handleWave();
 };
@@ -0,0 +1,290 @@
+#include "bakedanimation.hpp"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "animation.hpp"
+#include "terminal.hpp"
+#include "termcaps.hpp"
+#include "eventloop.hpp"
+#include "loopcache.hpp"
+#include "lz4.hpp"
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#define BAKE_TOO_SMALL_MSG "Make the terminal at least "
+
+// NOTE: The terminal the file is played on is unknown, so frames are encoded
+// without REP, ECH or synchronized update. The player adds the latter itself.
+bool BakedAnimation::bake(const AppConfig& conf) {
+    TerminalController::requestHeadless();
+    TerminalController& term = TerminalController::getInstance();
+    Canvas& canvas = Canvas::getInstance();
+    term.setCaps(TermCaps());
+    term.setColorMode(conf.colorMode == ColorMode::AUTO ? ColorMode::TRUECOLOR : conf.colorMode);
+    term.setHeadlessSize(conf.bakeSize);
+    term.assignPreferredFGandBG(conf.textColor, conf.bg);
+    canvas.setBackend(RenderBackend::CELLS);
+    canvas.setDithering(conf.dither);
+    canvas.setGlyphMode(conf.glyphMode);
+    canvas.setEdgeSmoothing(conf.smoothEdges);
+    canvas.setFixedPoint(conf.isFixedPoint);
+
+    Header header{};
+    header.magic = BAKE_MAGIC;
+    header.version = BAKE_VERSION;
+    header.cols = static_cast<uint32_t>(conf.bakeSize.first);
+    header.rows = static_cast<uint32_t>(conf.bakeSize.second);
+    header.fps = static_cast<uint32_t>(conf.fps);
+    header.frameCount = static_cast<uint32_t>(conf.loopFrames);
+
+    // The last frame drawn is the first one again, diffed from the last
+    std::vector<FrameEntry> entries;
+    std::vector<uint8_t> data;
+    size_t rawTotal = 0;
+    for (int i = 0; i <= conf.loopFrames; i++) {
+        term.invalidateState();
+        if (i == 0) {
+            term.resetFGAndBG();
+            term.clearScreen();
+        }
+        drawScene(conf, LoopCache::getTime(i % conf.loopFrames, conf.fps));
+        canvas.endDrawing();
+        std::string frame = term.takeCaptured();
+
+        FrameEntry entry{};
+        entry.offset = data.size();
+        entry.rawSize = static_cast<uint32_t>(frame.size());
+        Lz4::compressBlock(reinterpret_cast<const uint8_t*>(frame.data()), frame.size(), &data);
+        entry.size = static_cast<uint32_t>(data.size() - entry.offset);
+        entries.push_back(entry);
+        header.maxFrameSize = std::max(header.maxFrameSize, entry.rawSize);
+        rawTotal += frame.size();
+    }
+
+    std::ofstream file(conf.bakePath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(FrameEntry));
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    file.close();
+    if (!file) {
+        std::cout << "ERROR: Couldn't write `" << conf.bakePath << "`\n";
+        return false;
+    }
+    std::cout << "Baked " << conf.loopFrames << " frames (" << LoopCache::getTime(conf.loopFrames, conf.fps)
+        << " s) for " << header.cols << "x" << header.rows << " into `" << conf.bakePath << "`, "
+        << rawTotal / 1024 << " KiB compressed to " << data.size() / 1024 << " KiB\n";
+    return true;
+}
+
+bool BakedAnimation::play(const std::string& path) {
+    size_t fileSize = 0;
+    const uint8_t* file = mapFile(path, &fileSize);
+    if (file == nullptr) {
+        std::cout << "ERROR: Couldn't open `" << path << "`\n";
+        return false;
+    }
+    Header header;
+    if (!checkFile(file, fileSize, &header)) {
+        std::cout << "ERROR: `" << path << "` isn't a file made by this version of --bake\n";
+        unmapFile(file, fileSize);
+        return false;
+    }
+    const uint8_t* frameData = file + getDataStart(header);
+
+    EventLoop loop(static_cast<int>(header.fps));
+    TerminalController& term = TerminalController::getInstance();
+    size_t beginLen = strlen(ANSI_BEGIN_SYNC_UPDATE);
+    size_t endLen = strlen(ANSI_END_SYNC_UPDATE);
+    // Frames are decompressed between the synchronized update markers
+    std::vector<char> buffer(beginLen + header.maxFrameSize + endLen);
+    memcpy(buffer.data(), ANSI_BEGIN_SYNC_UPDATE, beginLen);
+
+    // -1 until the keyframe is shown
+    int shownFrame = -1;
+    bool isNoticeShown = false;
+    while (loop.waitFrame()) {
+        if (loop.isResizeSettling() || term.isOutputBusy()) {
+            continue;
+        }
+        if (loop.consumeResize()) {
+            term.refreshSize();
+            shownFrame = -1;
+            isNoticeShown = false;
+        }
+        std::pair<int, int> size = term.getSize();
+        if (size.first < static_cast<int>(header.cols) || size.second < static_cast<int>(header.rows)) {
+            if (!isNoticeShown) {
+                std::string notice = BAKE_TOO_SMALL_MSG + std::to_string(header.cols)
+                    + "x" + std::to_string(header.rows);
+                term.resetFGAndBG();
+                term.clearScreen();
+                term.writeText(notice.substr(0, std::max(size.first - 1, 0)));
+                term.flush();
+                isNoticeShown = true;
+            }
+            continue;
+        }
+
+        int frame = (shownFrame + 1) % static_cast<int>(header.frameCount);
+        size_t entryIdx = shownFrame < 0 ? 0 : (frame == 0 ? header.frameCount : static_cast<size_t>(frame));
+        FrameEntry entry = getEntry(file, entryIdx);
+        Lz4::decompressBlock(
+            frameData + entry.offset,
+            entry.size,
+            reinterpret_cast<uint8_t*>(buffer.data() + beginLen),
+            entry.rawSize
+        );
+        if (term.getCaps().hasSyncUpdate) {
+            memcpy(buffer.data() + beginLen + entry.rawSize, ANSI_END_SYNC_UPDATE, endLen);
+            term.writeFrame(buffer.data(), beginLen + entry.rawSize + endLen);
+        }
+        else {
+            term.writeFrame(buffer.data() + beginLen, entry.rawSize);
+        }
+        shownFrame = frame;
+    }
+
+    term.resetFGAndBG();
+    term.getStream() << "\n";
+    term.flush();
+    unmapFile(file, fileSize);
+    return true;
+}
+
+// Same scenes as the main loop draws
+void BakedAnimation::drawScene(const AppConfig& conf, float time) {
+    Canvas& canvas = Canvas::getInstance();
+    canvas.beginDrawing(conf.bg);
+    if (!conf.msg.empty()) {
+        canvas.drawSceneFlagPoleAndMsg(conf.flag, conf.waveConfig, conf.ambientLight, conf.msg, time);
+    }
+    else if (conf.fancyScene) {
+        canvas.drawSceneFlagAndPole(
+            conf.flag,
+            conf.waveConfig,
+            conf.normalPos.first,
+            conf.normalPos.second,
+            conf.ambientLight,
+            time
+        );
+    }
+    else {
+        canvas.drawSceneFlagOnly(
+            conf.flag,
+            conf.waveConfig,
+            conf.normalPos.first,
+            conf.normalPos.second,
+            conf.ambientLight,
+            time
+        );
+    }
+}
+
+// Every frame is decompressed once up front, so playing can't fail halfway
+// with the terminal already taken over
+bool BakedAnimation::checkFile(const uint8_t* file, size_t fileSize, Header* outHeader) {
+    if (fileSize < sizeof(Header)) {
+        return false;
+    }
+    memcpy(outHeader, file, sizeof(Header));
+    const Header& header = *outHeader;
+    if (header.magic != BAKE_MAGIC
+        || header.version != BAKE_VERSION
+        || header.cols == 0 || header.cols > BAKE_MAX_SIZE
+        || header.rows == 0 || header.rows > BAKE_MAX_SIZE
+        || header.fps < 1 || header.fps > 240
+        || header.frameCount == 0
+        || header.frameCount >= (fileSize - sizeof(Header)) / sizeof(FrameEntry)) {
+        return false;
+    }
+
+    // NOTE: Entries are checked before the buffer is allocated, a frame can't
+    // be larger than its compressed size allows
+    size_t dataStart = getDataStart(header);
+    size_t dataSize = fileSize - dataStart;
+    uint32_t largestSize = 0;
+    for (size_t i = 0; i <= header.frameCount; i++) {
+        FrameEntry entry = getEntry(file, i);
+        if (entry.offset > dataSize
+            || entry.size > dataSize - entry.offset
+            || entry.rawSize > static_cast<uint64_t>(entry.size) * LZ4_MAX_RATIO) {
+            return false;
+        }
+        largestSize = std::max(largestSize, entry.rawSize);
+    }
+    if (header.maxFrameSize != largestSize) {
+        return false;
+    }
+
+    std::vector<uint8_t> frame(header.maxFrameSize);
+    for (size_t i = 0; i <= header.frameCount; i++) {
+        FrameEntry entry = getEntry(file, i);
+        if (!Lz4::decompressBlock(file + dataStart + entry.offset, entry.size, frame.data(), entry.rawSize)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// NOTE: The entry table is counted in size_t, frameCount + 1 would wrap in
+// 32 bits
+size_t BakedAnimation::getDataStart(const Header& header) {
+    return sizeof(Header) + (static_cast<size_t>(header.frameCount) + 1) * sizeof(FrameEntry);
+}
+
+BakedAnimation::FrameEntry BakedAnimation::getEntry(const uint8_t* file, size_t idx) {
+    FrameEntry entry;
+    memcpy(&entry, file + sizeof(Header) + idx * sizeof(FrameEntry), sizeof(FrameEntry));
+    return entry;
+}
+
+// Windows reads the whole file instead
+const uint8_t* BakedAnimation::mapFile(const std::string& path, size_t* outSize) {
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return nullptr;
+    }
+    *outSize = static_cast<size_t>(file.tellg());
+    uint8_t* data = new uint8_t[*outSize];
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(data), *outSize)) {
+        delete[] data;
+        return nullptr;
+    }
+    return data;
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    *outSize = static_cast<size_t>(fileStat.st_size);
+    void* mapped = mmap(nullptr, *outSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+    return static_cast<const uint8_t*>(mapped);
+#endif
+}
+
+void BakedAnimation::unmapFile(const uint8_t* file, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    delete[] file;
+#else
+    munmap(const_cast<uint8_t*>(file), size);
+#endif
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "arguments.hpp"
+
+#define BAKE_MAGIC          0x42564157u // "WAVB"
+#define BAKE_VERSION        1
+#define BAKE_MAX_SIZE       1000
+// Used when --bake is given without --loop
+#define BAKE_LOOP_TOLERANCE 0.5f
+
+// One loop of the animation encoded ahead of time for a terminal of a given
+// size, so playing it back is only copying bytes to the terminal. The file
+// holds a keyframe that clears the screen and draws the loop's first frame,
+// the diffs into frames 1 to N-1, and the diff from the last frame back to
+// the first. Every frame is LZ4 compressed on its own and starts from an
+// unknown terminal state. The player maps the file and allocates nothing
+// once it started. Frames are played one after the other, a slow terminal
+// slows the animation down instead of skipping frames.
+// NOTE: Fields are in the byte order of the machine that baked the file
+class BakedAnimation {
+public:
+    static bool bake(const AppConfig& conf);
+    static bool play(const std::string& path);
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t cols;
+        uint32_t rows;
+        uint32_t fps;
+        uint32_t frameCount;
+        uint32_t maxFrameSize;
+        uint32_t reserved;
+        // Followed by frameCount + 1 FrameEntries and then the frame data
+    };
+
+    // Offset is from the start of the frame data
+    struct FrameEntry {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t rawSize;
+    };
+
+    static void drawScene(const AppConfig& conf, float time);
+    static bool checkFile(const uint8_t* file, size_t fileSize, Header* outHeader);
+    static size_t getDataStart(const Header& header);
+    static FrameEntry getEntry(const uint8_t* file, size_t idx);
+    static const uint8_t* mapFile(const std::string& path, size_t* outSize);
+    static void unmapFile(const uint8_t* file, size_t size);
+};
@@ -0,0 +1,206 @@
+#include "deflate.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+static const uint16_t LENGTH_BASES[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA_BITS[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t DISTANCE_BASES[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DISTANCE_EXTRA_BITS[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+std::vector<uint8_t> Deflate::compressZlib(const uint8_t* data, size_t size) {
+    std::vector<uint8_t> out;
+    out.reserve(size / 4 + 64);
+    // NOTE: 32K window and deflate, fastest compression level. Header check
+    // bits make 0x7801 a multiple of 31.
+    out.push_back(0x78);
+    out.push_back(0x01);
+
+    BitWriter writer(&out);
+    writer.writeBits(1, 1); // Final block
+    writer.writeBits(1, 2); // Fixed Huffman codes
+
+    std::vector<int32_t> heads(size_t(1) << DEFLATE_HASH_BITS, -1);
+    std::vector<int32_t> chain(DEFLATE_WINDOW_SIZE, -1);
+    auto hashAt = [&](size_t pos) {
+        uint32_t v = data[pos] | (data[pos + 1] << 8) | (data[pos + 2] << 16);
+        return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+    };
+    auto insert = [&](size_t pos) {
+        if (pos + DEFLATE_MIN_MATCH > size) {
+            return;
+        }
+        uint32_t hash = hashAt(pos);
+        chain.at(pos % DEFLATE_WINDOW_SIZE) = heads.at(hash);
+        heads.at(hash) = static_cast<int32_t>(pos);
+    };
+
+    size_t pos = 0;
+    while (pos < size) {
+        int bestLength = 0;
+        int bestDistance = 0;
+        if (pos + DEFLATE_MIN_MATCH <= size) {
+            int32_t candidate = heads.at(hashAt(pos));
+            size_t maxLength = std::min<size_t>(DEFLATE_MAX_MATCH, size - pos);
+            for (int i = 0; i < DEFLATE_MAX_CHAIN && candidate >= 0; i++) {
+                size_t distance = pos - static_cast<size_t>(candidate);
+                if (distance > DEFLATE_WINDOW_SIZE) {
+                    break;
+                }
+                size_t length = 0;
+                while (length < maxLength && data[candidate + length] == data[pos + length]) {
+                    length++;
+                }
+                if (static_cast<int>(length) > bestLength) {
+                    bestLength = static_cast<int>(length);
+                    bestDistance = static_cast<int>(distance);
+                    if (length == maxLength) {
+                        break;
+                    }
+                }
+                int32_t next = chain.at(candidate % DEFLATE_WINDOW_SIZE);
+                if (next >= candidate) {
+                    break;
+                }
+                candidate = next;
+            }
+        }
+
+        if (bestLength >= DEFLATE_MIN_MATCH) {
+            writeMatch(writer, bestLength, bestDistance);
+            for (int i = 0; i < bestLength; i++) {
+                insert(pos + i);
+            }
+            pos += bestLength;
+        }
+        else {
+            writeLiteral(writer, data[pos]);
+            insert(pos);
+            pos++;
+        }
+    }
+    writeLiteral(writer, 256); // End of block
+    writer.flush();
+
+    // Data that doesn't compress is cheaper to store as is
+    if (out.size() > size + (size / 65535 + 1) * 5 + 2) {
+        out.resize(2);
+        writeStored(data, size, &out);
+    }
+
+    uint32_t checksum = adler32(data, size);
+    out.push_back(static_cast<uint8_t>(checksum >> 24));
+    out.push_back(static_cast<uint8_t>(checksum >> 16));
+    out.push_back(static_cast<uint8_t>(checksum >> 8));
+    out.push_back(static_cast<uint8_t>(checksum));
+    return out;
+}
+
+// NOTE: Stored blocks start byte-aligned with 3 header bits padded to a byte
+void Deflate::writeStored(const uint8_t* data, size_t size, std::vector<uint8_t>* out) {
+    size_t pos = 0;
+    do {
+        size_t blockSize = std::min<size_t>(size - pos, 65535);
+        bool isFinal = pos + blockSize == size;
+        out->push_back(isFinal ? 1 : 0);
+        out->push_back(static_cast<uint8_t>(blockSize));
+        out->push_back(static_cast<uint8_t>(blockSize >> 8));
+        out->push_back(static_cast<uint8_t>(~blockSize));
+        out->push_back(static_cast<uint8_t>(~blockSize >> 8));
+        out->insert(out->end(), data + pos, data + pos + blockSize);
+        pos += blockSize;
+    } while (pos < size);
+}
+
+// Symbols of the fixed literal/length code, see RFC 1951 3.2.6
+void Deflate::writeLiteral(BitWriter& writer, int symbol) {
+    if (symbol < 144) {
+        writer.writeHuffman(0x30 + symbol, 8);
+    }
+    else if (symbol < 256) {
+        writer.writeHuffman(0x190 + symbol - 144, 9);
+    }
+    else if (symbol < 280) {
+        writer.writeHuffman(symbol - 256, 7);
+    }
+    else {
+        writer.writeHuffman(0xC0 + symbol - 280, 8);
+    }
+}
+
+void Deflate::writeMatch(BitWriter& writer, int length, int distance) {
+    int lengthCode = 28;
+    while (LENGTH_BASES[lengthCode] > length) {
+        lengthCode--;
+    }
+    writeLiteral(writer, 257 + lengthCode);
+    writer.writeBits(length - LENGTH_BASES[lengthCode], LENGTH_EXTRA_BITS[lengthCode]);
+
+    int distanceCode = 29;
+    while (DISTANCE_BASES[distanceCode] > distance) {
+        distanceCode--;
+    }
+    writer.writeHuffman(distanceCode, 5);
+    writer.writeBits(distance - DISTANCE_BASES[distanceCode], DISTANCE_EXTRA_BITS[distanceCode]);
+}
+
+uint32_t Deflate::adler32(const uint8_t* data, size_t size) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    // NOTE: 5552 is the most bytes that can be summed before b overflows
+    while (size > 0) {
+        size_t blockSize = std::min<size_t>(size, 5552);
+        size -= blockSize;
+        for (size_t i = 0; i < blockSize; i++) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+Deflate::BitWriter::BitWriter(std::vector<uint8_t>* out)
+    : m_out(out), m_bits(0), m_bitCount(0) {}
+
+// Deflate packs values starting from the least significant bit
+void Deflate::BitWriter::writeBits(uint32_t value, int count) {
+    m_bits |= static_cast<uint64_t>(value) << m_bitCount;
+    m_bitCount += count;
+    while (m_bitCount >= 8) {
+        m_out->push_back(static_cast<uint8_t>(m_bits));
+        m_bits >>= 8;
+        m_bitCount -= 8;
+    }
+}
+
+// Huffman codes are the exception and go most significant bit first
+void Deflate::BitWriter::writeHuffman(uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    writeBits(reversed, length);
+}
+
+void Deflate::BitWriter::flush() {
+    if (m_bitCount > 0) {
+        m_out->push_back(static_cast<uint8_t>(m_bits));
+    }
+    m_bits = 0;
+    m_bitCount = 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#define DEFLATE_WINDOW_SIZE   32768
+#define DEFLATE_HASH_BITS     15
+#define DEFLATE_MAX_CHAIN     16
+#define DEFLATE_MIN_MATCH     3
+#define DEFLATE_MAX_MATCH     258
+
+// Just enough of zlib (RFC 1950) to compress images for terminal graphics
+// protocols. Everything goes in a single block with the fixed Huffman codes
+// and greedy LZ77 matching, which is all that rendered frames with large flat
+// areas need.
+class Deflate {
+public:
+    static std::vector<uint8_t> compressZlib(const uint8_t* data, size_t size);
+private:
+    class BitWriter {
+    public:
+        BitWriter(std::vector<uint8_t>* out);
+        void writeBits(uint32_t value, int count);
+        void writeHuffman(uint32_t code, int length);
+        void flush();
+    private:
+        std::vector<uint8_t>* m_out;
+        uint64_t m_bits;
+        int m_bitCount;
+    };
+
+    static void writeStored(const uint8_t* data, size_t size, std::vector<uint8_t>* out);
+    static void writeLiteral(BitWriter& writer, int symbol);
+    static void writeMatch(BitWriter& writer, int length, int distance);
+    static uint32_t adler32(const uint8_t* data, size_t size);
+};
@@ -0,0 +1,210 @@
+#include "eventloop.hpp"
+#include <cstdint>
+#include <chrono>
+#include "terminal.hpp"
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/epoll.h>
+    #include <sys/timerfd.h>
+    #include <sys/signalfd.h>
+    #include <signal.h>
+    #include <unistd.h>
+    #include <time.h>
+#endif
+
+#define NS_PER_SEC 1000000000ll
+#define MAX_EPOLL_EVENTS 4
+// Dragging a window sends a storm of SIGWINCHs, only act once they stop
+#define RESIZE_DEBOUNCE_NS (60 * 1000000ll)
+// Windows has no SIGWINCH, so the console size is polled this often instead
+#define RESIZE_POLL_NS (250 * 1000000ll)
+
+EventLoop::EventLoop(int fps)
+    : m_fps(fps), m_periodNs(NS_PER_SEC / fps), m_frameIdx(-1), m_missedFrames(0)
+    , m_isResizePending(false), m_lastResizeNs(0), m_startNs(getMonotonicNs()) {
+#ifndef _WIN32
+    // NOTE: Signals must be blocked before any other thread is started so that
+    // they are only ever delivered through the signalfd
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+    m_signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct itimerspec timerSpec;
+    timerSpec.it_value = now;
+    timerSpec.it_interval.tv_sec = m_periodNs / NS_PER_SEC;
+    timerSpec.it_interval.tv_nsec = m_periodNs % NS_PER_SEC;
+    timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &timerSpec, nullptr);
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = m_timerFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_timerFd, &ev);
+    ev.data.fd = m_signalFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_signalFd, &ev);
+    ev.data.fd = STDIN_FILENO;
+    m_isWatchingStdin = isatty(STDIN_FILENO)
+        && epoll_ctl(m_epollFd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+    m_isWatchingStdout = false;
+#endif
+}
+
+EventLoop::~EventLoop() {
+#ifndef _WIN32
+    close(m_epollFd);
+    close(m_timerFd);
+    close(m_signalFd);
+#endif
+}
+
+// Blocks until the next frame is due. Returns false when the app should exit.
+bool EventLoop::waitFrame() {
+#ifdef _WIN32
+    int64_t nextNs = m_startNs + (m_frameIdx + 1) * m_periodNs;
+    int64_t nowNs = getMonotonicNs();
+    if (nowNs - m_lastResizeNs >= RESIZE_POLL_NS) {
+        m_isResizePending = true;
+        m_lastResizeNs = nowNs - RESIZE_DEBOUNCE_NS;
+    }
+    if (nextNs > nowNs) {
+        Sleep(static_cast<DWORD>((nextNs - nowNs) / 1000000));
+        m_frameIdx++;
+    }
+    else {
+        int64_t lateFrames = (nowNs - m_startNs) / m_periodNs - m_frameIdx;
+        m_missedFrames += lateFrames - 1;
+        m_frameIdx += lateFrames;
+    }
+    return !TerminalController::getInstance().shouldExit();
+#else
+    TerminalController& term = TerminalController::getInstance();
+    while (true) {
+        // Keep feeding a backed up terminal between frames, so the link stays
+        // saturated and the measured drain rate is the link's, not ours
+        bool hasPendingOutput = term.isOutputBusy();
+        if (hasPendingOutput != m_isWatchingStdout) {
+            struct epoll_event outEv;
+            outEv.events = EPOLLOUT;
+            outEv.data.fd = STDOUT_FILENO;
+            epoll_ctl(
+                m_epollFd,
+                hasPendingOutput ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+                STDOUT_FILENO,
+                &outEv
+            );
+            m_isWatchingStdout = hasPendingOutput;
+        }
+
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        int eventCount = epoll_wait(m_epollFd, events, MAX_EPOLL_EVENTS, -1);
+        bool isFrameDue = false;
+        for (int i = 0; i < eventCount; i++) {
+            int fd = events[i].data.fd;
+            if (fd == m_signalFd && !handleSignal()) {
+                return false;
+            }
+            else if (fd == STDIN_FILENO && !handleInput()) {
+                return false;
+            }
+            else if (fd == STDOUT_FILENO) {
+                term.drainOutput();
+            }
+            else if (fd == m_timerFd) {
+                uint64_t expirations = 0;
+                if (read(m_timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)
+                    && expirations > 0) {
+                    m_missedFrames += expirations - 1;
+                    m_frameIdx += static_cast<int64_t>(expirations);
+                    isFrameDue = true;
+                }
+            }
+        }
+        if (isFrameDue) {
+            return true;
+        }
+    }
+#endif
+}
+
+// NOTE: Time is derived from the deadline of the current frame rather than
+// from when we woke up, so the animation advances in exact steps
+float EventLoop::getTime() const {
+    return static_cast<float>(static_cast<double>(m_frameIdx * m_periodNs) / NS_PER_SEC);
+}
+
+// Frames due since the start, the first frame is 0
+int64_t EventLoop::getFrameIndex() const {
+    return m_frameIdx;
+}
+
+int EventLoop::getFPS() const {
+    return m_fps;
+}
+
+uint64_t EventLoop::getMissedFrames() const {
+    return m_missedFrames;
+}
+
+// True while the terminal is still being resized, frames drawn for the old
+// size would only be garbled by the terminal, so they should be skipped
+bool EventLoop::isResizeSettling() const {
+    return m_isResizePending && getMonotonicNs() - m_lastResizeNs < RESIZE_DEBOUNCE_NS;
+}
+
+bool EventLoop::consumeResize() {
+    if (!m_isResizePending || isResizeSettling()) {
+        return false;
+    }
+    m_isResizePending = false;
+    return true;
+}
+
+int64_t EventLoop::getMonotonicNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+#ifndef _WIN32
+bool EventLoop::handleSignal() {
+    struct signalfd_siginfo info;
+    while (read(m_signalFd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM) {
+            return false;
+        }
+        if (info.ssi_signo == SIGWINCH) {
+            m_isResizePending = true;
+            m_lastResizeNs = getMonotonicNs();
+        }
+    }
+    return true;
+}
+
+bool EventLoop::handleInput() {
+    char buffer[64];
+    ssize_t readCount = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (readCount <= 0) {
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+        m_isWatchingStdin = false;
+        return true;
+    }
+    // Late replies to the capability queries aren't keypresses
+    if (buffer[0] == '\x1b') {
+        return true;
+    }
+    for (ssize_t i = 0; i < readCount; i++) {
+        if (buffer[i] == 'q' || buffer[i] == 'Q') {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+
+// Paces the main loop. On Linux frame deadlines come from an absolute
+// monotonic timerfd, and SIGINT/SIGTERM/SIGWINCH and stdin are read through
+// the same epoll wait, so the process only wakes up when there is something
+// to do. Other platforms sleep until the next deadline instead.
+class EventLoop {
+public:
+    EventLoop(int fps);
+    EventLoop(EventLoop& other) = delete;
+    void operator=(const EventLoop&) = delete;
+    ~EventLoop();
+
+    bool waitFrame();
+    float getTime() const;
+    int64_t getFrameIndex() const;
+    int getFPS() const;
+    uint64_t getMissedFrames() const;
+    bool isResizeSettling() const;
+    bool consumeResize();
+private:
+    int m_fps;
+    int64_t m_periodNs;
+    int64_t m_frameIdx;
+    uint64_t m_missedFrames;
+    bool m_isResizePending;
+    int64_t m_lastResizeNs;
+
+    static int64_t getMonotonicNs();
+    int64_t m_startNs;
+#ifndef _WIN32
+    int m_epollFd;
+    int m_timerFd;
+    int m_signalFd;
+    bool m_isWatchingStdin;
+    bool m_isWatchingStdout;
+
+    bool handleSignal();
+    bool handleInput();
+#endif
+};
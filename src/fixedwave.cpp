@@ -0,0 +1,115 @@
+#include "fixedwave.hpp"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#define FIXED_SINE_SIZE (1 << FIXED_SINE_BITS)
+// Phase bits between two table entries, used to interpolate
+#define FIXED_SINE_FRAC_BITS (FIXED_SHIFT - FIXED_SINE_BITS)
+
+void FixedWave::getShifts(
+    const WaveConfig& waveConfig,
+    size_t imgWidth,
+    float time,
+    int scaleX,
+    size_t count,
+    int32_t* outWaveShifts,
+    int32_t* outShifts
+) {
+    // Phase of the first sample, one flag pixel left of the flag, and how
+    // far each sample moves it
+    size_t waveCount = waveConfig.waves.size();
+    std::vector<uint32_t> phases(waveCount);
+    std::vector<uint32_t> phaseSteps(waveCount);
+    std::vector<int32_t> amplitudes(waveCount);
+    for (size_t w = 0; w < waveCount; w++) {
+        const SineWave& wave = waveConfig.waves[w];
+        double offset = time * waveConfig.speedMultiplier * wave.speed;
+        double turns = (-1 - offset) / wave.wavelength + wave.phase / (2 * PI);
+        phases[w] = static_cast<uint32_t>(std::llround((turns - std::floor(turns)) * FIXED_ONE));
+        phaseSteps[w] = static_cast<uint32_t>(std::lround(
+            static_cast<double>(FIXED_ONE) / (wave.wavelength * scaleX)
+        ));
+        amplitudes[w] = toFixed(wave.amplitude * waveConfig.amplitudeMultiplier);
+    }
+
+    // Both the fixed left edge and gravity scale with the distance from it,
+    // in Q32 per sample
+    bool isLeftFixed = waveConfig.keepLeftFixed;
+    bool hasGravity = isLeftFixed && waveConfig.gravityMultiplier != 0;
+    int64_t samplesAcross = std::max<int64_t>(1, scaleX * (static_cast<int64_t>(imgWidth) - 1));
+    int64_t sampleScale = ((int64_t(1) << 32) + samplesAcross / 2) / samplesAcross;
+    int64_t gravity = toFixed(waveConfig.gravityMultiplier);
+
+    const int32_t* sines = getSineTable();
+    for (size_t i = 0; i < count; i++) {
+        int64_t yShift = 0;
+        for (size_t w = 0; w < waveCount; w++) {
+            uint32_t phase = phases[w] & (FIXED_ONE - 1);
+            uint32_t idx = phase >> FIXED_SINE_FRAC_BITS;
+            int64_t frac = phase & ((1 << FIXED_SINE_FRAC_BITS) - 1);
+            int64_t sine = sines[idx] + (((sines[idx + 1] - sines[idx]) * frac) >> FIXED_SINE_FRAC_BITS);
+            yShift += (amplitudes[w] * sine) >> FIXED_SHIFT;
+            phases[w] += phaseSteps[w];
+        }
+        if (isLeftFixed) {
+            int64_t fromLeft = static_cast<int64_t>(i) - scaleX;
+            int64_t scale = ((fromLeft < 0 ? -fromLeft : fromLeft) * sampleScale) >> FIXED_SHIFT;
+            yShift = (yShift * scale) >> FIXED_SHIFT;
+        }
+        outWaveShifts[i] = static_cast<int32_t>(yShift);
+
+        // NOTE: Gravity is sampled one pixel to the right, as in WaveKernel
+        if (hasGravity) {
+            int64_t xNormal = (static_cast<int64_t>(i) * sampleScale) >> FIXED_SHIFT;
+            yShift += (xNormal * gravity) >> FIXED_SHIFT;
+        }
+        outShifts[i] = static_cast<int32_t>(yShift);
+    }
+}
+
+// The normal of the slope dotted with light coming from the top left, which
+// works out to (1 + slope) / sqrt(2 * (1 + slope^2))
+int32_t FixedWave::getLight(int32_t slope) {
+    int64_t s = slope;
+    uint64_t tangentLenSq = static_cast<uint64_t>(FIXED_ONE) * FIXED_ONE + static_cast<uint64_t>(s * s);
+    int64_t tangentLen = sqrtInt(tangentLenSq);
+    return static_cast<int32_t>((FIXED_ONE + s) * FIXED_SQRT_HALF / tangentLen);
+}
+
+int32_t FixedWave::toFixed(float value) {
+    return static_cast<int32_t>(std::lround(value * FIXED_ONE));
+}
+
+// One turn of Q16 sines, with the first entry repeated at the end so that
+// the last one can be interpolated too
+const int32_t* FixedWave::getSineTable() {
+    static const std::vector<int32_t> table = []() {
+        std::vector<int32_t> sines(FIXED_SINE_SIZE + 1);
+        for (size_t i = 0; i < sines.size(); i++) {
+            sines[i] = static_cast<int32_t>(std::lround(std::sin(2 * PI * i / FIXED_SINE_SIZE) * FIXED_ONE));
+        }
+        return sines;
+    }();
+    return table.data();
+}
+
+// Rounded down, one result bit per step
+uint32_t FixedWave::sqrtInt(uint64_t value) {
+    uint64_t root = 0;
+    uint64_t bit = uint64_t(1) << 62;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= root + bit) {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return static_cast<uint32_t>(root);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "animation.hpp"
+
+// Fractional bits of the fixed point numbers, in Q16 1 is 65536
+#define FIXED_SHIFT        16
+#define FIXED_ONE          (1 << FIXED_SHIFT)
+// log2 of the sine table's entries per turn
+#define FIXED_SINE_BITS    10
+// 1 / sqrt(2) in Q16
+#define FIXED_SQRT_HALF    46341
+
+// The wave math of drawWavedImage in integers, for CPUs without a fast FPU.
+// Shifts and slopes are Q16 flag pixels, phases are Q16 turns so that they
+// wrap around on their own, and sines come from a table. Each frame's
+// parameters are converted once, every sample after that is integer only.
+// NOTE: Right shifts of negative numbers are taken to round down, as they do
+// with every compiler wavet builds with. Left shifting them is undefined,
+// those are multiplications.
+class FixedWave {
+public:
+    // Same samples as WaveKernel gives, see there
+    static void getShifts(
+        const WaveConfig& waveConfig,
+        size_t imgWidth,
+        float time,
+        int scaleX,
+        size_t count,
+        int32_t* outWaveShifts,
+        int32_t* outShifts
+    );
+    // How much light falls on the flag where it has this slope, in Q16. Can
+    // be negative for a flag facing away.
+    static int32_t getLight(int32_t slope);
+    static int32_t toFixed(float value);
+private:
+    static const int32_t* getSineTable();
+    static uint32_t sqrtInt(uint64_t value);
+};
@@ -1,7 +1,12 @@
 #include "image.hpp"
 #include <cassert>
 #include <vector>
+#include <string>
 #include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <atomic>
 #include "stb_image.h"
 
 Color::Color()
@@ -41,24 +46,111 @@ Image::Image(uint8_t* stdiBuffer, size_t width, size_t height)
     stbi_image_free(stdiBuffer);
 }
 
+Image::Image(
+    std::shared_ptr<const void> storage,
+    const Color* palette,
+    const uint8_t* indices,
+    size_t width,
+    size_t height
+)
+    : m_width(width), m_height(height), m_storage(std::move(storage))
+    , m_palette(palette), m_indices(indices) {}
+
+bool Image::load(const std::string& path, Image* outImg) {
+    int width, height;
+    int origChannels;
+    uint8_t* stbiBuffer = stbi_load(
+        path.c_str(), &width, &height, &origChannels, IMG_BUFFER_CHANNELS
+    );
+    if (stbiBuffer == nullptr) {
+        return false;
+    }
+    *outImg = Image(stbiBuffer, width, height);
+    return true;
+}
+
 void Image::resize(size_t width, size_t height, Color fill) {
+    assert(!isIndexed());
+    m_generation = 0;
     m_pixels.resize(width * height, fill);
     m_width = width;
     m_height = height;
 }
 
 void Image::clear(Color fill) {
+    assert(!isIndexed());
+    m_generation = 0;
     std::fill(m_pixels.begin(), m_pixels.end(), fill);
 }
 
 void Image::setPixel(size_t x, size_t y, Color value) {
+    assert(!isIndexed());
+    m_generation = 0;
     m_pixels.at(x + y * m_width) = value;
 }
 
 Color Image::getPixel(size_t x, size_t y) const {
+    if (isIndexed()) {
+        assert(x < m_width && y < m_height);
+        return m_palette[m_indices[x + y * m_width]];
+    }
     return m_pixels.at(x + y * m_width);
 }
 
+Color* Image::getRow(size_t y) {
+    assert(y < m_height && !isIndexed());
+    m_generation = 0;
+    return m_pixels.data() + y * m_width;
+}
+
+const Color* Image::getRow(size_t y) const {
+    assert(y < m_height && !isIndexed());
+    return m_pixels.data() + y * m_width;
+}
+
+// NOTE: Clipping is done in 64 bits so that sizes past INT_MAX don't wrap
+void Image::fillRect(int x, int y, size_t width, size_t height, Color fill) {
+    int64_t left = std::max<int64_t>(0, x);
+    int64_t top = std::max<int64_t>(0, y);
+    int64_t right = std::min<int64_t>(m_width, x + static_cast<int64_t>(width));
+    int64_t bottom = std::min<int64_t>(m_height, y + static_cast<int64_t>(height));
+    if (left >= right) {
+        return;
+    }
+    for (int64_t row = top; row < bottom; row++) {
+        Color* pixels = getRow(row);
+        std::fill(pixels + left, pixels + right, fill);
+    }
+}
+
+void Image::blitRow(int x, int y, const Color* values, size_t count) {
+    if (y < 0 || y >= static_cast<int64_t>(m_height)) {
+        return;
+    }
+    int64_t left = std::max<int64_t>(0, x);
+    int64_t right = std::min<int64_t>(m_width, x + static_cast<int64_t>(count));
+    if (left < right) {
+        std::copy(values + (left - x), values + (right - x), getRow(y) + left);
+    }
+}
+
+void Image::blitColumn(int x, int y, const Color* values, size_t count, size_t stride) {
+    if (x < 0 || x >= static_cast<int64_t>(m_width)) {
+        return;
+    }
+    int64_t top = std::max<int64_t>(0, y);
+    int64_t bottom = std::min<int64_t>(m_height, y + static_cast<int64_t>(count));
+    assert(!isIndexed());
+    m_generation = 0;
+    const Color* value = values + (top - y) * stride;
+    Color* pixel = m_pixels.data() + x + top * m_width;
+    for (int64_t row = top; row < bottom; row++) {
+        *pixel = *value;
+        pixel += m_width;
+        value += stride;
+    }
+}
+
 size_t Image::getWidth() const {
     return m_width;
 }
@@ -70,3 +162,38 @@ size_t Image::getHeight() const {
 std::pair<size_t, size_t> Image::getSize() const {
     return std::pair<size_t, size_t>(m_width, m_height);
 }
+
+bool Image::isIndexed() const {
+    return m_indices != nullptr;
+}
+
+const Color* Image::getPalette() const {
+    return m_palette;
+}
+
+const uint8_t* Image::getIndexRow(size_t y) const {
+    assert(y < m_height && isIndexed());
+    return m_indices + y * m_width;
+}
+
+// NOTE: Images are made on the playlist's thread too, so generations come
+// from one atomic counter
+uint64_t Image::getGeneration() const {
+    static std::atomic<uint64_t> lastGeneration(0);
+    if (m_generation == 0) {
+        m_generation = ++lastGeneration;
+    }
+    return m_generation;
+}
+
+const Color* Image::getRowColors(size_t y, std::vector<Color>* buffer) const {
+    if (!isIndexed()) {
+        return getRow(y);
+    }
+    const uint8_t* indices = getIndexRow(y);
+    buffer->resize(m_width);
+    for (size_t x = 0; x < m_width; x++) {
+        (*buffer)[x] = m_palette[indices[x]];
+    }
+    return buffer->data();
+}
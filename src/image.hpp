@@ -1,6 +1,10 @@
 #pragma once
 #include <vector>
+#include <string>
 #include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <memory>
 
 #define IMG_BUFFER_CHANNELS 4
 
@@ -19,16 +23,52 @@ public:
     Image() = default;
     Image(size_t width, size_t height, Color fill = Color());
     Image(uint8_t* stdiBuffer, size_t width, size_t height);
+    // Reads palette indices where storage keeps them, e.g. a shared memory
+    // segment, instead of owning the pixels. Copies share the storage. Such
+    // an image is read-only, only getPixel and the index accessors work.
+    Image(
+        std::shared_ptr<const void> storage,
+        const Color* palette,
+        const uint8_t* indices,
+        size_t width,
+        size_t height
+    );
+
+    static bool load(const std::string& path, Image* outImg);
 
     void resize(size_t p_width, size_t p_height, Color fill = Color());
     void clear(Color fill);
     void setPixel(size_t x, size_t y, Color value);
     Color getPixel(size_t x, size_t y) const;
+    // The row's pixels from left to right. Only the row is checked, and only
+    // in debug builds, so loops over many pixels index it directly.
+    Color* getRow(size_t y);
+    const Color* getRow(size_t y) const;
+    // Clipped to the image once per call, whatever falls outside is skipped.
+    // A column's values are stride apart, so another image's column can be
+    // copied from its row.
+    void fillRect(int x, int y, size_t width, size_t height, Color fill);
+    void blitRow(int x, int y, const Color* values, size_t count);
+    void blitColumn(int x, int y, const Color* values, size_t count, size_t stride = 1);
     size_t getWidth() const;
     size_t getHeight() const;
     std::pair<size_t, size_t> getSize() const;
+    bool isIndexed() const;
+    const Color* getPalette() const;
+    const uint8_t* getIndexRow(size_t y) const;
+    // The row's colors whatever the image holds, an indexed image's are
+    // looked up into buffer
+    const Color* getRowColors(size_t y, std::vector<Color>* buffer) const;
+    // Stays the same while the pixels do and is shared by copies, so equal
+    // generations mean equal pixels. Any change gets the image a new one.
+    uint64_t getGeneration() const;
 
 private:
     std::vector<Color> m_pixels;
     size_t m_width, m_height;
+    std::shared_ptr<const void> m_storage;
+    const Color* m_palette = nullptr;
+    const uint8_t* m_indices = nullptr;
+    // 0 until asked for after a change
+    mutable uint64_t m_generation = 0;
 };
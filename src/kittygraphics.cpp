@@ -0,0 +1,191 @@
+#include "kittygraphics.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "deflate.hpp"
+
+#define KITTY_APC_START ESC "_G"
+#define KITTY_APC_END   ESC "\\"
+
+KittyEncoder::KittyEncoder()
+    : m_tileColCount(0), m_tileRowCount(0), m_scale(1), m_isCleared(false) {}
+
+// Forgets what the terminal shows, the next frame deletes every image and
+// sends all tiles again
+void KittyEncoder::reset() {
+    m_isCleared = false;
+    m_shownTiles.clear();
+}
+
+void KittyEncoder::encodeFrame(
+    const Image& canvas,
+    std::pair<size_t, size_t> cellSize,
+    const std::vector<bool>& dirtyCells,
+    std::pair<int, int> cellPixelSize,
+    const TerminalController& term,
+    TermState& state,
+    std::string* out
+) {
+    size_t colCount = canvas.getWidth() / cellSize.first;
+    size_t rowCount = canvas.getHeight() / cellSize.second;
+    size_t tileColCount = (colCount + KITTY_TILE_COLS - 1) / KITTY_TILE_COLS;
+    size_t tileRowCount = (rowCount + KITTY_TILE_ROWS - 1) / KITTY_TILE_ROWS;
+
+    // Canvas pixels are scaled up by whole steps so the terminal doesn't
+    // blur them much when it fits the tiles to their cells
+    size_t scale = 1;
+    if (cellPixelSize.first > 0 && cellPixelSize.second > 0) {
+        scale = std::min(
+            static_cast<size_t>(cellPixelSize.first) / cellSize.first,
+            static_cast<size_t>(cellPixelSize.second) / cellSize.second
+        );
+        scale = std::max<size_t>(1, std::min<size_t>(scale, KITTY_MAX_SCALE));
+    }
+
+    if (tileColCount != m_tileColCount || tileRowCount != m_tileRowCount || scale != m_scale) {
+        reset();
+        m_tileColCount = tileColCount;
+        m_tileRowCount = tileRowCount;
+        m_scale = scale;
+    }
+    if (!m_isCleared) {
+        writeDeleteAll(out);
+        m_shownTiles.assign(tileColCount * tileRowCount, false);
+    }
+
+    for (size_t tileY = 0; tileY < tileRowCount; tileY++) {
+        for (size_t tileX = 0; tileX < tileColCount; tileX++) {
+            size_t tileIdx = tileX + tileY * tileColCount;
+            if (m_isCleared && !isTileDirty(tileX, tileY, colCount, rowCount, dirtyCells)) {
+                continue;
+            }
+            writeTile(canvas, cellSize, tileIdx, tileX, tileY, colCount, rowCount, term, state, out);
+        }
+    }
+    m_isCleared = true;
+}
+
+bool KittyEncoder::isTileDirty(
+    size_t tileX,
+    size_t tileY,
+    size_t colCount,
+    size_t rowCount,
+    const std::vector<bool>& dirtyCells
+) const {
+    size_t lastRow = std::min(rowCount, (tileY + 1) * KITTY_TILE_ROWS);
+    size_t lastCol = std::min(colCount, (tileX + 1) * KITTY_TILE_COLS);
+    for (size_t row = tileY * KITTY_TILE_ROWS; row < lastRow; row++) {
+        for (size_t col = tileX * KITTY_TILE_COLS; col < lastCol; col++) {
+            if (dirtyCells.at(col + row * colCount)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// NOTE: Transmitting with an ID that is in use replaces that image along with
+// its placement, so there is no need to delete the old tile first
+void KittyEncoder::writeTile(
+    const Image& canvas,
+    std::pair<size_t, size_t> cellSize,
+    size_t tileIdx,
+    size_t tileX,
+    size_t tileY,
+    size_t colCount,
+    size_t rowCount,
+    const TerminalController& term,
+    TermState& state,
+    std::string* out
+) {
+    uint32_t id = KITTY_IMAGE_ID_BASE + static_cast<uint32_t>(tileIdx);
+    size_t tileCols = std::min<size_t>(KITTY_TILE_COLS, colCount - tileX * KITTY_TILE_COLS);
+    size_t tileRows = std::min<size_t>(KITTY_TILE_ROWS, rowCount - tileY * KITTY_TILE_ROWS);
+    size_t originX = tileX * KITTY_TILE_COLS * cellSize.first;
+    size_t originY = tileY * KITTY_TILE_ROWS * cellSize.second;
+    size_t width = tileCols * cellSize.first * m_scale;
+    size_t height = tileRows * cellSize.second * m_scale;
+
+    std::vector<uint8_t> rgba(width * height * 4, 0);
+    bool isBlank = true;
+    for (size_t y = 0; y < height; y++) {
+        const Color* row = canvas.getRow(originY + y / m_scale) + originX;
+        for (size_t x = 0; x < width; x++) {
+            Color c = row[x / m_scale];
+            if (!c.a) {
+                continue;
+            }
+            uint8_t* px = &rgba.at((x + y * width) * 4);
+            px[0] = c.r;
+            px[1] = c.g;
+            px[2] = c.b;
+            px[3] = 255;
+            isBlank = false;
+        }
+    }
+
+    if (isBlank) {
+        if (m_shownTiles.at(tileIdx)) {
+            writeDelete(id, out);
+            m_shownTiles.at(tileIdx) = false;
+        }
+        return;
+    }
+    m_shownTiles.at(tileIdx) = true;
+
+    std::string payload;
+    std::vector<uint8_t> compressed = Deflate::compressZlib(rgba.data(), rgba.size());
+    appendBase64(compressed.data(), compressed.size(), &payload);
+
+    // C=1 keeps the cursor where it is, z=-1 puts the image under the text
+    // and q=2 stops the terminal from replying
+    term.writeMove(state, static_cast<int>(tileX * KITTY_TILE_COLS), static_cast<int>(tileY * KITTY_TILE_ROWS), out);
+    for (size_t pos = 0; pos < payload.size(); pos += KITTY_CHUNK_SIZE) {
+        bool isLast = pos + KITTY_CHUNK_SIZE >= payload.size();
+        *out += KITTY_APC_START;
+        if (pos == 0) {
+            *out += "a=T,f=32,o=z,s=" + std::to_string(width)
+                + ",v=" + std::to_string(height)
+                + ",i=" + std::to_string(id)
+                + ",p=1,c=" + std::to_string(tileCols)
+                + ",r=" + std::to_string(tileRows)
+                + ",C=1,z=-1,";
+        }
+        *out += isLast ? "q=2,m=0;" : "q=2,m=1;";
+        out->append(payload, pos, KITTY_CHUNK_SIZE);
+        *out += KITTY_APC_END;
+    }
+}
+
+void KittyEncoder::writeDelete(uint32_t id, std::string* out) {
+    *out += KITTY_APC_START "a=d,d=I,i=" + std::to_string(id) + ",q=2" KITTY_APC_END;
+}
+
+void KittyEncoder::writeDeleteAll(std::string* out) {
+    *out += KITTY_APC_START "a=d,d=A,q=2" KITTY_APC_END;
+}
+
+void KittyEncoder::appendBase64(const uint8_t* data, size_t size, std::string* out) {
+    static const char* ALPHABET =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    out->reserve(out->size() + (size + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= size; i += 3) {
+        uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        *out += ALPHABET[(v >> 18) & 0x3F];
+        *out += ALPHABET[(v >> 12) & 0x3F];
+        *out += ALPHABET[(v >> 6) & 0x3F];
+        *out += ALPHABET[v & 0x3F];
+    }
+    if (i < size) {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < size) {
+            v |= data[i + 1] << 8;
+        }
+        *out += ALPHABET[(v >> 18) & 0x3F];
+        *out += ALPHABET[(v >> 12) & 0x3F];
+        *out += i + 1 < size ? ALPHABET[(v >> 6) & 0x3F] : '=';
+        *out += '=';
+    }
+}
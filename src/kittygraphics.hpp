@@ -0,0 +1,64 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include "image.hpp"
+#include "terminal.hpp"
+
+#define KITTY_TILE_COLS       8
+#define KITTY_TILE_ROWS       4
+#define KITTY_IMAGE_ID_BASE   0x57560000u
+#define KITTY_CHUNK_SIZE      4096
+#define KITTY_MAX_SCALE       8
+
+// Sends the canvas as images through the kitty graphics protocol. The screen
+// is split into tiles of cells, each tile is its own image with a fixed ID, so
+// a frame only re-transmits the tiles that have changed cells and the
+// terminal swaps them in place. Tiles are zlib compressed RGBA, placed under
+// the text so message text still shows on top.
+class KittyEncoder {
+public:
+    KittyEncoder();
+
+    void reset();
+    void encodeFrame(
+        const Image& canvas,
+        std::pair<size_t, size_t> cellSize,
+        const std::vector<bool>& dirtyCells,
+        std::pair<int, int> cellPixelSize,
+        const TerminalController& term,
+        TermState& state,
+        std::string* out
+    );
+    static void writeDeleteAll(std::string* out);
+private:
+    size_t m_tileColCount;
+    size_t m_tileRowCount;
+    size_t m_scale;
+    bool m_isCleared;
+    std::vector<bool> m_shownTiles;
+
+    bool isTileDirty(
+        size_t tileX,
+        size_t tileY,
+        size_t colCount,
+        size_t rowCount,
+        const std::vector<bool>& dirtyCells
+    ) const;
+    void writeTile(
+        const Image& canvas,
+        std::pair<size_t, size_t> cellSize,
+        size_t tileIdx,
+        size_t tileX,
+        size_t tileY,
+        size_t colCount,
+        size_t rowCount,
+        const TerminalController& term,
+        TermState& state,
+        std::string* out
+    );
+    static void writeDelete(uint32_t id, std::string* out);
+    static void appendBase64(const uint8_t* data, size_t size, std::string* out);
+};
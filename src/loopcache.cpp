@@ -0,0 +1,117 @@
+#include "loopcache.hpp"
+#include <string>
+#include <vector>
+#include <utility>
+#include <cmath>
+#include <algorithm>
+
+LoopCache::LoopCache(int period)
+    : m_term(TerminalController::getInstance()), m_period(period), m_totalBytes(0)
+    , m_size(0, 0), m_colorMode(ColorMode::AUTO), m_shownFrame(-1), m_drawnFrame(-1)
+    , m_isRecording(false), m_isCanvasBehind(false) {}
+
+// Fewest frames after which every wave is back within tolerance pixels of
+// where it was, 0 if there are none within LOOP_CACHE_MAX_SECONDS. The loop is
+// at least one cycle of the slowest wave, otherwise a few frames that barely
+// move would do.
+// NOTE: A wave that is off by d cycles moves the flag by at most 2*PI*d times
+// its amplitude
+int LoopCache::findPeriod(const WaveConfig& waveConfig, int fps, float tolerance) {
+    int maxPeriod = LOOP_CACHE_MAX_SECONDS * fps;
+    int minPeriod = 1;
+    std::vector<std::pair<double, double>> waves;
+    for (const SineWave& w : waveConfig.waves) {
+        double cyclesPerFrame = std::abs(
+            static_cast<double>(waveConfig.speedMultiplier) * w.speed / w.wavelength / fps
+        );
+        double amplitude = std::abs(static_cast<double>(w.amplitude) * waveConfig.amplitudeMultiplier);
+        if (cyclesPerFrame == 0 || amplitude == 0) {
+            continue;
+        }
+        if (1 / cyclesPerFrame > maxPeriod) {
+            return 0;
+        }
+        minPeriod = std::max(minPeriod, static_cast<int>(std::ceil(1 / cyclesPerFrame)));
+        waves.push_back(std::pair<double, double>(amplitude, cyclesPerFrame));
+    }
+
+    for (int period = minPeriod; period <= maxPeriod; period++) {
+        double drift = 0;
+        for (const std::pair<double, double>& w : waves) {
+            double cycles = period * w.second;
+            drift += w.first * 2 * PI * std::abs(cycles - std::round(cycles));
+        }
+        if (drift <= tolerance) {
+            return period;
+        }
+    }
+    return 0;
+}
+
+float LoopCache::getTime(int idx, int fps) {
+    return static_cast<float>(idx) / fps;
+}
+
+int LoopCache::getPeriod() const {
+    return m_period;
+}
+
+// Sends frame idx if it is kept and comes right after the shown one. The
+// canvas is then behind the screen.
+bool LoopCache::replayFrame(int idx) {
+    checkTerminal();
+    if (m_shownFrame < 0 || idx != (m_shownFrame + 1) % m_period || !m_hasFrames.at(idx)) {
+        return false;
+    }
+    m_term.writeFrame(m_frames.at(idx));
+    m_term.invalidateState();
+    m_shownFrame = idx;
+    m_isCanvasBehind = true;
+    return true;
+}
+
+bool LoopCache::isCanvasBehind() const {
+    return m_isCanvasBehind;
+}
+
+// -1 until the first frame is drawn
+int LoopCache::getShownFrame() const {
+    return m_shownFrame;
+}
+
+// Call before the canvas draws frame idx, once it has caught up with the
+// shown frame. A diff from the frame before gets kept.
+void LoopCache::beginFrame(int idx) {
+    checkTerminal();
+    m_term.invalidateState();
+    m_isCanvasBehind = false;
+    m_drawnFrame = idx;
+    m_isRecording = m_shownFrame >= 0
+        && idx == (m_shownFrame + 1) % m_period
+        && !m_hasFrames.at(idx)
+        && m_totalBytes < LOOP_CACHE_MAX_BYTES;
+    m_term.setKeepingFrames(m_isRecording);
+}
+
+void LoopCache::endFrame() {
+    if (m_isRecording) {
+        std::string frame = m_term.takeKeptFrame();
+        m_totalBytes += frame.size();
+        m_frames.at(m_drawnFrame).swap(frame);
+        m_hasFrames.at(m_drawnFrame) = true;
+        m_term.setKeepingFrames(false);
+        m_isRecording = false;
+    }
+    m_shownFrame = m_drawnFrame;
+}
+
+void LoopCache::checkTerminal() {
+    if (m_term.getSize() == m_size && m_term.getColorMode() == m_colorMode) {
+        return;
+    }
+    m_frames.assign(m_period, std::string());
+    m_hasFrames.assign(m_period, false);
+    m_totalBytes = 0;
+    m_size = m_term.getSize();
+    m_colorMode = m_term.getColorMode();
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include "animation.hpp"
+#include "terminal.hpp"
+#include "palette.hpp"
+
+// Longest loop looked for, and most bytes kept for one
+#define LOOP_CACHE_MAX_SECONDS 60
+#define LOOP_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+// Remembers what was sent for each frame of an animation that repeats every
+// period frames, so the next time around it can be sent again without
+// drawing or encoding anything. Frame i holds what turns the screen from
+// frame i-1 into frame i, frame 0 turns the last frame back into the first.
+// Frames are only kept and replayed one after the other, and every frame
+// starts with an unknown terminal state, so they can follow each other no
+// matter who drew the previous one. The cache holds one terminal size and
+// color mode, it starts over when either changes.
+class LoopCache {
+public:
+    LoopCache(int period);
+
+    static int findPeriod(const WaveConfig& waveConfig, int fps, float tolerance);
+    static float getTime(int idx, int fps);
+
+    int getPeriod() const;
+    bool replayFrame(int idx);
+    bool isCanvasBehind() const;
+    int getShownFrame() const;
+    void beginFrame(int idx);
+    void endFrame();
+private:
+    TerminalController& m_term;
+    int m_period;
+    std::vector<std::string> m_frames;
+    std::vector<bool> m_hasFrames;
+    size_t m_totalBytes;
+    std::pair<int, int> m_size;
+    ColorMode m_colorMode;
+    int m_shownFrame;
+    int m_drawnFrame;
+    bool m_isRecording;
+    bool m_isCanvasBehind;
+
+    void checkTerminal();
+};
@@ -0,0 +1,133 @@
+#include "lz4.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// NOTE: Inputs too short for a match are a single run of literals
+void Lz4::compressBlock(const uint8_t* data, size_t size, std::vector<uint8_t>* out) {
+    std::vector<int32_t> heads(size_t(1) << LZ4_HASH_BITS, -1);
+    auto read32 = [data](size_t pos) {
+        uint32_t v;
+        memcpy(&v, data + pos, sizeof(v));
+        return v;
+    };
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (size > LZ4_MATCH_LIMIT && pos < size - LZ4_MATCH_LIMIT) {
+        uint32_t seq = read32(pos);
+        uint32_t hash = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        int32_t candidate = heads.at(hash);
+        heads.at(hash) = static_cast<int32_t>(pos);
+        if (candidate < 0
+            || pos - static_cast<size_t>(candidate) > LZ4_MAX_DISTANCE
+            || read32(candidate) != seq) {
+            pos++;
+            continue;
+        }
+
+        size_t length = LZ4_MIN_MATCH;
+        while (pos + length < size - LZ4_LAST_LITERALS && data[candidate + length] == data[pos + length]) {
+            length++;
+        }
+        writeSequence(data + anchor, pos - anchor, pos - candidate, length, out);
+        pos += length;
+        anchor = pos;
+    }
+    writeSequence(data + anchor, size - anchor, 0, 0, out);
+}
+
+// Returns false unless src is a well formed block of exactly dstSize bytes
+bool Lz4::decompressBlock(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) {
+    size_t in = 0;
+    size_t outPos = 0;
+    auto readLength = [&](size_t length, size_t* outLength) {
+        if (length == 15) {
+            uint8_t b;
+            do {
+                if (in >= srcSize) {
+                    return false;
+                }
+                b = src[in++];
+                length += b;
+            } while (b == 255);
+        }
+        *outLength = length;
+        return true;
+    };
+
+    while (in < srcSize) {
+        uint8_t token = src[in++];
+        size_t literalCount;
+        if (!readLength(token >> 4, &literalCount)
+            || literalCount > srcSize - in
+            || literalCount > dstSize - outPos) {
+            return false;
+        }
+        memcpy(dst + outPos, src + in, literalCount);
+        in += literalCount;
+        outPos += literalCount;
+        if (in == srcSize) {
+            break;
+        }
+
+        if (srcSize - in < 2) {
+            return false;
+        }
+        size_t distance = src[in] | (src[in + 1] << 8);
+        in += 2;
+        size_t matchLength;
+        if (!readLength(token & 15, &matchLength)) {
+            return false;
+        }
+        matchLength += LZ4_MIN_MATCH;
+        if (distance == 0 || distance > outPos || matchLength > dstSize - outPos) {
+            return false;
+        }
+        // NOTE: The match may overlap what it writes, that's how runs are
+        // encoded, so it's copied byte by byte
+        for (size_t i = 0; i < matchLength; i++) {
+            dst[outPos + i] = dst[outPos + i - distance];
+        }
+        outPos += matchLength;
+    }
+    return outPos == dstSize;
+}
+
+// Lengths of 15 and up continue in bytes of 255 and a final byte below it
+void Lz4::writeLength(size_t length, std::vector<uint8_t>* out) {
+    length -= 15;
+    while (length >= 255) {
+        out->push_back(255);
+        length -= 255;
+    }
+    out->push_back(static_cast<uint8_t>(length));
+}
+
+// A match length of 0 ends the block with just the literals
+void Lz4::writeSequence(
+    const uint8_t* literals,
+    size_t literalCount,
+    size_t distance,
+    size_t matchLength,
+    std::vector<uint8_t>* out
+) {
+    size_t matchCode = matchLength > 0 ? matchLength - LZ4_MIN_MATCH : 0;
+    uint8_t token = static_cast<uint8_t>(
+        (literalCount < 15 ? literalCount : 15) << 4 | (matchCode < 15 ? matchCode : 15)
+    );
+    out->push_back(token);
+    if (literalCount >= 15) {
+        writeLength(literalCount, out);
+    }
+    out->insert(out->end(), literals, literals + literalCount);
+    if (matchLength == 0) {
+        return;
+    }
+    out->push_back(static_cast<uint8_t>(distance));
+    out->push_back(static_cast<uint8_t>(distance >> 8));
+    if (matchCode >= 15) {
+        writeLength(matchCode, out);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#define LZ4_HASH_BITS      12
+#define LZ4_MAX_DISTANCE   65535
+#define LZ4_MIN_MATCH      4
+// The last match has to start this far from the end, and the last bytes are
+// always literals
+#define LZ4_MATCH_LIMIT    12
+#define LZ4_LAST_LITERALS  5
+// A block decompresses to at most this many times its size, a match costs at
+// least one byte per 255 bytes it copies
+#define LZ4_MAX_RATIO      255
+
+// The LZ4 block format, without the frame around it. Greedy matching with a
+// single hash probe, which already finds the long runs of repeated escape
+// sequences and blank cells that make up most of an encoded frame.
+class Lz4 {
+public:
+    static void compressBlock(const uint8_t* data, size_t size, std::vector<uint8_t>* out);
+    static bool decompressBlock(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+private:
+    static void writeLength(size_t length, std::vector<uint8_t>* out);
+    static void writeSequence(
+        const uint8_t* literals,
+        size_t literalCount,
+        size_t distance,
+        size_t matchLength,
+        std::vector<uint8_t>* out
+    );
+};
@@ -1,17 +1,15 @@
 #include "terminal.hpp"
 #include "animation.hpp"
 #include "arguments.hpp"
+#include "playlist.hpp"
+#include "transition.hpp"
+#include "eventloop.hpp"
+#include "loopcache.hpp"
+#include "bakedanimation.hpp"
 #define STB_IMAGE_IMPLEMENTATION
     #include "stb_image.h"
 #undef STB_IMAGE_IMPLEMENTATION
 
-#ifdef _WIN32
-    #include <windows.h>
-#else
-    #include <unistd.h>
-    #define Sleep(x) usleep(x * 1000)
-#endif
-
 int main(int argc, const char** argv) {
     ArgParser argParser(argc, argv);
 
@@ -23,18 +21,34 @@ int main(int argc, const char** argv) {
     }
 
     AppConfig conf = argParser.getAppConfig();
+    if (!conf.playPath.empty()) {
+        return BakedAnimation::play(conf.playPath) ? 0 : -1;
+    }
+    if (!conf.bakePath.empty()) {
+        return BakedAnimation::bake(conf) ? 0 : -1;
+    }
+    EventLoop loop(conf.fps);
     TerminalController& term = TerminalController::getInstance();
     Canvas& canvas = Canvas::getInstance();
+    Playlist playlist(conf.flagPaths, conf.playlistInterval, conf.useSharedCache, conf.flag);
+    Transition transition(conf.transitionType, conf.transitionTime);
+    LoopCache loopCache(conf.loopFrames);
 
+    term.setColorMode(conf.colorMode);
+    canvas.setDithering(conf.dither);
+    canvas.setGlyphMode(conf.glyphMode);
+    canvas.setEdgeSmoothing(conf.smoothEdges);
+    canvas.setBackend(conf.backend);
+    canvas.setFixedPoint(conf.isFixedPoint);
+    canvas.setDiffThreshold(conf.diffThreshold);
     term.assignPreferredFGandBG(conf.textColor, conf.bg);
     term.clearScreen();
-    float t = 0;
-    static const int fps = 24;
-    while (!term.shouldExit()) {
+
+    auto drawScene = [&](const Image& flag, float t) {
         canvas.beginDrawing(conf.bg);
         if (!conf.msg.empty()) {
             canvas.drawSceneFlagPoleAndMsg(
-                conf.flag,
+                flag,
                 conf.waveConfig,
                 conf.ambientLight,
                 conf.msg,
@@ -43,7 +57,7 @@ int main(int argc, const char** argv) {
         }
         else if (conf.fancyScene) {
             canvas.drawSceneFlagAndPole(
-                conf.flag,
+                flag,
                 conf.waveConfig,
                 conf.normalPos.first,
                 conf.normalPos.second,
@@ -53,7 +67,7 @@ int main(int argc, const char** argv) {
         }
         else {
             canvas.drawSceneFlagOnly(
-                conf.flag,
+                flag,
                 conf.waveConfig,
                 conf.normalPos.first,
                 conf.normalPos.second,
@@ -61,11 +75,56 @@ int main(int argc, const char** argv) {
                 t
             );
         }
+    };
+
+    int framesSinceDraw = 0;
+    while (loop.waitFrame()) {
+        framesSinceDraw++;
+        if (loop.isResizeSettling()
+            || term.isOutputBusy()
+            || framesSinceDraw < term.getFrameStride(conf.fps)) {
+            continue;
+        }
+        framesSinceDraw = 0;
+        bool isResized = loop.consumeResize();
+        float t = loop.getTime();
+        int loopFrame = -1;
+        if (loopCache.getPeriod() > 0) {
+            loopFrame = static_cast<int>(loop.getFrameIndex() % loopCache.getPeriod());
+            t = LoopCache::getTime(loopFrame, conf.fps);
+            if (!isResized && loopCache.replayFrame(loopFrame)) {
+                continue;
+            }
+            // NOTE: The canvas has to catch up with the screen before it can
+            // diff against it, and before a resize moves things around
+            if (loopCache.isCanvasBehind()) {
+                drawScene(
+                    playlist.getCurrent(),
+                    LoopCache::getTime(loopCache.getShownFrame(), conf.fps)
+                );
+                canvas.assumeDrawn();
+            }
+        }
+        if (isResized) {
+            term.refreshSize();
+        }
+        if (playlist.update(t)) {
+            transition.start(playlist.getPrevious(), playlist.getCurrent(), t);
+        }
+        const Image& flag = transition.isActive()
+            ? transition.getFrame(t)
+            : playlist.getCurrent();
+        if (loopFrame >= 0) {
+            loopCache.beginFrame(loopFrame);
+        }
+        drawScene(flag, t);
         canvas.endDrawing();
-        Sleep(1000/fps);
-        t += 1.0f/fps;
+        if (loopFrame >= 0) {
+            loopCache.endFrame();
+        }
     }
 
+    canvas.releaseGraphics();
     term.resetFGAndBG();
     term.getStream() << "\n";
     term.flush();
@@ -0,0 +1,103 @@
+#include "palette.hpp"
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "image.hpp"
+
+#define QUANT_TABLE_SIZE (1 << 15)
+
+static const uint8_t cubeLevels[6] = { 0, 95, 135, 175, 215, 255 };
+
+static const Color ansi16Colors[16] = {
+    Color(0, 0, 0),       Color(205, 0, 0),     Color(0, 205, 0),     Color(205, 205, 0),
+    Color(0, 0, 238),     Color(205, 0, 205),   Color(0, 205, 205),   Color(229, 229, 229),
+    Color(127, 127, 127), Color(255, 0, 0),     Color(0, 255, 0),     Color(255, 255, 0),
+    Color(92, 92, 255),   Color(255, 0, 255),   Color(0, 255, 255),   Color(255, 255, 255)
+};
+
+// 4x4 Bayer matrix, thresholds depend on the cell only so dithered areas
+// don't shimmer from frame to frame
+static const int bayer4x4[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 }
+};
+
+uint8_t ColorQuantizer::to256(Color c) {
+    return getTable(ColorMode::COLOR_256)[getTableIdx(c)];
+}
+
+uint8_t ColorQuantizer::to16(Color c) {
+    return getTable(ColorMode::COLOR_16)[getTableIdx(c)];
+}
+
+Color ColorQuantizer::dither(Color c, size_t x, size_t y, ColorMode mode) {
+    if (mode != ColorMode::COLOR_256 && mode != ColorMode::COLOR_16) {
+        return c;
+    }
+    // NOTE: Spread is roughly the distance between neighbouring palette colors
+    int spread = mode == ColorMode::COLOR_256 ? 40 : 128;
+    int offset = (bayer4x4[y % 4][x % 4] * 2 - 15) * spread / 32;
+    return Color(
+        static_cast<uint8_t>(std::clamp(c.r + offset, 0, 255)),
+        static_cast<uint8_t>(std::clamp(c.g + offset, 0, 255)),
+        static_cast<uint8_t>(std::clamp(c.b + offset, 0, 255)),
+        c.a
+    );
+}
+
+// NOTE: Entries 0-15 of the 256 color palette are the ANSI colors which
+// depend on the terminal theme, to256() never picks them
+Color ColorQuantizer::getPaletteColor(uint8_t idx) {
+    if (idx < 16) {
+        return ansi16Colors[idx];
+    }
+    if (idx < 232) {
+        int cubeIdx = idx - 16;
+        return Color(cubeLevels[cubeIdx / 36], cubeLevels[cubeIdx / 6 % 6], cubeLevels[cubeIdx % 6]);
+    }
+    uint8_t gray = static_cast<uint8_t>(8 + (idx - 232) * 10);
+    return Color(gray, gray, gray);
+}
+
+const uint8_t* ColorQuantizer::getTable(ColorMode mode) {
+    static std::vector<uint8_t> table256;
+    static std::vector<uint8_t> table16;
+    std::vector<uint8_t>& table = mode == ColorMode::COLOR_16 ? table16 : table256;
+    if (!table.empty()) {
+        return table.data();
+    }
+
+    int firstIdx = mode == ColorMode::COLOR_16 ? 0 : 16;
+    int lastIdx = mode == ColorMode::COLOR_16 ? 15 : 255;
+    table.resize(QUANT_TABLE_SIZE);
+    for (size_t i = 0; i < QUANT_TABLE_SIZE; i++) {
+        // Use the center of the 5-bit bucket
+        int r = static_cast<int>((i >> 10) & 31) * 8 + 4;
+        int g = static_cast<int>((i >> 5) & 31) * 8 + 4;
+        int b = static_cast<int>(i & 31) * 8 + 4;
+        int bestIdx = firstIdx;
+        int bestDist = INT32_MAX;
+        for (int idx = firstIdx; idx <= lastIdx; idx++) {
+            Color p = getPaletteColor(static_cast<uint8_t>(idx));
+            int dr = r - p.r;
+            int dg = g - p.g;
+            int db = b - p.b;
+            // NOTE: Cheap perceptual weighting, green matters most and blue least
+            int dist = 3 * dr * dr + 4 * dg * dg + 2 * db * db;
+            if (dist < bestDist) {
+                bestDist = dist;
+                bestIdx = idx;
+            }
+        }
+        table.at(i) = static_cast<uint8_t>(bestIdx);
+    }
+    return table.data();
+}
+
+size_t ColorQuantizer::getTableIdx(Color c) {
+    return (static_cast<size_t>(c.r >> 3) << 10)
+        | (static_cast<size_t>(c.g >> 3) << 5)
+        | static_cast<size_t>(c.b >> 3);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "image.hpp"
+
+enum class ColorMode {
+    AUTO,
+    TRUECOLOR,
+    COLOR_256,
+    COLOR_16
+};
+
+// Maps colors to the xterm 256 and ANSI 16 color palettes. Lookups go through
+// tables indexed by 15-bit RGB that are built on first use.
+class ColorQuantizer {
+public:
+    static uint8_t to256(Color c);
+    static uint8_t to16(Color c);
+    static Color dither(Color c, size_t x, size_t y, ColorMode mode);
+    static Color getPaletteColor(uint8_t idx);
+private:
+    static const uint8_t* getTable(ColorMode mode);
+    static size_t getTableIdx(Color c);
+};
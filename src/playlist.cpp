@@ -0,0 +1,73 @@
+#include "playlist.hpp"
+#include <string>
+#include <vector>
+#include <future>
+#include <chrono>
+#include "image.hpp"
+#include "sharedcache.hpp"
+
+Playlist::Playlist(
+    const std::vector<std::string>& paths,
+    float interval,
+    bool useSharedCache,
+    const Image& first
+)
+    : m_paths(paths), m_interval(interval), m_useSharedCache(useSharedCache)
+    , m_switchTime(interval), m_curr(first) {
+    if (m_paths.size() > 1) {
+        prefetch(1);
+    }
+}
+
+bool Playlist::loadFlag(const std::string& path, bool useSharedCache, Image* outImg) {
+    if (useSharedCache) {
+        return SharedAssetCache::load(path, outImg);
+    }
+    return Image::load(path, outImg);
+}
+
+bool Playlist::update(float time) {
+    if (time < m_switchTime || m_paths.size() < 2) {
+        return false;
+    }
+
+    // NOTE: If the next flag is somehow still loading, keep waving the current
+    // one and check again on the next frame instead of blocking
+    if (m_next.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return false;
+    }
+
+    // A flag that failed to load is skipped until the playlist comes back to
+    // it. The one after it is tried on the next tick, not the next frame, so
+    // a broken file costs a load per interval.
+    PreparedFlag next = m_next.get();
+    prefetch((next.idx + 1) % m_paths.size());
+    if (!next.isLoaded) {
+        m_switchTime = time + m_interval;
+        return false;
+    }
+
+    m_prev = std::move(m_curr);
+    m_curr = std::move(next.img);
+    m_switchTime = time + m_interval;
+    return true;
+}
+
+const Image& Playlist::getCurrent() const {
+    return m_curr;
+}
+
+const Image& Playlist::getPrevious() const {
+    return m_prev;
+}
+
+void Playlist::prefetch(size_t idx) {
+    std::string path = m_paths.at(idx);
+    bool useSharedCache = m_useSharedCache;
+    m_next = std::async(std::launch::async, [idx, path, useSharedCache]() {
+        PreparedFlag prepared;
+        prepared.idx = idx;
+        prepared.isLoaded = loadFlag(path, useSharedCache, &prepared.img);
+        return prepared;
+    });
+}
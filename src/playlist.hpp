@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <future>
+#include "image.hpp"
+
+// Cycles through flags on a timer. The flag after the current one is always
+// being loaded on a background thread so that switching never has to wait for
+// the disk or the decoder.
+class Playlist {
+public:
+    Playlist(
+        const std::vector<std::string>& paths,
+        float interval,
+        bool useSharedCache,
+        const Image& first
+    );
+
+    static bool loadFlag(const std::string& path, bool useSharedCache, Image* outImg);
+
+    bool update(float time);
+    const Image& getCurrent() const;
+    const Image& getPrevious() const;
+private:
+    struct PreparedFlag {
+        size_t idx;
+        bool isLoaded;
+        Image img;
+    };
+
+    std::vector<std::string> m_paths;
+    float m_interval;
+    bool m_useSharedCache;
+    float m_switchTime;
+    Image m_curr;
+    Image m_prev;
+    std::future<PreparedFlag> m_next;
+
+    void prefetch(size_t idx);
+};
@@ -0,0 +1,272 @@
+#include "shading.hpp"
+#include <vector>
+#include <cstdint>
+#ifdef SHADING_HAS_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#endif
+
+// Only the kernels are compiled for their instruction set, the rest of the
+// program still runs on any CPU. MSVC takes the intrinsics without a flag.
+#if defined(SHADING_HAS_X86) && (defined(__GNUC__) || defined(__clang__))
+    #define SHADING_TARGET_SSE2 __attribute__((target("sse2")))
+    #define SHADING_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+    #define SHADING_TARGET_SSE2
+    #define SHADING_TARGET_AVX2
+#endif
+
+// NOTE: The x86 kernels write each color as one little endian word
+static_assert(sizeof(Color) == 4, "Colors are expected to be r, g, b and a bytes");
+
+void ColumnPlanes::assign(const Image& img) {
+    width = img.getWidth();
+    height = img.getHeight();
+    r.resize(width * height);
+    g.resize(width * height);
+    b.resize(width * height);
+    a.resize(width * height);
+    std::vector<Color> rowBuffer;
+    for (size_t y = 0; y < height; y++) {
+        const Color* row = img.getRowColors(y, &rowBuffer);
+        for (size_t x = 0; x < width; x++) {
+            Color color = row[x];
+            size_t idx = x * height + y;
+            r[idx] = color.r;
+            g[idx] = color.g;
+            b[idx] = color.b;
+            a[idx] = color.a ? 1 : 0;
+        }
+    }
+}
+
+SimdLevel Shading::getSimdLevel() {
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+const char* Shading::getLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX2:
+            return "AVX2";
+        case SimdLevel::SSE2:
+            return "SSE2";
+        default:
+            return "scalar";
+    }
+}
+
+void Shading::shadeColumn(const ColumnPlanes& planes, size_t x, float light, Color* out) {
+    static const Kernel kernel = getKernel(getSimdLevel());
+    size_t offset = x * planes.height;
+    kernel(
+        planes.r.data() + offset,
+        planes.g.data() + offset,
+        planes.b.data() + offset,
+        planes.a.data() + offset,
+        planes.height,
+        light,
+        out
+    );
+}
+
+// Levels the CPU doesn't have fall back to the best one it has
+void Shading::shadeColumn(
+    SimdLevel level,
+    const ColumnPlanes& planes,
+    size_t x,
+    float light,
+    Color* out
+) {
+    Kernel kernel = getKernel(level <= getSimdLevel() ? level : getSimdLevel());
+    size_t offset = x * planes.height;
+    kernel(
+        planes.r.data() + offset,
+        planes.g.data() + offset,
+        planes.b.data() + offset,
+        planes.a.data() + offset,
+        planes.height,
+        light,
+        out
+    );
+}
+
+// NOTE: Made for CPUs without SIMD or FPU to speak of, so it stays scalar
+void Shading::shadeColumnFixed(const ColumnPlanes& planes, size_t x, uint32_t light, Color* out) {
+    size_t offset = x * planes.height;
+    const uint8_t* r = planes.r.data() + offset;
+    const uint8_t* g = planes.g.data() + offset;
+    const uint8_t* b = planes.b.data() + offset;
+    const uint8_t* a = planes.a.data() + offset;
+    for (size_t i = 0; i < planes.height; i++) {
+        out[i] = Color(
+            static_cast<uint8_t>((r[i] * light) >> 8),
+            static_cast<uint8_t>((g[i] * light) >> 8),
+            static_cast<uint8_t>((b[i] * light) >> 8),
+            a[i] != 0
+        );
+    }
+}
+
+Color Shading::shadePixelFixed(Color color, uint32_t light) {
+    return Color(
+        static_cast<uint8_t>((color.r * light) >> 8),
+        static_cast<uint8_t>((color.g * light) >> 8),
+        static_cast<uint8_t>((color.b * light) >> 8),
+        color.a
+    );
+}
+
+// NOTE: AVX2 also needs the OS to save the wider registers, the compiler
+// builtin checks that as well
+SimdLevel Shading::detectSimdLevel() {
+#if defined(SHADING_HAS_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return SimdLevel::SSE2;
+    }
+#elif defined(SHADING_HAS_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool hasSSE2 = (info[3] & (1 << 26)) != 0;
+    bool hasAVX = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0
+        && (_xgetbv(0) & 0x6) == 0x6;
+    if (hasAVX && maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        if ((info[1] & (1 << 5)) != 0) {
+            return SimdLevel::AVX2;
+        }
+    }
+    if (hasSSE2) {
+        return SimdLevel::SSE2;
+    }
+#endif
+    return SimdLevel::SCALAR;
+}
+
+Shading::Kernel Shading::getKernel(SimdLevel level) {
+#ifdef SHADING_HAS_X86
+    if (level == SimdLevel::AVX2) {
+        return &shadeAVX2;
+    }
+    if (level == SimdLevel::SSE2) {
+        return &shadeSSE2;
+    }
+#else
+    (void)level;
+#endif
+    return &shadeScalar;
+}
+
+void Shading::shadeScalar(
+    const uint8_t* r,
+    const uint8_t* g,
+    const uint8_t* b,
+    const uint8_t* a,
+    size_t count,
+    float light,
+    Color* out
+) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = Color(r[i], g[i], b[i], a[i] != 0) * light;
+    }
+}
+
+#ifdef SHADING_HAS_X86
+// Four channel words in, four packed colors out. Alpha isn't scaled.
+SHADING_TARGET_SSE2
+static inline __m128i shadeFourSSE2(__m128i r, __m128i g, __m128i b, __m128i a, __m128 light) {
+    r = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(r), light));
+    g = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(g), light));
+    b = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(b), light));
+    return _mm_or_si128(
+        _mm_or_si128(r, _mm_slli_epi32(g, 8)),
+        _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24))
+    );
+}
+
+// Sixteen pixels per step, the bytes are widened to words in quarters
+SHADING_TARGET_SSE2
+void Shading::shadeSSE2(
+    const uint8_t* r,
+    const uint8_t* g,
+    const uint8_t* b,
+    const uint8_t* a,
+    size_t count,
+    float light,
+    Color* out
+) {
+    __m128 lightVec = _mm_set1_ps(light);
+    __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i rBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+        __m128i gBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i));
+        __m128i bBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i aBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i halves[4][2] = {
+            { _mm_unpacklo_epi8(rBytes, zero), _mm_unpackhi_epi8(rBytes, zero) },
+            { _mm_unpacklo_epi8(gBytes, zero), _mm_unpackhi_epi8(gBytes, zero) },
+            { _mm_unpacklo_epi8(bBytes, zero), _mm_unpackhi_epi8(bBytes, zero) },
+            { _mm_unpacklo_epi8(aBytes, zero), _mm_unpackhi_epi8(aBytes, zero) }
+        };
+        for (int half = 0; half < 2; half++) {
+            __m128i lo = shadeFourSSE2(
+                _mm_unpacklo_epi16(halves[0][half], zero),
+                _mm_unpacklo_epi16(halves[1][half], zero),
+                _mm_unpacklo_epi16(halves[2][half], zero),
+                _mm_unpacklo_epi16(halves[3][half], zero),
+                lightVec
+            );
+            __m128i hi = shadeFourSSE2(
+                _mm_unpackhi_epi16(halves[0][half], zero),
+                _mm_unpackhi_epi16(halves[1][half], zero),
+                _mm_unpackhi_epi16(halves[2][half], zero),
+                _mm_unpackhi_epi16(halves[3][half], zero),
+                lightVec
+            );
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + half * 8), lo);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + half * 8 + 4), hi);
+        }
+    }
+    shadeScalar(r + i, g + i, b + i, a + i, count - i, light, out + i);
+}
+
+SHADING_TARGET_AVX2
+static inline __m256i loadEightAVX2(const uint8_t* bytes) {
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bytes)));
+}
+
+// Eight pixels per step, widening bytes to words directly
+SHADING_TARGET_AVX2
+void Shading::shadeAVX2(
+    const uint8_t* r,
+    const uint8_t* g,
+    const uint8_t* b,
+    const uint8_t* a,
+    size_t count,
+    float light,
+    Color* out
+) {
+    __m256 lightVec = _mm256_set1_ps(light);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i rWords = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(loadEightAVX2(r + i)), lightVec));
+        __m256i gWords = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(loadEightAVX2(g + i)), lightVec));
+        __m256i bWords = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(loadEightAVX2(b + i)), lightVec));
+        __m256i colors = _mm256_or_si256(
+            _mm256_or_si256(rWords, _mm256_slli_epi32(gWords, 8)),
+            _mm256_or_si256(_mm256_slli_epi32(bWords, 16), _mm256_slli_epi32(loadEightAVX2(a + i), 24))
+        );
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), colors);
+    }
+    shadeScalar(r + i, g + i, b + i, a + i, count - i, light, out + i);
+}
+#endif
@@ -0,0 +1,98 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "image.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define SHADING_HAS_X86
+#endif
+
+// Full light for the integer shading, colors are multiplied by the light and
+// shifted down by 8
+#define SHADING_FIXED_ONE 256
+
+// Ordered, a CPU with one level has all the ones before it
+enum class SimdLevel {
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+// An image's channels stored column by column, each column's pixels one
+// after the other. Indexed images are looked up in their palette once, when
+// the planes are assigned.
+struct ColumnPlanes {
+    std::vector<uint8_t> r;
+    std::vector<uint8_t> g;
+    std::vector<uint8_t> b;
+    std::vector<uint8_t> a;
+    size_t width;
+    size_t height;
+
+    void assign(const Image& img);
+};
+
+// Scales the colors of a flag column by its light level, several pixels at a
+// time where the CPU can. The best level is detected once, the first time it
+// is needed. Every level gives the same colors as Color::operator* does, for
+// lights from 0 to 1. The fixed ones take the light out of SHADING_FIXED_ONE
+// and use integers only, a light of n / SHADING_FIXED_ONE gives the same
+// colors as the float one.
+class Shading {
+public:
+    static SimdLevel getSimdLevel();
+    static const char* getLevelName(SimdLevel level);
+    static void shadeColumn(const ColumnPlanes& planes, size_t x, float light, Color* out);
+    static void shadeColumn(
+        SimdLevel level,
+        const ColumnPlanes& planes,
+        size_t x,
+        float light,
+        Color* out
+    );
+    static void shadeColumnFixed(const ColumnPlanes& planes, size_t x, uint32_t light, Color* out);
+    static Color shadePixelFixed(Color color, uint32_t light);
+private:
+    typedef void (*Kernel)(
+        const uint8_t* r,
+        const uint8_t* g,
+        const uint8_t* b,
+        const uint8_t* a,
+        size_t count,
+        float light,
+        Color* out
+    );
+
+    static SimdLevel detectSimdLevel();
+    static Kernel getKernel(SimdLevel level);
+    static void shadeScalar(
+        const uint8_t* r,
+        const uint8_t* g,
+        const uint8_t* b,
+        const uint8_t* a,
+        size_t count,
+        float light,
+        Color* out
+    );
+#ifdef SHADING_HAS_X86
+    static void shadeSSE2(
+        const uint8_t* r,
+        const uint8_t* g,
+        const uint8_t* b,
+        const uint8_t* a,
+        size_t count,
+        float light,
+        Color* out
+    );
+    static void shadeAVX2(
+        const uint8_t* r,
+        const uint8_t* g,
+        const uint8_t* b,
+        const uint8_t* a,
+        size_t count,
+        float light,
+        Color* out
+    );
+#endif
+};
@@ -0,0 +1,231 @@
+#include "sharedcache.hpp"
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include <memory>
+#include "image.hpp"
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <errno.h>
+#endif
+
+#define SHARED_CACHE_WAIT_TRIES 100
+#define SHARED_CACHE_WAIT_US    2000
+// Times to look for the segment again when another process creates it first
+#define SHARED_CACHE_OPEN_TRIES 3
+
+bool SharedAssetCache::load(const std::string& path, Image* outImg) {
+#ifdef _WIN32
+    return Image::load(path, outImg);
+#else
+    std::error_code ec;
+    std::filesystem::path canonPath = std::filesystem::canonical(path, ec);
+    if (ec || canonPath.string().size() >= SHARED_CACHE_MAX_PATH) {
+        return Image::load(path, outImg);
+    }
+    struct stat fileStat;
+    if (stat(canonPath.c_str(), &fileStat) != 0) {
+        return Image::load(path, outImg);
+    }
+
+    Header expected{};
+    expected.magic = SHARED_CACHE_MAGIC;
+    expected.version = SHARED_CACHE_VERSION;
+    expected.fileMTime = static_cast<int64_t>(fileStat.st_mtime);
+    expected.fileSize = static_cast<uint64_t>(fileStat.st_size);
+    strncpy(expected.path, canonPath.c_str(), SHARED_CACHE_MAX_PATH - 1);
+
+    // NOTE: Only a segment that was checked and found stale or abandoned is
+    // unlinked, processes that still map it keep their mapping. Losing the
+    // race to create it means another process is filling it, so look again.
+    // A segment owned by another user is never trusted, the image is decoded
+    // privately instead.
+    std::string name = segmentName(canonPath.string(), getuid());
+    Image decoded;
+    bool isDecoded = false;
+    for (int i = 0; i < SHARED_CACHE_OPEN_TRIES; i++) {
+        MapResult mapResult = mapExisting(name, expected, outImg);
+        if (mapResult == MAP_DONE) {
+            return true;
+        }
+        if (mapResult == MAP_INVALID) {
+            shm_unlink(name.c_str());
+        }
+        if (!isDecoded) {
+            if (!Image::load(path, &decoded)) {
+                return false;
+            }
+            isDecoded = true;
+        }
+        if (mapResult == MAP_FOREIGN) {
+            break;
+        }
+        FillResult fillResult = fill(name, expected, decoded, outImg);
+        if (fillResult == FILL_DONE) {
+            return true;
+        }
+        if (fillResult == FILL_FAILED) {
+            break;
+        }
+    }
+    *outImg = decoded;
+    return true;
+#endif
+}
+
+#ifndef _WIN32
+// NOTE: 64-bit FNV-1a, collisions are caught by the path stored in the header.
+// Every user gets their own segments.
+std::string SharedAssetCache::segmentName(const std::string& path, uid_t uid) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : path) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    char name[48];
+    snprintf(
+        name,
+        sizeof(name),
+        "/wavet-%lu-%016llx",
+        static_cast<unsigned long>(uid),
+        static_cast<unsigned long long>(hash)
+    );
+    return std::string(name);
+}
+
+// A segment that isn't ready after the wait was left behind by a process that
+// died while filling it, like one for another file it is invalid
+SharedAssetCache::MapResult SharedAssetCache::mapExisting(
+    const std::string& name,
+    const Header& expected,
+    Image* outImg
+) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return MAP_MISSING;
+    }
+    // Anyone who can guess the name can create the segment first
+    struct stat ownerStat;
+    if (fstat(fd, &ownerStat) != 0 || (ownerStat.st_uid != getuid() && ownerStat.st_uid != 0)) {
+        close(fd);
+        return MAP_FOREIGN;
+    }
+
+    // The creator may still be sizing or filling the segment, give it a moment
+    struct stat segStat;
+    const Header* header = nullptr;
+    size_t segSize = 0;
+    bool isReady = false;
+    for (int i = 0; i < SHARED_CACHE_WAIT_TRIES; i++) {
+        if (header == nullptr) {
+            if (fstat(fd, &segStat) == 0 && static_cast<size_t>(segStat.st_size) >= sizeof(Header)) {
+                segSize = static_cast<size_t>(segStat.st_size);
+                void* mapped = mmap(nullptr, segSize, PROT_READ, MAP_SHARED, fd, 0);
+                if (mapped != MAP_FAILED) {
+                    header = static_cast<const Header*>(mapped);
+                }
+            }
+        }
+        if (header != nullptr && __atomic_load_n(&header->state, __ATOMIC_ACQUIRE) == STATE_READY) {
+            isReady = true;
+            break;
+        }
+        usleep(SHARED_CACHE_WAIT_US);
+    }
+    close(fd);
+
+    if (header == nullptr) {
+        return MAP_INVALID;
+    }
+
+    bool isValid = isReady
+        && header->magic == expected.magic
+        && header->version == expected.version
+        && header->fileMTime == expected.fileMTime
+        && header->fileSize == expected.fileSize
+        && strncmp(header->path, expected.path, SHARED_CACHE_MAX_PATH) == 0
+        && header->paletteSize <= SHARED_CACHE_MAX_COLORS
+        && segSize >= sizeof(Header) + size_t(header->width) * header->height;
+    if (!isValid) {
+        munmap(const_cast<Header*>(header), segSize);
+        return MAP_INVALID;
+    }
+    *outImg = fromMapping(header, segSize);
+    return MAP_DONE;
+}
+
+// The segment is created exclusively, FILL_TAKEN means another process has
+// created it in the meantime. On success the image is drawn from the segment
+// like in every other process.
+SharedAssetCache::FillResult SharedAssetCache::fill(
+    const std::string& name,
+    const Header& expected,
+    const Image& img,
+    Image* outImg
+) {
+    std::vector<Color> palette;
+    std::vector<uint8_t> indices(img.getWidth() * img.getHeight());
+    for (size_t y = 0; y < img.getHeight(); y++) {
+        for (size_t x = 0; x < img.getWidth(); x++) {
+            Color c = img.getPixel(x, y);
+            size_t idx = 0;
+            while (idx < palette.size() && !(palette.at(idx) == c)) {
+                idx++;
+            }
+            if (idx == palette.size()) {
+                if (palette.size() == SHARED_CACHE_MAX_COLORS) {
+                    return FILL_FAILED;
+                }
+                palette.push_back(c);
+            }
+            indices.at(x + y * img.getWidth()) = static_cast<uint8_t>(idx);
+        }
+    }
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        return errno == EEXIST ? FILL_TAKEN : FILL_FAILED;
+    }
+
+    size_t segSize = sizeof(Header) + indices.size();
+    if (ftruncate(fd, static_cast<off_t>(segSize)) != 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+        return FILL_FAILED;
+    }
+    void* mapped = mmap(nullptr, segSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return FILL_FAILED;
+    }
+
+    Header* header = static_cast<Header*>(mapped);
+    memcpy(header, &expected, sizeof(Header));
+    header->state = STATE_FILLING;
+    header->width = static_cast<uint32_t>(img.getWidth());
+    header->height = static_cast<uint32_t>(img.getHeight());
+    header->paletteSize = static_cast<uint32_t>(palette.size());
+    std::copy(palette.begin(), palette.end(), header->palette);
+    memcpy(header + 1, indices.data(), indices.size());
+    __atomic_store_n(&header->state, STATE_READY, __ATOMIC_RELEASE);
+    *outImg = fromMapping(header, segSize);
+    return FILL_DONE;
+}
+
+// The image owns the mapping, it is unmapped with the last copy
+Image SharedAssetCache::fromMapping(const Header* header, size_t segSize) {
+    std::shared_ptr<const void> mapping(header, [segSize](const void* mapped) {
+        munmap(const_cast<void*>(mapped), segSize);
+    });
+    const uint8_t* indices = reinterpret_cast<const uint8_t*>(header + 1);
+    return Image(mapping, header->palette, indices, header->width, header->height);
+}
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include "image.hpp"
+#ifndef _WIN32
+    #include <sys/types.h>
+#endif
+
+#define SHARED_CACHE_MAGIC      0x54564157u // "WAVT"
+#define SHARED_CACHE_VERSION    1
+#define SHARED_CACHE_MAX_COLORS 256
+#define SHARED_CACHE_MAX_PATH   512
+
+// Decoded flags are kept in one POSIX shared memory segment per user and
+// image. The segment name is derived from the user id and the image path, and
+// its header acts as the index entry that tells whether the segment belongs to
+// that exact file. The first process decodes the image and fills the segment,
+// later processes of the same user map it read-only and skip the decoding. Every process draws from the mapping
+// through an indexed Image, which keeps it mapped. Only available on POSIX
+// systems, on other platforms load() just decodes the image privately.
+class SharedAssetCache {
+public:
+    static bool load(const std::string& path, Image* outImg);
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t state;
+        uint32_t width;
+        uint32_t height;
+        uint32_t paletteSize;
+        int64_t fileMTime;
+        uint64_t fileSize;
+        char path[SHARED_CACHE_MAX_PATH];
+        Color palette[SHARED_CACHE_MAX_COLORS];
+        // Followed by width * height palette indices
+    };
+
+    enum State : uint32_t {
+        STATE_FILLING = 0,
+        STATE_READY = 1
+    };
+
+    enum MapResult {
+        MAP_DONE,
+        MAP_MISSING,
+        MAP_INVALID,
+        MAP_FOREIGN
+    };
+
+    enum FillResult {
+        FILL_DONE,
+        FILL_TAKEN,
+        FILL_FAILED
+    };
+
+#ifndef _WIN32
+    static std::string segmentName(const std::string& path, uid_t uid);
+    static MapResult mapExisting(const std::string& name, const Header& expected, Image* outImg);
+    static FillResult fill(const std::string& name, const Header& expected, const Image& img, Image* outImg);
+    static Image fromMapping(const Header* header, size_t segSize);
+#endif
+};
@@ -0,0 +1,273 @@
+#include "sixelgraphics.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "palette.hpp"
+
+#define SIXEL_START ESC "P0;1;0q"
+#define SIXEL_END   ESC "\\"
+
+SixelEncoder::SixelEncoder()
+    : m_isCleared(false) {}
+
+// Forgets what the terminal shows, the next frame clears the screen and draws
+// everything again
+void SixelEncoder::reset() {
+    m_isCleared = false;
+}
+
+// NOTE: The last row is never drawn, an image reaching it would leave the
+// cursor below the screen and scroll it
+void SixelEncoder::encodeFrame(
+    const Image& canvas,
+    std::pair<size_t, size_t> cellSize,
+    const std::vector<bool>& dirtyCells,
+    std::pair<int, int> cellPixelSize,
+    const TerminalController& term,
+    TermState& state,
+    std::string* out
+) {
+    size_t colCount = canvas.getWidth() / cellSize.first;
+    size_t rowCount = canvas.getHeight() / cellSize.second;
+    std::pair<size_t, size_t> pixelSize(SIXEL_DEFAULT_CELL_WIDTH, SIXEL_DEFAULT_CELL_HEIGHT);
+    if (cellPixelSize.first > 0 && cellPixelSize.second > 0) {
+        pixelSize = std::pair<size_t, size_t>(cellPixelSize.first, cellPixelSize.second);
+    }
+
+    bool isAfterClear = !m_isCleared;
+    if (isAfterClear) {
+        *out += CSI "2J";
+        state.cursorX = -1;
+        state.cursorY = -1;
+        m_isCleared = true;
+    }
+
+    // Consecutive dirty rows are merged into one image over all their dirty
+    // columns, one image costs less than many small ones
+    size_t drawnRowCount = rowCount > 1 ? rowCount - 1 : rowCount;
+    size_t groupStart = 0;
+    size_t groupColStart = colCount;
+    size_t groupColEnd = 0;
+    for (size_t row = 0; row <= drawnRowCount; row++) {
+        size_t colStart = colCount;
+        size_t colEnd = 0;
+        for (size_t col = 0; col < colCount && row < drawnRowCount; col++) {
+            if (isAfterClear || dirtyCells.at(col + row * colCount)) {
+                colStart = std::min(colStart, col);
+                colEnd = col + 1;
+            }
+        }
+        if (colStart < colEnd) {
+            if (groupColStart >= groupColEnd) {
+                groupStart = row;
+            }
+            groupColStart = std::min(groupColStart, colStart);
+            groupColEnd = std::max(groupColEnd, colEnd);
+            continue;
+        }
+        if (groupColStart < groupColEnd) {
+            writeImage(
+                canvas,
+                cellSize,
+                pixelSize,
+                std::pair<size_t, size_t>(groupColStart, groupColEnd),
+                std::pair<size_t, size_t>(groupStart, row),
+                isAfterClear,
+                term,
+                state,
+                out
+            );
+        }
+        groupColStart = colCount;
+        groupColEnd = 0;
+    }
+}
+
+// Cells the image doesn't cover fully are erased first, sixels only paint the
+// pixels that are set and would leave the old image showing through
+void SixelEncoder::writeImage(
+    const Image& canvas,
+    std::pair<size_t, size_t> cellSize,
+    std::pair<size_t, size_t> pixelSize,
+    std::pair<size_t, size_t> cols,
+    std::pair<size_t, size_t> rows,
+    bool isAfterClear,
+    const TerminalController& term,
+    TermState& state,
+    std::string* out
+) {
+    size_t canvasX = cols.first * cellSize.first;
+    size_t canvasY = rows.first * cellSize.second;
+    size_t canvasWidth = (cols.second - cols.first) * cellSize.first;
+    size_t canvasHeight = (rows.second - rows.first) * cellSize.second;
+
+    // Start over with the registers when the new colors don't fit, and if the
+    // image alone has too many colors fall back to the 256 color palette
+    std::vector<uint32_t> keys;
+    keys.reserve(canvasWidth * canvasHeight);
+    for (size_t y = 0; y < canvasHeight; y++) {
+        const Color* row = canvas.getRow(canvasY + y) + canvasX;
+        for (size_t x = 0; x < canvasWidth; x++) {
+            Color c = row[x];
+            if (c.a) {
+                keys.push_back((c.r << 16) | (c.g << 8) | c.b);
+            }
+        }
+    }
+    bool hasTransparent = keys.size() < canvasWidth * canvasHeight;
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    size_t newColorCount = 0;
+    for (uint32_t key : keys) {
+        newColorCount += m_registers.count(key) == 0 ? 1 : 0;
+    }
+    bool isQuantized = false;
+    if (m_registers.size() + newColorCount > SIXEL_MAX_REGISTERS) {
+        m_registers.clear();
+        m_registerColors.clear();
+        isQuantized = keys.size() > SIXEL_MAX_REGISTERS;
+    }
+
+    std::vector<int16_t> canvasRegisters(canvasWidth * canvasHeight, -1);
+    std::vector<bool> isRegisterUsed(SIXEL_MAX_REGISTERS, false);
+    for (size_t y = 0; y < canvasHeight; y++) {
+        const Color* row = canvas.getRow(canvasY + y) + canvasX;
+        for (size_t x = 0; x < canvasWidth; x++) {
+            Color c = row[x];
+            if (c.a) {
+                int16_t reg = getRegister(c, isQuantized);
+                canvasRegisters.at(x + y * canvasWidth) = reg;
+                isRegisterUsed.at(reg) = true;
+            }
+        }
+    }
+
+    if (hasTransparent && !isAfterClear) {
+        int eraseLen = static_cast<int>(cols.second - cols.first);
+        term.writeSGR(state, TermColor::byDefault(), TermColor::byDefault(), out);
+        for (size_t row = rows.first; row < rows.second; row++) {
+            term.writeMove(state, static_cast<int>(cols.first), static_cast<int>(row), out);
+            if (term.getCaps().hasECH) {
+                term.writeErase(state, eraseLen, out);
+            }
+            else {
+                *out += std::string(eraseLen, ' ');
+                state.cursorX = -1;
+            }
+        }
+    }
+    if (keys.empty()) {
+        return;
+    }
+
+    IndexedImage img;
+    img.width = (cols.second - cols.first) * pixelSize.first;
+    img.height = (rows.second - rows.first) * pixelSize.second;
+    img.registers.resize(img.width * img.height);
+    for (size_t y = 0; y < img.height; y++) {
+        size_t srcY = y / pixelSize.second * cellSize.second
+            + y % pixelSize.second * cellSize.second / pixelSize.second;
+        for (size_t x = 0; x < img.width; x++) {
+            size_t srcX = x / pixelSize.first * cellSize.first
+                + x % pixelSize.first * cellSize.first / pixelSize.first;
+            img.registers.at(x + y * img.width) = canvasRegisters.at(srcX + srcY * canvasWidth);
+        }
+    }
+
+    term.writeMove(state, static_cast<int>(cols.first), static_cast<int>(rows.first), out);
+    *out += SIXEL_START "\"1;1;" + std::to_string(img.width) + ";" + std::to_string(img.height);
+    // NOTE: Registers are sent with every image, terminals differ in whether
+    // they keep them from one image to the next
+    for (size_t reg = 0; reg < m_registerColors.size(); reg++) {
+        if (!isRegisterUsed.at(reg)) {
+            continue;
+        }
+        Color c = m_registerColors.at(reg);
+        *out += "#" + std::to_string(reg)
+            + ";2;" + std::to_string((c.r * 100 + 127) / 255)
+            + ";" + std::to_string((c.g * 100 + 127) / 255)
+            + ";" + std::to_string((c.b * 100 + 127) / 255);
+    }
+    for (size_t bandY = 0; bandY < img.height; bandY += SIXEL_BAND_HEIGHT) {
+        if (bandY > 0) {
+            *out += "-";
+        }
+        writeBand(img, bandY, out);
+    }
+    *out += SIXEL_END;
+
+    // Where the cursor ends up after an image depends on the terminal
+    state.cursorX = -1;
+    state.cursorY = -1;
+}
+
+int16_t SixelEncoder::getRegister(Color c, bool isQuantized) {
+    if (isQuantized) {
+        c = ColorQuantizer::getPaletteColor(ColorQuantizer::to256(c));
+    }
+    uint32_t key = (c.r << 16) | (c.g << 8) | c.b;
+    auto it = m_registers.find(key);
+    if (it != m_registers.end()) {
+        return it->second;
+    }
+    int16_t reg = static_cast<int16_t>(m_registerColors.size());
+    m_registers.emplace(key, reg);
+    m_registerColors.push_back(c);
+    return reg;
+}
+
+// Colors are painted one after another over the band, each from the left up
+// to its last pixel. They go in order of first appearance so the gaps before
+// them stay short.
+void SixelEncoder::writeBand(const IndexedImage& img, size_t bandY, std::string* out) const {
+    size_t bandHeight = std::min<size_t>(SIXEL_BAND_HEIGHT, img.height - bandY);
+    std::vector<int> slotOfRegister(SIXEL_MAX_REGISTERS, -1);
+    std::vector<int16_t> slotRegisters;
+    std::vector<std::vector<uint8_t>> slotSixels;
+    std::vector<size_t> slotEnds;
+    for (size_t x = 0; x < img.width; x++) {
+        for (size_t k = 0; k < bandHeight; k++) {
+            int16_t reg = img.registers.at(x + (bandY + k) * img.width);
+            if (reg < 0) {
+                continue;
+            }
+            int slot = slotOfRegister.at(reg);
+            if (slot < 0) {
+                slot = static_cast<int>(slotRegisters.size());
+                slotOfRegister.at(reg) = slot;
+                slotRegisters.push_back(reg);
+                slotSixels.emplace_back(img.width, 0);
+                slotEnds.push_back(0);
+            }
+            slotSixels.at(slot).at(x) |= static_cast<uint8_t>(1 << k);
+            slotEnds.at(slot) = x + 1;
+        }
+    }
+
+    for (size_t slot = 0; slot < slotRegisters.size(); slot++) {
+        if (slot > 0) {
+            *out += "$";
+        }
+        *out += "#" + std::to_string(slotRegisters.at(slot));
+        const std::vector<uint8_t>& sixels = slotSixels.at(slot);
+        for (size_t x = 0; x < slotEnds.at(slot);) {
+            size_t runEnd = x + 1;
+            while (runEnd < slotEnds.at(slot) && sixels.at(runEnd) == sixels.at(x)) {
+                runEnd++;
+            }
+            appendSixels(static_cast<char>('?' + sixels.at(x)), runEnd - x, out);
+            x = runEnd;
+        }
+    }
+}
+
+void SixelEncoder::appendSixels(char sixel, size_t count, std::string* out) {
+    if (count >= SIXEL_MIN_REPEAT) {
+        *out += "!" + std::to_string(count);
+        *out += sixel;
+    }
+    else {
+        out->append(count, sixel);
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include "image.hpp"
+#include "terminal.hpp"
+
+#define SIXEL_MAX_REGISTERS        256
+#define SIXEL_DEFAULT_CELL_WIDTH   10
+#define SIXEL_DEFAULT_CELL_HEIGHT  20
+#define SIXEL_BAND_HEIGHT          6
+#define SIXEL_MIN_REPEAT           4
+
+// Sends the canvas as sixel images. Each run of consecutive cell rows that
+// have dirty cells becomes one image spanning their dirty columns, the rest
+// of the screen is left alone. Colors keep the register they got when first
+// seen, so the palette of a flag stays the same from frame to frame.
+class SixelEncoder {
+public:
+    SixelEncoder();
+
+    void reset();
+    void encodeFrame(
+        const Image& canvas,
+        std::pair<size_t, size_t> cellSize,
+        const std::vector<bool>& dirtyCells,
+        std::pair<int, int> cellPixelSize,
+        const TerminalController& term,
+        TermState& state,
+        std::string* out
+    );
+private:
+    // Canvas pixels as registers, -1 for transparent
+    struct IndexedImage {
+        std::vector<int16_t> registers;
+        size_t width;
+        size_t height;
+    };
+
+    std::unordered_map<uint32_t, int16_t> m_registers;
+    std::vector<Color> m_registerColors;
+    bool m_isCleared;
+
+    void writeImage(
+        const Image& canvas,
+        std::pair<size_t, size_t> cellSize,
+        std::pair<size_t, size_t> pixelSize,
+        std::pair<size_t, size_t> cols,
+        std::pair<size_t, size_t> rows,
+        bool isAfterClear,
+        const TerminalController& term,
+        TermState& state,
+        std::string* out
+    );
+    int16_t getRegister(Color c, bool isQuantized);
+    void writeBand(const IndexedImage& img, size_t bandY, std::string* out) const;
+    static void appendSixels(char sixel, size_t count, std::string* out);
+};
@@ -0,0 +1,390 @@
+#include "termcaps.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <termios.h>
+    #include <poll.h>
+    #include <errno.h>
+    #include <chrono>
+#endif
+
+// The DECRQSS query sets this foreground and checks whether the terminal
+// reports it back unchanged
+#define TERMCAPS_PROBE_RGB "17;34;51"
+
+TermCaps::TermCaps()
+    : hasTruecolor(false), isTruecolorProbed(false), hasREP(false), hasECH(false)
+    , hasSyncUpdate(false), hasFocusReport(false), hasKittyGraphics(false), hasSixel(false) {}
+
+TermCaps TermCapsProbe::detect(bool canQuery) {
+#ifdef _WIN32
+    (void)canQuery;
+    return fromEnvironment();
+#else
+    TermCaps caps = fromEnvironment();
+    if (!canQuery) {
+        return caps;
+    }
+    std::string cachePath = getCachePath();
+    if (!cachePath.empty() && loadCached(cachePath, &caps)) {
+        return caps;
+    }
+
+    std::string replies;
+    if (!query(&replies)) {
+        // A slow link may still answer, don't let a pessimistic guess stick
+        return caps;
+    }
+    parseReplies(replies, &caps);
+    if (!cachePath.empty()) {
+        saveCached(cachePath, caps);
+    }
+    return caps;
+#endif
+}
+
+// NOTE: ECH is as old as the VT220 and every emulator that claims to be an
+// xterm has it. REP is newer and only trusted where we know it works.
+TermCaps TermCapsProbe::fromEnvironment() {
+    TermCaps caps;
+#ifdef _WIN32
+    caps.hasTruecolor = true;
+    caps.hasECH = true;
+    caps.hasREP = true;
+#else
+    const char* termEnv = getenv("TERM");
+    std::string term = termEnv == nullptr ? "" : termEnv;
+    const char* colorTerm = getenv("COLORTERM");
+    caps.hasTruecolor = colorTerm != nullptr
+        && (std::string(colorTerm) == "truecolor" || std::string(colorTerm) == "24bit");
+    caps.hasECH = !term.empty() && term != "dumb";
+
+    const char* vteVersion = getenv("VTE_VERSION");
+    caps.hasREP = getenv("XTERM_VERSION") != nullptr
+        || term == "xterm-kitty"
+        || term.rfind("foot", 0) == 0
+        || (vteVersion != nullptr && atoi(vteVersion) >= 6800);
+    caps.hasKittyGraphics = term == "xterm-kitty";
+#endif
+    return caps;
+}
+
+#ifndef _WIN32
+// Everything in the environment that tells terminals apart. Only terminal
+// emulators set these, TERM and COLORTERM alone also come along over ssh and
+// are the same for many terminals, so without one of these the key is empty
+// and nothing is cached. IDs are only checked for, they differ per window.
+std::string TermCapsProbe::getIdentityKey() {
+    const char* versionVars[] = {
+        "TERM_PROGRAM", "TERM_PROGRAM_VERSION", "VTE_VERSION", "XTERM_VERSION", "KONSOLE_VERSION"
+    };
+    const char* idVars[] = { "KITTY_WINDOW_ID", "WEZTERM_PANE", "ALACRITTY_WINDOW_ID", "WT_SESSION" };
+    std::string key;
+    bool isTerminalNamed = false;
+    for (const char* var : versionVars) {
+        const char* value = getenv(var);
+        isTerminalNamed = isTerminalNamed || value != nullptr;
+        key += var;
+        key += '=';
+        key += value == nullptr ? "" : value;
+        key += '\n';
+    }
+    for (const char* var : idVars) {
+        if (getenv(var) != nullptr) {
+            isTerminalNamed = true;
+            key += var;
+            key += '\n';
+        }
+    }
+    if (!isTerminalNamed) {
+        return "";
+    }
+    const char* sharedVars[] = { "TERM", "COLORTERM" };
+    for (const char* var : sharedVars) {
+        const char* value = getenv(var);
+        key += var;
+        key += '=';
+        key += value == nullptr ? "" : value;
+        key += '\n';
+    }
+    return key;
+}
+
+// Empty when the terminal can't be told apart, it is probed every time then
+std::string TermCapsProbe::getCachePath() {
+    std::string identityKey = getIdentityKey();
+    if (identityKey.empty()) {
+        return "";
+    }
+    std::string dir;
+    const char* xdgCache = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if (xdgCache != nullptr && xdgCache[0] == '/') {
+        dir = std::string(xdgCache) + "/wavet";
+    }
+    else if (home != nullptr && home[0] != '\0') {
+        dir = std::string(home) + "/.cache/wavet";
+    }
+    else {
+        return "";
+    }
+
+    // NOTE: 64-bit FNV-1a, same as the shared asset cache
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : identityKey) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    char name[40];
+    snprintf(name, sizeof(name), "/termcaps-%016llx", static_cast<unsigned long long>(hash));
+    return dir + name;
+}
+
+bool TermCapsProbe::loadCached(const std::string& path, TermCaps* outCaps) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    TermCaps caps;
+    bool isVersionValid = false;
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t sep = line.find('=');
+        if (sep == std::string::npos) {
+            continue;
+        }
+        std::string key = line.substr(0, sep);
+        std::string value = line.substr(sep + 1);
+        bool isSet = value == "1";
+        if (key == "version") isVersionValid = value == std::to_string(TERMCAPS_CACHE_VERSION);
+        else if (key == "truecolor") caps.hasTruecolor = isSet;
+        else if (key == "truecolor_probed") caps.isTruecolorProbed = isSet;
+        else if (key == "rep") caps.hasREP = isSet;
+        else if (key == "ech") caps.hasECH = isSet;
+        else if (key == "sync") caps.hasSyncUpdate = isSet;
+        else if (key == "focus") caps.hasFocusReport = isSet;
+        else if (key == "kitty") caps.hasKittyGraphics = isSet;
+        else if (key == "sixel") caps.hasSixel = isSet;
+        else if (key == "identity") caps.identity = value;
+    }
+    if (!isVersionValid) {
+        return false;
+    }
+    *outCaps = caps;
+    return true;
+}
+
+// NOTE: Written to a temporary file first so that another wavet starting at
+// the same time never reads half of it
+void TermCapsProbe::saveCached(const std::string& path, const TermCaps& caps) {
+    std::error_code ec;
+    std::filesystem::path filePath(path);
+    std::filesystem::create_directories(filePath.parent_path(), ec);
+    if (ec) {
+        return;
+    }
+
+    std::string tmpPath = path + ".tmp" + std::to_string(static_cast<long long>(getpid()));
+    {
+        std::ofstream file(tmpPath, std::ios::trunc);
+        if (!file) {
+            return;
+        }
+        file << "version=" << TERMCAPS_CACHE_VERSION << "\n"
+            << "identity=" << caps.identity << "\n"
+            << "truecolor=" << caps.hasTruecolor << "\n"
+            << "truecolor_probed=" << caps.isTruecolorProbed << "\n"
+            << "rep=" << caps.hasREP << "\n"
+            << "ech=" << caps.hasECH << "\n"
+            << "sync=" << caps.hasSyncUpdate << "\n"
+            << "focus=" << caps.hasFocusReport << "\n"
+            << "kitty=" << caps.hasKittyGraphics << "\n"
+            << "sixel=" << caps.hasSixel << "\n";
+        if (!file) {
+            file.close();
+            std::filesystem::remove(tmpPath, ec);
+            return;
+        }
+    }
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmpPath, ec);
+    }
+}
+
+// True once the buffer holds a DA1 reply, CSI ? Ps ; ... c
+static bool hasDA1Reply(const std::string& replies) {
+    size_t pos = 0;
+    while ((pos = replies.find("\x1b[?", pos)) != std::string::npos) {
+        size_t end = pos + 3;
+        while (end < replies.size() && (isdigit(static_cast<unsigned char>(replies[end])) || replies[end] == ';')) {
+            end++;
+        }
+        if (end < replies.size() && replies[end] == 'c') {
+            return true;
+        }
+        pos = end;
+    }
+    return false;
+}
+
+// Expects stdin in non-canonical mode. Returns false if the terminal didn't
+// answer DA1 in time.
+bool TermCapsProbe::query(std::string* outReplies) {
+    std::string queries =
+        "\x1b[>0q"                                          // XTVERSION
+        "\x1b[>c"                                           // DA2
+        "\x1b[?2026$p"                                      // DECRQM synchronized update
+        "\x1b[?1004$p"                                      // DECRQM focus reporting
+        "\x1b[38;2;" TERMCAPS_PROBE_RGB "m\x1bP$qm\x1b\\"   // DECRQSS SGR
+        "\x1b[0m"
+        "\x1b_Gi=31,s=1,v=1,a=q,t=d,f=24;AAAA\x1b\\"        // Kitty graphics
+        "\x1b[c";                                           // DA1
+    size_t offset = 0;
+    while (offset < queries.size()) {
+        ssize_t written = write(STDOUT_FILENO, queries.data() + offset, queries.size() - offset);
+        if (written < 0 && errno != EINTR && errno != EAGAIN) {
+            return false;
+        }
+        offset += written > 0 ? static_cast<size_t>(written) : 0;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(TERMCAPS_PROBE_TIMEOUT_MS);
+    std::string replies;
+    while (!hasDA1Reply(replies)) {
+        int remainingMs = static_cast<int>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count()
+        );
+        if (remainingMs <= 0) {
+            // Whatever arrives later must not be taken for keypresses
+            tcflush(STDIN_FILENO, TCIFLUSH);
+            return false;
+        }
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        int ready = poll(&pfd, 1, remainingMs);
+        if (ready < 0 && errno != EINTR) {
+            return false;
+        }
+        if (ready > 0) {
+            char buffer[256];
+            ssize_t readCount = read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (readCount <= 0 && errno != EINTR && errno != EAGAIN) {
+                return false;
+            }
+            if (readCount > 0) {
+                replies.append(buffer, static_cast<size_t>(readCount));
+            }
+        }
+    }
+    *outReplies = replies;
+    return true;
+}
+
+// Splits a parameter string like "64;1;4" into numbers
+static std::vector<int> parseParams(const std::string& params) {
+    std::vector<int> values;
+    size_t start = 0;
+    while (start <= params.size()) {
+        size_t end = params.find(';', start);
+        if (end == std::string::npos) {
+            end = params.size();
+        }
+        values.push_back(atoi(params.substr(start, end - start).c_str()));
+        start = end + 1;
+    }
+    return values;
+}
+
+// NOTE: Replies we didn't ask about or don't recognize are skipped, the user
+// may also have typed something while we waited
+void TermCapsProbe::parseReplies(const std::string& replies, TermCaps* caps) {
+    int da2Type = -1;
+    int da2Version = 0;
+    size_t pos = 0;
+    while ((pos = replies.find('\x1b', pos)) != std::string::npos) {
+        size_t start = pos;
+        std::string rest = replies.substr(start);
+        pos++;
+        if (rest.rfind("\x1bP", 0) == 0 || rest.rfind("\x1b_", 0) == 0) {
+            // DCS and APC strings end with ST
+            size_t end = rest.find("\x1b\\", 2);
+            if (end == std::string::npos) {
+                continue;
+            }
+            std::string body = rest.substr(2, end - 2);
+            if (body.rfind(">|", 0) == 0) {
+                caps->identity = body.substr(2);
+            }
+            else if (body.rfind("1$r", 0) == 0) {
+                std::string colonRGB = TERMCAPS_PROBE_RGB;
+                std::replace(colonRGB.begin(), colonRGB.end(), ';', ':');
+                caps->isTruecolorProbed = true;
+                caps->hasTruecolor = caps->hasTruecolor
+                    || body.find(TERMCAPS_PROBE_RGB) != std::string::npos
+                    || body.find(colonRGB) != std::string::npos;
+            }
+            else if (body.rfind("Gi=31;", 0) == 0) {
+                caps->hasKittyGraphics = body.find(";OK") != std::string::npos;
+            }
+            pos = start + end + 2;
+            continue;
+        }
+        if (rest.rfind("\x1b[", 0) != 0) {
+            continue;
+        }
+        size_t end = 2;
+        while (end < rest.size() && (rest[end] < 0x40 || rest[end] > 0x7e)) {
+            end++;
+        }
+        if (end == rest.size()) {
+            break;
+        }
+        char final = rest[end];
+        std::string params = rest.substr(2, end - 2);
+        if (final == 'c' && params.rfind("?", 0) == 0) {
+            std::vector<int> values = parseParams(params.substr(1));
+            caps->hasECH = caps->hasECH || values.front() >= 62;
+            for (size_t i = 1; i < values.size(); i++) {
+                caps->hasSixel = caps->hasSixel || values.at(i) == 4;
+            }
+        }
+        else if (final == 'c' && params.rfind(">", 0) == 0) {
+            std::vector<int> values = parseParams(params.substr(1));
+            da2Type = values.front();
+            da2Version = values.size() > 1 ? values.at(1) : 0;
+        }
+        else if (final == 'y' && params.rfind("?", 0) == 0 && params.back() == '$') {
+            std::vector<int> values = parseParams(params.substr(1, params.size() - 2));
+            if (values.size() == 2) {
+                // 1 set, 2 reset, 3 permanently set all mean it's there
+                bool isSupported = values.at(1) >= 1 && values.at(1) <= 3;
+                if (values.at(0) == 2026) {
+                    caps->hasSyncUpdate = isSupported;
+                }
+                else if (values.at(0) == 1004) {
+                    caps->hasFocusReport = isSupported;
+                }
+            }
+        }
+        pos = start + end + 1;
+    }
+
+    // NOTE: Names as reported by XTVERSION, DA2 type 41 is xterm and 65 is VTE
+    const char* repTerminals[] = { "XTerm(", "kitty(", "foot(", "WezTerm", "contour" };
+    for (const char* name : repTerminals) {
+        caps->hasREP = caps->hasREP || caps->identity.rfind(name, 0) == 0;
+    }
+    caps->hasREP = caps->hasREP || da2Type == 41 || (da2Type == 65 && da2Version >= 6800);
+}
+#endif
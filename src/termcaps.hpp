@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+#define TERMCAPS_CACHE_VERSION   1
+#define TERMCAPS_PROBE_TIMEOUT_MS 150
+
+// Optional features of the terminal that change how we encode output
+struct TermCaps {
+    bool hasTruecolor;
+    bool isTruecolorProbed;
+    bool hasREP;
+    bool hasECH;
+    bool hasSyncUpdate;
+    bool hasFocusReport;
+    bool hasKittyGraphics;
+    bool hasSixel;
+    std::string identity;
+
+    TermCaps();
+};
+
+// Finds out what the terminal supports. Guesses from the environment are
+// refined by asking the terminal itself with DA1/DA2/XTVERSION, DECRQM and
+// DECRQSS queries. DA1 goes last since every terminal answers it, so its
+// reply marks the end of the replies. Results are cached on disk per terminal
+// identity, later launches in the same terminal skip the round-trip. Only
+// terminals the environment names are cached, others are asked every time.
+class TermCapsProbe {
+public:
+    static TermCaps detect(bool canQuery);
+private:
+    static TermCaps fromEnvironment();
+#ifndef _WIN32
+    static std::string getIdentityKey();
+    static std::string getCachePath();
+    static bool loadCached(const std::string& path, TermCaps* outCaps);
+    static void saveCached(const std::string& path, const TermCaps& caps);
+    static bool query(std::string* outReplies);
+    static void parseReplies(const std::string& replies, TermCaps* caps);
+#endif
+};
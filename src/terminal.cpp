@@ -3,36 +3,96 @@
 #include <sstream>
 #include <vector>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #ifdef _WIN32
     #include <windows.h>
 #else
     #include <sys/ioctl.h>
     #include <unistd.h>
-    #include <signal.h>
+    #include <termios.h>
+    #include <poll.h>
+    #include <fcntl.h>
+    #include <errno.h>
 #endif
+
+// Weight of the newest sample in the running averages of frame size and
+// drain rate
+#define OUTPUT_EWMA_WEIGHT 0.2f
+// Drain rate samples older than this are stale, the link has caught up since
+#define DRAIN_RATE_EXPIRY_NS (1000 * 1000000ll)
+// Most bytes handed to one write when stdout isn't a terminal and stays
+// blocking. A pipe that polls writable has at least a page free.
+#define OUTPUT_WRITE_CHUNK 512
 #include "terminal.hpp"
 
+TermColor::TermColor()
+    : kind(ANY), rgb(), idx(0) {}
+
+TermColor TermColor::byDefault() {
+    TermColor c;
+    c.kind = DEFAULT;
+    return c;
+}
+
+bool TermColor::operator==(const TermColor& other) const {
+    if (kind != other.kind || kind == ANY) {
+        return false;
+    }
+    if (kind == RGB) {
+        return rgb.r == other.rgb.r && rgb.g == other.rgb.g && rgb.b == other.rgb.b;
+    }
+    return kind != INDEXED || idx == other.idx;
+}
+
+TermState::TermState()
+    : fg(), bg(), cursorX(-1), cursorY(-1), reverseVideo(-1) {}
+
+// Set by requestHeadless() before the controller is first used
+static bool isHeadlessRequested = false;
+
+#ifndef _WIN32
+static int64_t getNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+#endif
+
 TerminalController& TerminalController::getInstance() {
     static TerminalController tc;
     return tc;
 }
 
+// Makes the controller leave the real terminal alone, frames are kept in
+// memory for takeCaptured() instead. Has to be called before getInstance().
+void TerminalController::requestHeadless() {
+    isHeadlessRequested = true;
+}
+
+// NOTE: On Linux SIGINT is handled by EventLoop through a signalfd
 TerminalController::TerminalController()
-    : m_isCtrlCPressed(false) {
+    : m_isCtrlCPressed(false), m_size(80, 24), m_cellPixelSize(0, 0), m_avgFrameBytes(0)
+    , m_colorMode(ColorMode::TRUECOLOR), m_isColorModeAuto(false)
+    , m_isHeadless(isHeadlessRequested), m_isKeepingFrames(false) {
+    if (m_isHeadless) {
+        return;
+    }
     setupTerminal();
+    refreshSize();
 #ifdef _WIN32
     SetConsoleCtrlHandler(handleCtrlC_Windows, TRUE);
-#else
-    struct sigaction sigIntHandler;
-    sigIntHandler.sa_handler = handleCtrlC_Linux;
-    sigemptyset(&sigIntHandler.sa_mask);
-    sigIntHandler.sa_flags = 0;
-    sigaction(SIGINT, &sigIntHandler, NULL);
 #endif
 }
 
 // TODO: Do i need to reset ctrl handler?
 TerminalController::~TerminalController() {
+    if (m_isHeadless) {
+        return;
+    }
     cleanupTerminal();
 #ifdef _WIN32
     SetConsoleCtrlHandler(NULL, FALSE);
@@ -51,15 +111,64 @@ void TerminalController::setupTerminal() {
     if (SetConsoleMode(hOut, targetMode)) {
         // TODO: Handle the error
     }
+#else
+    // Keypresses are read by EventLoop, so don't wait for enter or echo them
+    m_hasOrigInAttrs = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &m_origInAttrs) == 0;
+    if (m_hasOrigInAttrs) {
+        struct termios inAttrs = m_origInAttrs;
+        inAttrs.c_lflag &= ~(ICANON | ECHO);
+        inAttrs.c_cc[VMIN] = 1;
+        inAttrs.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &inAttrs);
+    }
 #endif
     std::cout << ANSI_ENTER_ALT_BUFFER << ANSI_HIDE_CURSOR << std::flush;
+#ifdef _WIN32
+    m_caps = TermCapsProbe::detect(false);
+#else
+    // Replies come through stdin, so only ask when both ends are the terminal
+    m_caps = TermCapsProbe::detect(m_hasOrigInAttrs && isatty(STDOUT_FILENO));
+#endif
+#ifndef _WIN32
+    // Frames are only written while the terminal takes them, so a slow
+    // terminal or link makes us drop frames instead of stalling the loop, see
+    // drainOutput(). They go through a non-blocking descriptor of our own,
+    // stdout's file description is shared with the shell and stays blocking.
+    m_outFd = -1;
+    if (isatty(STDOUT_FILENO)) {
+        const char* ttyName = ttyname(STDOUT_FILENO);
+        m_outFd = ttyName != nullptr ? open(ttyName, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC) : -1;
+    }
+    m_pendingOffset = 0;
+    m_wasSaturated = false;
+    m_lastDrainNs = 0;
+    m_drainRate = 0;
+#endif
 }
 
 void TerminalController::cleanupTerminal() {
+#ifndef _WIN32
+    while (m_pendingOffset < m_pending.size()) {
+        ssize_t written = write(
+            STDOUT_FILENO, m_pending.data() + m_pendingOffset, m_pending.size() - m_pendingOffset
+        );
+        if (written <= 0 && errno != EINTR) {
+            break;
+        }
+        m_pendingOffset += std::max<ssize_t>(written, 0);
+    }
+    if (m_outFd >= 0) {
+        close(m_outFd);
+    }
+#endif
     std::cout << ANSI_EXIT_ALT_BUFFER << ANSI_SHOW_CURSOR << std::flush;
 #ifdef _WIN32
     HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
     SetConsoleMode(hOut, m_origOutMode);
+#else
+    if (m_hasOrigInAttrs) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &m_origInAttrs);
+    }
 #endif
 }
 
@@ -71,16 +180,6 @@ int TerminalController::handleCtrlC_Windows(DWORD ctrlType) {
     }
     return false;
 }
-#else
-void TerminalController::handleCtrlC_Linux(int signal) {
-    // TODO: As far as i understood, we only set this callback for SIGINT, but
-    // it still gives the signal as an argument so maybe that is not true. Check
-    // this and remove the assert and check if signal is SIGINT if that is not
-    // the case
-    (void)signal;
-    assert(signal == SIGINT);
-    TerminalController::getInstance().m_isCtrlCPressed = true;
-}
 #endif
 
 std::ostringstream& TerminalController::getStream() {
@@ -88,92 +187,501 @@ std::ostringstream& TerminalController::getStream() {
 }
 
 void TerminalController::flush() {
-    std::cout << m_outStream.str();
+    std::string frame = m_outStream.str();
     m_outStream.str("");
     m_outStream.clear();
+    if (m_isKeepingFrames) {
+        m_keptFrame += frame;
+    }
+    writeFrame(frame);
+}
+
+// Sends bytes that were encoded earlier as they are, the stream is left alone
+void TerminalController::writeFrame(const std::string& frame) {
+    writeFrame(frame.data(), frame.size());
+}
+
+void TerminalController::writeFrame(const char* data, size_t size) {
+    m_avgFrameBytes += (size - m_avgFrameBytes) * OUTPUT_EWMA_WEIGHT;
+    if (m_isHeadless) {
+        m_captured.append(data, size);
+        return;
+    }
+#ifdef _WIN32
+    std::cout.write(data, size);
+#else
+    // NOTE: With nothing pending the frame is written from the caller's
+    // buffer, only what the terminal didn't take yet is copied
+    if (m_pendingOffset == m_pending.size()) {
+        int64_t nowNs = getNowNs();
+        size_t written = writeWhileWritable(data, size);
+        m_pending.assign(data + written, size - written);
+        m_pendingOffset = 0;
+        recordDrain(written, nowNs);
+    }
+    else {
+        m_pending.append(data, size);
+        drainOutput();
+    }
+#endif
+}
+
+// While keeping, everything flushed is also collected until taken
+void TerminalController::setKeepingFrames(bool isKeeping) {
+    m_isKeepingFrames = isKeeping;
+    m_keptFrame.clear();
+}
+
+std::string TerminalController::takeKeptFrame() {
+    std::string frame;
+    frame.swap(m_keptFrame);
+    return frame;
+}
+
+// Like flush() but for a whole frame. Terminals with synchronized update get
+// it wrapped in begin/end markers, they then repaint once the end arrives
+// instead of showing it half drawn. The frame is handed to a single write, a
+// partial write only delays the end marker.
+void TerminalController::flushFrame() {
+    if (m_caps.hasSyncUpdate && m_outStream.tellp() > 0) {
+        std::string frame = m_outStream.str();
+        m_outStream.str("");
+        m_outStream.clear();
+        m_outStream << ANSI_BEGIN_SYNC_UPDATE << frame << ANSI_END_SYNC_UPDATE;
+    }
+    flush();
+}
+
+// True while the previous frame is still waiting to be written. Callers should
+// drop the frame instead of drawing it, the next frame's diff then covers
+// both.
+bool TerminalController::isOutputBusy() {
+#ifdef _WIN32
+    return false;
+#else
+    if (m_isHeadless) {
+        return false;
+    }
+    drainOutput();
+    return m_pendingOffset < m_pending.size();
+#endif
+}
+
+// How many frames to advance per drawn frame so that the output fits in the
+// drain rate measured while the link was saturated. In auto color mode a
+// saturated link first makes us fall back to the shorter 256 color codes.
+int TerminalController::getFrameStride(int fps) {
+#ifdef _WIN32
+    (void)fps;
+    return 1;
+#else
+    if (m_drainRate <= 0) {
+        return 1;
+    }
+    int stride = static_cast<int>(ceil(m_avgFrameBytes * fps / m_drainRate));
+    if (stride > 1 && m_isColorModeAuto && m_colorMode == ColorMode::TRUECOLOR) {
+        m_colorMode = ColorMode::COLOR_256;
+    }
+    return std::clamp(stride, 1, fps);
+#endif
+}
+
+void TerminalController::drainOutput() {
+#ifndef _WIN32
+    int64_t nowNs = getNowNs();
+    if (m_pendingOffset == m_pending.size()) {
+        if (nowNs - m_lastDrainNs > DRAIN_RATE_EXPIRY_NS) {
+            m_drainRate = 0;
+        }
+        m_wasSaturated = false;
+        return;
+    }
+
+    size_t written = writeWhileWritable(
+        m_pending.data() + m_pendingOffset, m_pending.size() - m_pendingOffset
+    );
+    m_pendingOffset += written;
+    recordDrain(written, nowNs);
+#endif
+}
+
+#ifndef _WIN32
+// Updates the drain rate with what a drain that started at nowNs wrote, and
+// drops what is pending once it is all written
+void TerminalController::recordDrain(size_t written, int64_t nowNs) {
+    // NOTE: Only intervals where the output was backed up the whole time tell
+    // us how fast the other side actually reads
+    if (m_wasSaturated && nowNs > m_lastDrainNs) {
+        float rate = written * 1e9f / (nowNs - m_lastDrainNs);
+        m_drainRate = m_drainRate <= 0
+            ? rate
+            : m_drainRate + (rate - m_drainRate) * OUTPUT_EWMA_WEIGHT;
+    }
+    m_wasSaturated = m_pendingOffset < m_pending.size();
+    m_lastDrainNs = nowNs;
+    if (!m_wasSaturated) {
+        m_pending.clear();
+        m_pendingOffset = 0;
+    }
+}
+
+// Writes as much as the terminal takes without blocking, returns how much
+// that was. Without a descriptor of our own stdout is polled before each
+// bounded write.
+size_t TerminalController::writeWhileWritable(const char* data, size_t size) {
+    size_t offset = 0;
+    struct pollfd pfd;
+    pfd.fd = m_outFd >= 0 ? m_outFd : STDOUT_FILENO;
+    pfd.events = POLLOUT;
+    while (offset < size && poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLOUT) != 0) {
+        size_t count = m_outFd >= 0 ? size - offset : std::min<size_t>(size - offset, OUTPUT_WRITE_CHUNK);
+        ssize_t written = write(pfd.fd, data + offset, count);
+        if (written <= 0) {
+            break;
+        }
+        offset += written;
+    }
+    return offset;
 }
+#endif
 
 bool TerminalController::shouldExit() {
     return m_isCtrlCPressed;
 }
 
+// NOTE: The size is cached, call refreshSize() when the terminal is resized
 std::pair<int, int> TerminalController::getSize() {
+    return m_size;
+}
+
+void TerminalController::refreshSize() {
+    if (m_isHeadless) {
+        return;
+    }
 #ifdef _WIN32
     HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
     CONSOLE_SCREEN_BUFFER_INFO bufferInfo;
     if (GetConsoleScreenBufferInfo(hOut, &bufferInfo)) {
         // TODO: Handle the error
     }
-    return std::pair<int, int>(bufferInfo.dwSize.X, bufferInfo.dwSize.Y);
+    m_size = std::pair<int, int>(bufferInfo.dwSize.X, bufferInfo.dwSize.Y);
 #else
     struct winsize ws;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws);
-    return std::pair<int, int>(ws.ws_col, ws.ws_row);
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0) {
+        m_size = std::pair<int, int>(ws.ws_col, ws.ws_row);
+        m_cellPixelSize = ws.ws_col > 0 && ws.ws_row > 0
+            ? std::pair<int, int>(ws.ws_xpixel / ws.ws_col, ws.ws_ypixel / ws.ws_row)
+            : std::pair<int, int>(0, 0);
+    }
 #endif
 }
 
+// NOTE: Not every terminal fills in the pixel size of the window, it's 0 by
+// 0 when unknown
+std::pair<int, int> TerminalController::getCellPixelSize() {
+    return m_cellPixelSize;
+}
+
 void TerminalController::setCursor(int x, int y) {
-    m_outStream << CSI << y << ";" << x << "H";
+    std::string out;
+    writeMove(m_state, x - 1, y - 1, &out);
+    m_outStream << out;
 }
 
 void TerminalController::setCursorHome() {
     m_outStream << CSI "H";
+    m_state.cursorX = 0;
+    m_state.cursorY = 0;
 }
 
 void TerminalController::clearScreen() {
     m_outStream << CSI "2J" CSI "H";
+    m_state.cursorX = 0;
+    m_state.cursorY = 0;
+}
+
+// NOTE: Text must be printable, single width and fit in the line
+void TerminalController::writeText(const std::string& text) {
+    m_outStream << text;
+    if (m_state.cursorX >= 0) {
+        m_state.cursorX += static_cast<int>(text.size());
+    }
+    if (m_state.cursorX < 0 || m_state.cursorX >= m_size.first) {
+        m_state.cursorX = -1;
+    }
+}
+
+TermState& TerminalController::getState() {
+    return m_state;
+}
+
+// Forget what the terminal is showing, everything is set again when next used
+void TerminalController::invalidateState() {
+    m_state = TermState();
+}
+
+void TerminalController::setColorMode(ColorMode mode) {
+    m_isColorModeAuto = mode == ColorMode::AUTO;
+    m_colorMode = m_isColorModeAuto ? detectColorMode() : mode;
+}
+
+ColorMode TerminalController::getColorMode() const {
+    return m_colorMode;
+}
+
+// NOTE: Anything that doesn't say otherwise gets truecolor, which is what
+// wavet always used
+ColorMode TerminalController::detectColorMode() const {
+    if (m_caps.hasTruecolor) {
+        return ColorMode::TRUECOLOR;
+    }
+    if (m_caps.isTruecolorProbed) {
+        return ColorMode::COLOR_256;
+    }
+    const char* termEnv = getenv("TERM");
+    std::string term = termEnv == nullptr ? "" : termEnv;
+    if (term == "linux" || term == "ansi" || term.rfind("vt", 0) == 0
+        || term.find("16color") != std::string::npos) {
+        return ColorMode::COLOR_16;
+    }
+    return ColorMode::TRUECOLOR;
+}
+
+const TermCaps& TerminalController::getCaps() const {
+    return m_caps;
+}
+
+void TerminalController::setCaps(const TermCaps& caps) {
+    m_caps = caps;
+}
+
+// NOTE: Only for headless mode, a real terminal's size comes from refreshSize()
+void TerminalController::setHeadlessSize(std::pair<int, int> size) {
+    m_size = size;
+}
+
+// Returns what was flushed in headless mode since the last call
+std::string TerminalController::takeCaptured() {
+    std::string captured;
+    captured.swap(m_captured);
+    return captured;
 }
 
 void TerminalController::setFG(Color col) {
-    m_outStream << CSI "38;2;" << static_cast<int>(col.r) << ";"
-                               << static_cast<int>(col.g) << ";"
-                               << static_cast<int>(col.b) << "m";
+    std::string out;
+    writeSGR(m_state, toTermColor(col), TermColor(), &out);
+    m_outStream << out;
 }
 
 void TerminalController::setBG(Color col) {
-    m_outStream << CSI "48;2;" << static_cast<int>(col.r) << ";"
-                               << static_cast<int>(col.g) << ";"
-                               << static_cast<int>(col.b) << "m";
+    std::string out;
+    writeSGR(m_state, TermColor(), toTermColor(col), &out);
+    m_outStream << out;
 }
 
 void TerminalController::setFGAndBG(Color fg, Color bg) {
-    m_outStream << CSI "38;2;" << static_cast<int>(fg.r) << ";"
-                               << static_cast<int>(fg.g) << ";"
-                               << static_cast<int>(fg.b) << "m";
-    m_outStream << CSI "48;2;" << static_cast<int>(bg.r) << ";"
-                               << static_cast<int>(bg.g) << ";"
-                               << static_cast<int>(bg.b) << "m";
+    std::string out;
+    writeSGR(m_state, toTermColor(fg), toTermColor(bg), &out);
+    m_outStream << out;
 }
 
 void TerminalController::resetFG() {
-    m_outStream << CSI "39m";
+    std::string out;
+    writeSGR(m_state, TermColor::byDefault(), TermColor(), &out);
+    m_outStream << out;
 }
 
 void TerminalController::resetBG() {
-    m_outStream << CSI "49m";
+    std::string out;
+    writeSGR(m_state, TermColor(), TermColor::byDefault(), &out);
+    m_outStream << out;
 }
 
 void TerminalController::resetFGAndBG() {
-    m_outStream << CSI "39m" CSI "49m";
+    std::string out;
+    writeSGR(m_state, TermColor::byDefault(), TermColor::byDefault(), &out);
+    m_outStream << out;
 }
 
-void TerminalController::assignPreferredFGandBG(Color fg, Color bg) {
-    m_prefFG = fg;
-    m_prefBG = bg;
+TermColor TerminalController::toTermColor(Color c) const {
+    TermColor tc;
+    switch (m_colorMode) {
+    case ColorMode::COLOR_256:
+        tc.kind = TermColor::INDEXED;
+        tc.idx = ColorQuantizer::to256(c);
+        break;
+    case ColorMode::COLOR_16:
+        tc.kind = TermColor::INDEXED;
+        tc.idx = ColorQuantizer::to16(c);
+        break;
+    default:
+        tc.kind = TermColor::RGB;
+        tc.rgb = c;
+        break;
+    }
+    return tc;
 }
 
-void TerminalController::usePreferredFGandBG() {
-    if (m_prefFG == Color()) {
-        resetFG();
+TermColor TerminalController::getPreferredFG() const {
+    return m_prefFG == Color() ? TermColor::byDefault() : toTermColor(m_prefFG);
+}
+
+TermColor TerminalController::getPreferredBG() const {
+    return m_prefBG == Color() ? TermColor::byDefault() : toTermColor(m_prefBG);
+}
+
+// The write* functions append the escape codes needed to get from state to
+// what is asked to out, update state and return how many bytes that took.
+// Passing nullptr as out only does the bookkeeping, which lets callers price
+// alternatives on a copy of the state before committing to one.
+size_t TerminalController::writeSGR(
+    TermState& state,
+    TermColor fg,
+    TermColor bg,
+    std::string* out,
+    bool isReversed
+) const {
+    bool needsFG = fg.kind != TermColor::ANY && !(state.fg == fg);
+    bool needsBG = bg.kind != TermColor::ANY && !(state.bg == bg);
+    bool needsReverse = state.reverseVideo != (isReversed ? 1 : 0);
+    if (!needsFG && !needsBG && !needsReverse) {
+        return 0;
+    }
+
+    std::string params;
+    if (needsReverse) {
+        params += isReversed ? "7" : "27";
+        state.reverseVideo = isReversed ? 1 : 0;
+    }
+    if (needsFG) {
+        if (!params.empty()) {
+            params += ';';
+        }
+        appendColorParam(38, fg, &params);
+        state.fg = fg;
+    }
+    if (needsBG) {
+        if (!params.empty()) {
+            params += ';';
+        }
+        appendColorParam(48, bg, &params);
+        state.bg = bg;
+    }
+    if (out != nullptr) {
+        *out += CSI;
+        *out += params;
+        *out += 'm';
+    }
+    return params.size() + 3;
+}
+
+size_t TerminalController::writeMove(TermState& state, int x, int y, std::string* out) const {
+    if (state.cursorX == x && state.cursorY == y) {
+        return 0;
+    }
+
+    std::string seq;
+    if (state.cursorY == y && state.cursorX >= 0) {
+        int dist = x - state.cursorX;
+        seq = CSI;
+        if (dist > 1 || dist < -1) {
+            seq += std::to_string(dist > 0 ? dist : -dist);
+        }
+        seq += dist > 0 ? 'C' : 'D';
     }
     else {
-        setFG(m_prefFG);
+        seq = CSI;
+        seq += std::to_string(y + 1);
+        if (x > 0) {
+            seq += ';';
+            seq += std::to_string(x + 1);
+        }
+        seq += 'H';
+    }
+    state.cursorX = x;
+    state.cursorY = y;
+    if (out != nullptr) {
+        *out += seq;
+    }
+    return seq.size();
+}
+
+// NOTE: Glyphs are one cell wide. Writing to the last column leaves the cursor
+// in a state terminals disagree on, so it is treated as unknown afterwards.
+size_t TerminalController::writeGlyph(TermState& state, const char* glyph, std::string* out) const {
+    size_t len = strlen(glyph);
+    if (out != nullptr) {
+        out->append(glyph, len);
     }
+    if (state.cursorX >= 0) {
+        state.cursorX++;
+        if (state.cursorX >= m_size.first) {
+            state.cursorX = -1;
+            state.cursorY = -1;
+        }
+    }
+    return len;
+}
+
+// Repeats the last written glyph
+size_t TerminalController::writeRepeat(TermState& state, int count, std::string* out) const {
+    std::string seq = CSI + std::to_string(count) + "b";
+    if (state.cursorX >= 0) {
+        state.cursorX += count;
+        if (state.cursorX >= m_size.first) {
+            state.cursorX = -1;
+            state.cursorY = -1;
+        }
+    }
+    if (out != nullptr) {
+        *out += seq;
+    }
+    return seq.size();
+}
 
-    if (m_prefBG == Color()) {
-        resetBG();
+// Erases cells from the cursor on to the current background without moving
+// the cursor
+size_t TerminalController::writeErase(TermState& state, int count, std::string* out) const {
+    (void)state;
+    std::string seq = CSI + std::to_string(count) + "X";
+    if (out != nullptr) {
+        *out += seq;
+    }
+    return seq.size();
+}
+
+// Takes 38 for foreground or 48 for background
+void TerminalController::appendColorParam(int sgrBase, TermColor col, std::string* out) const {
+    if (col.kind == TermColor::DEFAULT) {
+        *out += std::to_string(sgrBase + 1);
+    }
+    else if (col.kind == TermColor::INDEXED && m_colorMode == ColorMode::COLOR_16) {
+        int base = sgrBase == 38 ? 30 : 40;
+        *out += std::to_string(base + (col.idx < 8 ? col.idx : col.idx - 8 + 60));
+    }
+    else if (col.kind == TermColor::INDEXED) {
+        *out += std::to_string(sgrBase);
+        *out += ";5;";
+        *out += std::to_string(col.idx);
     }
     else {
-        setBG(m_prefBG);
+        *out += std::to_string(sgrBase);
+        *out += ";2;";
+        *out += std::to_string(col.rgb.r);
+        *out += ';';
+        *out += std::to_string(col.rgb.g);
+        *out += ';';
+        *out += std::to_string(col.rgb.b);
     }
 }
+
+void TerminalController::assignPreferredFGandBG(Color fg, Color bg) {
+    m_prefFG = fg;
+    m_prefBG = bg;
+}
+
+void TerminalController::usePreferredFGandBG() {
+    std::string out;
+    writeSGR(m_state, getPreferredFG(), getPreferredBG(), &out);
+    m_outStream << out;
+}
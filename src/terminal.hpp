@@ -2,11 +2,16 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <cstdint>
 #ifdef _WIN32
     #include <windows.h>
+#else
+    #include <termios.h>
 #endif
     #include <utility>
     #include "image.hpp"
+    #include "palette.hpp"
+    #include "termcaps.hpp"
 #include "stb_image.h"
 
 #define ESC "\x1b"
@@ -17,21 +22,88 @@
 #define ANSI_EXIT_ALT_BUFFER  CSI "?1049l"
 #define ANSI_HIDE_CURSOR      CSI "?25l"
 #define ANSI_SHOW_CURSOR      CSI "?25h"
+#define ANSI_BEGIN_SYNC_UPDATE CSI "?2026h"
+#define ANSI_END_SYNC_UPDATE   CSI "?2026l"
+
+// A color as the terminal sees it. In a TermState, ANY means we don't know
+// what the terminal has, as a requirement it means anything will do.
+struct TermColor {
+    enum Kind : uint8_t {
+        ANY,
+        DEFAULT,
+        RGB,
+        INDEXED
+    };
+
+    Kind kind;
+    Color rgb;
+    uint8_t idx;
+
+    TermColor();
+    static TermColor byDefault();
+    bool operator==(const TermColor& other) const;
+};
+
+// What we last told the terminal, cursor position is 0-based and -1 when
+// unknown. Reverse video is 1 when on, 0 when off and -1 when unknown.
+struct TermState {
+    TermColor fg;
+    TermColor bg;
+    int cursorX;
+    int cursorY;
+    int reverseVideo;
+
+    TermState();
+};
 
 class TerminalController {
 public:
     TerminalController(TerminalController& other) = delete;
     void operator=(const TerminalController&) = delete;
     static TerminalController& getInstance();
+    static void requestHeadless();
 
     std::ostringstream& getStream();
     void flush();
+    void flushFrame();
+    void writeFrame(const std::string& frame);
+    void writeFrame(const char* data, size_t size);
+    void setKeepingFrames(bool isKeeping);
+    std::string takeKeptFrame();
     bool shouldExit();
+    bool isOutputBusy();
+    void drainOutput();
+    int getFrameStride(int fps);
 
     std::pair<int, int> getSize();
+    void refreshSize();
+    std::pair<int, int> getCellPixelSize();
     void setCursor(int x, int y);
     void setCursorHome();
     void clearScreen();
+    void writeText(const std::string& text);
+    TermState& getState();
+    void invalidateState();
+    TermColor toTermColor(Color c) const;
+    TermColor getPreferredFG() const;
+    TermColor getPreferredBG() const;
+    size_t writeSGR(
+        TermState& state,
+        TermColor fg,
+        TermColor bg,
+        std::string* out,
+        bool isReversed = false
+    ) const;
+    size_t writeMove(TermState& state, int x, int y, std::string* out) const;
+    size_t writeGlyph(TermState& state, const char* glyph, std::string* out) const;
+    size_t writeRepeat(TermState& state, int count, std::string* out) const;
+    size_t writeErase(TermState& state, int count, std::string* out) const;
+    const TermCaps& getCaps() const;
+    void setCaps(const TermCaps& caps);
+    void setHeadlessSize(std::pair<int, int> size);
+    std::string takeCaptured();
+    void setColorMode(ColorMode mode);
+    ColorMode getColorMode() const;
     void setFG(Color c);
     void setBG(Color c);
     void setFGAndBG(Color fg, Color bg);
@@ -43,8 +115,22 @@ public:
 private:
     std::ostringstream m_outStream;
     bool m_isCtrlCPressed;
+    std::pair<int, int> m_size;
+    std::pair<int, int> m_cellPixelSize;
     Color m_prefFG;
     Color m_prefBG;
+    float m_avgFrameBytes;
+    ColorMode m_colorMode;
+    bool m_isColorModeAuto;
+    TermState m_state;
+    TermCaps m_caps;
+    bool m_isHeadless;
+    std::string m_captured;
+    bool m_isKeepingFrames;
+    std::string m_keptFrame;
+
+    void appendColorParam(int sgrBase, TermColor c, std::string* out) const;
+    ColorMode detectColorMode() const;
 
     TerminalController();
     ~TerminalController();
@@ -56,6 +142,16 @@ private:
 
     static int handleCtrlC_Windows(DWORD ctrlType);
 #else
-    static void handleCtrlC_Linux(int signal);
+    struct termios m_origInAttrs;
+    bool m_hasOrigInAttrs;
+    int m_outFd;
+    std::string m_pending;
+    size_t m_pendingOffset;
+    bool m_wasSaturated;
+    int64_t m_lastDrainNs;
+    float m_drainRate;
+
+    size_t writeWhileWritable(const char* data, size_t size);
+    void recordDrain(size_t written, int64_t nowNs);
 #endif
 };
@@ -0,0 +1,114 @@
+#include "transition.hpp"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "image.hpp"
+
+#define FADE_STEPS 32
+
+Transition::Transition(TransitionType type, float duration)
+    : m_type(type), m_duration(duration), m_startTime(0), m_isActive(false)
+    , m_wipeColumn(0), m_fadeStep(0) {}
+
+void Transition::start(const Image& from, const Image& to, float time) {
+    if (m_type == TransitionType::NONE) {
+        return;
+    }
+
+    m_from = from;
+    m_to = to;
+    m_startTime = time;
+    m_isActive = true;
+    m_wipeColumn = 0;
+    m_fadeStep = 0;
+
+    size_t width = std::max(from.getWidth(), to.getWidth());
+    size_t height = std::max(from.getHeight(), to.getHeight());
+    m_frame.resize(width, height);
+    m_changingPixels.clear();
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            Color fromColor = sampleFrom(x, y);
+            m_frame.setPixel(x, y, fromColor);
+            if (!(fromColor == sampleTo(x, y))) {
+                m_changingPixels.push_back(x + y * width);
+            }
+        }
+    }
+}
+
+bool Transition::isActive() const {
+    return m_isActive;
+}
+
+const Image& Transition::getFrame(float time) {
+    float progress = (time - m_startTime) / m_duration;
+    if (progress >= 1) {
+        m_isActive = false;
+        return m_to;
+    }
+
+    if (m_type == TransitionType::WIPE) {
+        updateWipe(progress);
+    }
+    else {
+        updateFade(progress);
+    }
+    return m_frame;
+}
+
+Color Transition::sampleFrom(size_t x, size_t y) const {
+    if (x < m_from.getWidth() && y < m_from.getHeight()) {
+        return m_from.getPixel(x, y);
+    }
+    return Color();
+}
+
+Color Transition::sampleTo(size_t x, size_t y) const {
+    if (x < m_to.getWidth() && y < m_to.getHeight()) {
+        return m_to.getPixel(x, y);
+    }
+    return Color();
+}
+
+// NOTE: The wipe moves away from the pole like the waves do, so only the
+// columns the edge passed since the last frame are copied
+void Transition::updateWipe(float progress) {
+    size_t column = static_cast<size_t>(progress * m_frame.getWidth());
+    for (size_t x = m_wipeColumn; x < column; x++) {
+        for (size_t y = 0; y < m_frame.getHeight(); y++) {
+            m_frame.setPixel(x, y, sampleTo(x, y));
+        }
+    }
+    m_wipeColumn = std::max(m_wipeColumn, column);
+}
+
+void Transition::updateFade(float progress) {
+    int step = static_cast<int>(progress * FADE_STEPS);
+    if (step == m_fadeStep) {
+        return;
+    }
+    m_fadeStep = step;
+
+    float toWeight = static_cast<float>(step) / FADE_STEPS;
+    float fromWeight = 1 - toWeight;
+    size_t width = m_frame.getWidth();
+    for (size_t idx : m_changingPixels) {
+        size_t x = idx % width;
+        size_t y = idx / width;
+        Color fromColor = sampleFrom(x, y);
+        Color toColor = sampleTo(x, y);
+        Color blended;
+        if (fromColor.a && toColor.a) {
+            blended = Color(
+                static_cast<uint8_t>(round(fromColor.r * fromWeight + toColor.r * toWeight)),
+                static_cast<uint8_t>(round(fromColor.g * fromWeight + toColor.g * toWeight)),
+                static_cast<uint8_t>(round(fromColor.b * fromWeight + toColor.b * toWeight))
+            );
+        }
+        else {
+            blended = toWeight < 0.5f ? fromColor : toColor;
+        }
+        m_frame.setPixel(x, y, blended);
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <vector>
+#include "image.hpp"
+
+enum class TransitionType {
+    NONE,
+    FADE,
+    WIPE
+};
+
+// Blends two flags into a frame image that is then waved like any other flag.
+// The frame is kept between calls and only the pixels the transition changed
+// since the previous call are rewritten, so the canvas diff also only has to
+// re-encode those.
+class Transition {
+public:
+    Transition(TransitionType type, float duration);
+
+    void start(const Image& from, const Image& to, float time);
+    bool isActive() const;
+    const Image& getFrame(float time);
+private:
+    TransitionType m_type;
+    float m_duration;
+    float m_startTime;
+    bool m_isActive;
+    Image m_from;
+    Image m_to;
+    Image m_frame;
+    std::vector<size_t> m_changingPixels;
+    size_t m_wipeColumn;
+    int m_fadeStep;
+
+    Color sampleFrom(size_t x, size_t y) const;
+    Color sampleTo(size_t x, size_t y) const;
+    void updateWipe(float progress);
+    void updateFade(float progress);
+};
@@ -0,0 +1,80 @@
+#include "wavekernel.hpp"
+#include <cmath>
+#include <vector>
+
+// Index 0 holds the generic kernels. Gravity only pulls a fixed flag.
+#define WAVE_KERNEL_ROW(n) { \
+    { &WaveKernel::run<n, false, false>, &WaveKernel::run<n, false, false> }, \
+    { &WaveKernel::run<n, true, false>, &WaveKernel::run<n, true, true> } \
+}
+
+WaveKernelParams WaveKernel::getParams(const WaveConfig& waveConfig, size_t imgWidth, float time) {
+    WaveKernelParams params;
+    for (const SineWave& w : waveConfig.waves) {
+        params.amplitudes.push_back(w.amplitude);
+        params.wavelengths.push_back(w.wavelength);
+        params.phases.push_back(w.phase);
+        params.offsets.push_back(time * waveConfig.speedMultiplier * w.speed);
+    }
+    params.waveCount = waveConfig.waves.size();
+    params.amplitudeMultiplier = waveConfig.amplitudeMultiplier;
+    params.gravityMultiplier = waveConfig.gravityMultiplier;
+    params.imgWidthLessOne = static_cast<float>(imgWidth - 1);
+    return params;
+}
+
+// A WaveCount of 0 reads the count from params instead.
+// NOTE: The math is written out the same way the waves always were, so the
+// shifts come out the same to the last bit
+template <size_t WaveCount, bool IsLeftFixed, bool HasGravity>
+void WaveKernel::run(
+    const WaveKernelParams& params,
+    int scaleX,
+    size_t count,
+    float* outWaveShifts,
+    float* outShifts
+) {
+    size_t waveCount = WaveCount > 0 ? WaveCount : params.waveCount;
+    const float* amplitudes = params.amplitudes.data();
+    const float* wavelengths = params.wavelengths.data();
+    const float* phases = params.phases.data();
+    const float* offsets = params.offsets.data();
+    for (size_t i = 0; i < count; i++) {
+        float x = static_cast<float>(static_cast<int>(i) - scaleX) / scaleX;
+        float yShift = 0;
+        for (size_t w = 0; w < waveCount; w++) {
+            float angle = 2 * static_cast<float>(PI) * (x - offsets[w]) / wavelengths[w] + phases[w];
+            yShift += amplitudes[w] * sin(angle) * params.amplitudeMultiplier;
+        }
+        if (IsLeftFixed) {
+            yShift *= x / params.imgWidthLessOne * (x < 0 ? -1 : 1);
+        }
+        outWaveShifts[i] = yShift;
+
+        // NOTE: Gravity is sampled one pixel to the right, as it always was
+        if (HasGravity) {
+            // TODO: Make this a flag in WaveConfig
+            float xNormal = (x + 1) / params.imgWidthLessOne;
+            yShift += 1.0f * xNormal * params.gravityMultiplier;
+        }
+        outShifts[i] = yShift;
+    }
+}
+
+WaveKernel::Kernel WaveKernel::select(const WaveConfig& waveConfig) {
+    static const Kernel kernels[WAVE_KERNEL_MAX_WAVES + 1][2][2] = {
+        WAVE_KERNEL_ROW(0),
+        WAVE_KERNEL_ROW(1),
+        WAVE_KERNEL_ROW(2),
+        WAVE_KERNEL_ROW(3),
+        WAVE_KERNEL_ROW(4),
+        WAVE_KERNEL_ROW(5),
+        WAVE_KERNEL_ROW(6),
+        WAVE_KERNEL_ROW(7),
+        WAVE_KERNEL_ROW(8)
+    };
+    size_t waveCount = waveConfig.waves.size();
+    bool isLeftFixed = waveConfig.keepLeftFixed;
+    bool hasGravity = isLeftFixed && waveConfig.gravityMultiplier != 0;
+    return kernels[waveCount <= WAVE_KERNEL_MAX_WAVES ? waveCount : 0][isLeftFixed][hasGravity];
+}
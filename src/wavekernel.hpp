@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include "animation.hpp"
+
+// Most waves a kernel is specialized for, configs with more use the generic
+// one
+#define WAVE_KERNEL_MAX_WAVES 8
+
+// What the kernels read for a frame, one array entry per wave
+struct WaveKernelParams {
+    std::vector<float> amplitudes;
+    std::vector<float> wavelengths;
+    std::vector<float> phases;
+    // How far each wave moved by the frame's time
+    std::vector<float> offsets;
+    size_t waveCount;
+    float amplitudeMultiplier;
+    float gravityMultiplier;
+    float imgWidthLessOne;
+};
+
+// Vertical offsets of the flag, in flag pixels, for count evenly spaced
+// samples. Sample i is at x = (i - scaleX) / scaleX, so scaleX samples per
+// flag pixel starting one pixel left of the flag. outWaveShifts gets the
+// offset from the waves alone, outShifts adds gravity. A kernel is
+// specialized on the wave count and on whether the left edge is fixed and
+// pulled by gravity, the loop over the waves is then unrolled and the
+// branches are gone.
+class WaveKernel {
+public:
+    typedef void (*Kernel)(
+        const WaveKernelParams& params,
+        int scaleX,
+        size_t count,
+        float* outWaveShifts,
+        float* outShifts
+    );
+
+    static WaveKernelParams getParams(const WaveConfig& waveConfig, size_t imgWidth, float time);
+    static Kernel select(const WaveConfig& waveConfig);
+private:
+    template <size_t WaveCount, bool IsLeftFixed, bool HasGravity>
+    static void run(
+        const WaveKernelParams& params,
+        int scaleX,
+        size_t count,
+        float* outWaveShifts,
+        float* outShifts
+    );
+};
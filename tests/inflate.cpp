@@ -0,0 +1,285 @@
+#include "inflate.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+static const uint16_t LENGTH_BASES[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA_BITS[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t DISTANCE_BASES[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DISTANCE_EXTRA_BITS[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+// Order the code length code lengths of a dynamic block come in
+static const uint8_t CODE_LENGTH_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+bool Inflate::decompressZlib(const uint8_t* data, size_t size, std::vector<uint8_t>* out) {
+    out->clear();
+    // NOTE: Deflate with a window of at most 32K, no preset dictionary
+    if (size < 6 || (data[0] & 0x0F) != 8 || (data[0] >> 4) > 7 || (data[1] & 0x20) != 0
+        || ((data[0] << 8) | data[1]) % 31 != 0) {
+        return false;
+    }
+
+    BitReader reader(data, size, 2);
+    bool isFinal = false;
+    while (!isFinal) {
+        isFinal = reader.readBits(1) == 1;
+        uint32_t type = reader.readBits(2);
+        bool isRead = false;
+        if (type == 0) {
+            isRead = readStored(reader, out);
+        }
+        else if (type == 1) {
+            uint8_t lengths[INFLATE_LITLEN_CODES + INFLATE_DIST_CODES];
+            std::fill(lengths, lengths + 144, 8);
+            std::fill(lengths + 144, lengths + 256, 9);
+            std::fill(lengths + 256, lengths + 280, 7);
+            std::fill(lengths + 280, lengths + INFLATE_LITLEN_CODES, 8);
+            std::fill(lengths + INFLATE_LITLEN_CODES, lengths + INFLATE_LITLEN_CODES + INFLATE_DIST_CODES, 5);
+            Huffman litLen;
+            Huffman dist;
+            isRead = buildHuffman(lengths, INFLATE_LITLEN_CODES, &litLen)
+                && buildHuffman(lengths + INFLATE_LITLEN_CODES, INFLATE_DIST_CODES, &dist)
+                && readCompressed(reader, litLen, dist, out);
+        }
+        else if (type == 2) {
+            Huffman litLen;
+            Huffman dist;
+            isRead = readDynamicCodes(reader, &litLen, &dist)
+                && readCompressed(reader, litLen, dist, out);
+        }
+        if (!isRead || reader.isOverrun()) {
+            return false;
+        }
+    }
+
+    reader.alignToByte();
+    size_t pos = reader.getBytePos();
+    if (pos + 4 > size) {
+        return false;
+    }
+    uint32_t checksum = (static_cast<uint32_t>(data[pos]) << 24) | (data[pos + 1] << 16)
+        | (data[pos + 2] << 8) | data[pos + 3];
+    return checksum == adler32(out->data(), out->size());
+}
+
+Inflate::BitReader::BitReader(const uint8_t* data, size_t size, size_t pos)
+    : m_data(data), m_size(size), m_pos(pos), m_bits(0), m_bitCount(0), m_isOverrun(false) {}
+
+uint32_t Inflate::BitReader::readBits(int count) {
+    while (m_bitCount < count) {
+        uint32_t byte = 0;
+        if (m_pos < m_size) {
+            byte = m_data[m_pos];
+        }
+        else {
+            m_isOverrun = true;
+        }
+        m_pos++;
+        m_bits |= byte << m_bitCount;
+        m_bitCount += 8;
+    }
+    uint32_t value = m_bits & ((uint32_t(1) << count) - 1);
+    m_bits >>= count;
+    m_bitCount -= count;
+    return value;
+}
+
+// NOTE: Bits are only ever buffered up to the byte they came from, so
+// dropping them lands on the next byte
+void Inflate::BitReader::alignToByte() {
+    m_bits = 0;
+    m_bitCount = 0;
+}
+
+size_t Inflate::BitReader::getBytePos() const {
+    return m_pos;
+}
+
+bool Inflate::BitReader::isOverrun() const {
+    return m_isOverrun;
+}
+
+// Fails for lengths that describe more codes than fit, incomplete codes are
+// allowed as RFC 1951 uses them for single distance codes
+bool Inflate::buildHuffman(const uint8_t* lengths, size_t count, Huffman* outHuffman) {
+    std::fill(outHuffman->counts, outHuffman->counts + INFLATE_MAX_BITS + 1, 0);
+    for (size_t i = 0; i < count; i++) {
+        outHuffman->counts[lengths[i]]++;
+    }
+    outHuffman->counts[0] = 0;
+
+    int left = 1;
+    for (int len = 1; len <= INFLATE_MAX_BITS; len++) {
+        left = left * 2 - outHuffman->counts[len];
+        if (left < 0) {
+            return false;
+        }
+    }
+
+    uint16_t offsets[INFLATE_MAX_BITS + 1];
+    offsets[1] = 0;
+    for (int len = 1; len < INFLATE_MAX_BITS; len++) {
+        offsets[len + 1] = offsets[len] + outHuffman->counts[len];
+    }
+    outHuffman->symbols.assign(count, 0);
+    for (size_t i = 0; i < count; i++) {
+        if (lengths[i] != 0) {
+            outHuffman->symbols.at(offsets[lengths[i]]++) = static_cast<uint16_t>(i);
+        }
+    }
+    return true;
+}
+
+// Codes are read MSB first a bit at a time, each length's codes follow the
+// last one of the length before. Returns -1 for bits that aren't a code.
+int Inflate::decodeSymbol(BitReader& reader, const Huffman& huffman) {
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len <= INFLATE_MAX_BITS; len++) {
+        code |= static_cast<int>(reader.readBits(1));
+        int count = huffman.counts[len];
+        if (code - first < count) {
+            return huffman.symbols.at(index + code - first);
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+bool Inflate::readStored(BitReader& reader, std::vector<uint8_t>* out) {
+    reader.alignToByte();
+    uint32_t len = reader.readBits(16);
+    uint32_t lenComplement = reader.readBits(16);
+    if ((len ^ 0xFFFF) != lenComplement) {
+        return false;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        out->push_back(static_cast<uint8_t>(reader.readBits(8)));
+    }
+    return true;
+}
+
+bool Inflate::readDynamicCodes(BitReader& reader, Huffman* outLitLen, Huffman* outDist) {
+    size_t litLenCount = reader.readBits(5) + 257;
+    size_t distCount = reader.readBits(5) + 1;
+    size_t codeLengthCount = reader.readBits(4) + 4;
+    if (litLenCount > 286 || distCount > INFLATE_DIST_CODES) {
+        return false;
+    }
+
+    uint8_t codeLengthLengths[19] = {};
+    for (size_t i = 0; i < codeLengthCount; i++) {
+        codeLengthLengths[CODE_LENGTH_ORDER[i]] = static_cast<uint8_t>(reader.readBits(3));
+    }
+    Huffman codeLengths;
+    if (!buildHuffman(codeLengthLengths, 19, &codeLengths)) {
+        return false;
+    }
+
+    // Literal/length and distance code lengths are one sequence, repeats may
+    // run from one into the other
+    std::vector<uint8_t> lengths;
+    while (lengths.size() < litLenCount + distCount) {
+        int symbol = decodeSymbol(reader, codeLengths);
+        if (symbol < 0 || reader.isOverrun()) {
+            return false;
+        }
+        if (symbol < 16) {
+            lengths.push_back(static_cast<uint8_t>(symbol));
+            continue;
+        }
+        uint8_t value = 0;
+        size_t repeat = 0;
+        if (symbol == 16) {
+            if (lengths.empty()) {
+                return false;
+            }
+            value = lengths.back();
+            repeat = 3 + reader.readBits(2);
+        }
+        else if (symbol == 17) {
+            repeat = 3 + reader.readBits(3);
+        }
+        else {
+            repeat = 11 + reader.readBits(7);
+        }
+        if (lengths.size() + repeat > litLenCount + distCount) {
+            return false;
+        }
+        lengths.insert(lengths.end(), repeat, value);
+    }
+    // NOTE: Without an end of block code no block can end
+    if (lengths.at(256) == 0) {
+        return false;
+    }
+    return buildHuffman(lengths.data(), litLenCount, outLitLen)
+        && buildHuffman(lengths.data() + litLenCount, distCount, outDist);
+}
+
+bool Inflate::readCompressed(
+    BitReader& reader,
+    const Huffman& litLen,
+    const Huffman& dist,
+    std::vector<uint8_t>* out
+) {
+    while (!reader.isOverrun()) {
+        int symbol = decodeSymbol(reader, litLen);
+        if (symbol < 0) {
+            return false;
+        }
+        if (symbol < 256) {
+            out->push_back(static_cast<uint8_t>(symbol));
+            continue;
+        }
+        if (symbol == 256) {
+            return true;
+        }
+
+        symbol -= 257;
+        if (symbol >= 29) {
+            return false;
+        }
+        size_t length = LENGTH_BASES[symbol] + reader.readBits(LENGTH_EXTRA_BITS[symbol]);
+        int distSymbol = decodeSymbol(reader, dist);
+        if (distSymbol < 0 || distSymbol >= INFLATE_DIST_CODES) {
+            return false;
+        }
+        size_t distance = DISTANCE_BASES[distSymbol] + reader.readBits(DISTANCE_EXTRA_BITS[distSymbol]);
+        if (distance > out->size()) {
+            return false;
+        }
+        // NOTE: Matches may overlap what they copy, so copy byte by byte
+        size_t from = out->size() - distance;
+        for (size_t i = 0; i < length; i++) {
+            out->push_back(out->at(from + i));
+        }
+    }
+    return false;
+}
+
+uint32_t Inflate::adler32(const uint8_t* data, size_t size) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (size_t i = 0; i < size; i++) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#define INFLATE_MAX_BITS      15
+#define INFLATE_LITLEN_CODES  288
+#define INFLATE_DIST_CODES    30
+
+// Decompresses zlib streams (RFC 1950) to check what Deflate and the kitty
+// encoder send. Takes all three block types, not only what Deflate writes,
+// and checks the Adler-32 at the end.
+class Inflate {
+public:
+    static bool decompressZlib(const uint8_t* data, size_t size, std::vector<uint8_t>* out);
+private:
+    class BitReader {
+    public:
+        BitReader(const uint8_t* data, size_t size, size_t pos);
+        // Reads count bits, LSB first. Past the end it reads zeros and marks
+        // the stream as overrun.
+        uint32_t readBits(int count);
+        void alignToByte();
+        size_t getBytePos() const;
+        bool isOverrun() const;
+    private:
+        const uint8_t* m_data;
+        size_t m_size;
+        size_t m_pos;
+        uint32_t m_bits;
+        int m_bitCount;
+        bool m_isOverrun;
+    };
+
+    // Canonical Huffman code as the number of codes of each length and the
+    // symbols ordered by code
+    struct Huffman {
+        uint16_t counts[INFLATE_MAX_BITS + 1];
+        std::vector<uint16_t> symbols;
+    };
+
+    static bool buildHuffman(const uint8_t* lengths, size_t count, Huffman* outHuffman);
+    static int decodeSymbol(BitReader& reader, const Huffman& huffman);
+    static bool readStored(BitReader& reader, std::vector<uint8_t>* out);
+    static bool readDynamicCodes(BitReader& reader, Huffman* outLitLen, Huffman* outDist);
+    static bool readCompressed(
+        BitReader& reader,
+        const Huffman& litLen,
+        const Huffman& dist,
+        std::vector<uint8_t>* out
+    );
+    static uint32_t adler32(const uint8_t* data, size_t size);
+};
@@ -0,0 +1,211 @@
+#include "kittymodel.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstdlib>
+#include "inflate.hpp"
+
+KittyModel::KittyModel()
+    : m_pendingCol(0), m_pendingRow(0), m_isPending(false) {}
+
+// The first chunk of an image holds its keys and the later ones only m, m=1
+// means more chunks follow
+void KittyModel::feed(const VtString& str) {
+    if (str.kind != '_' || str.data.empty() || str.data.at(0) != 'G') {
+        setError("Unexpected string that isn't kitty graphics");
+        return;
+    }
+    size_t split = str.data.find(';');
+    std::map<std::string, std::string> keys;
+    if (!parseKeys(str.data.substr(1, split == std::string::npos ? std::string::npos : split - 1), &keys)) {
+        setError("Malformed keys in `" + str.data.substr(0, split) + "`");
+        return;
+    }
+    std::string payload = split == std::string::npos ? "" : str.data.substr(split + 1);
+    if (keys.count("q") == 0 || keys.at("q") != "2") {
+        setError("Command without q=2 would make the terminal reply");
+        return;
+    }
+
+    if (m_isPending) {
+        if (keys.size() != 2 || keys.count("m") == 0) {
+            setError("Continuation chunk with keys besides m");
+            return;
+        }
+        m_pendingPayload += payload;
+        if (keys.at("m") == "0") {
+            transmit();
+        }
+        return;
+    }
+
+    std::string action = keys.count("a") != 0 ? keys.at("a") : "t";
+    if (action == "d") {
+        std::string what = keys.count("d") != 0 ? keys.at("d") : "a";
+        long id = 0;
+        if (what == "A" || what == "a") {
+            m_images.clear();
+        }
+        else if ((what == "I" || what == "i") && getNumber(keys, "i", &id)) {
+            m_images.erase(static_cast<uint32_t>(id));
+        }
+        else {
+            setError("Unsupported delete d=" + what);
+        }
+        return;
+    }
+    if (action != "T") {
+        setError("Unsupported action a=" + action);
+        return;
+    }
+    m_pendingKeys = keys;
+    m_pendingPayload = payload;
+    m_pendingCol = str.cursorX;
+    m_pendingRow = str.cursorY;
+    m_isPending = true;
+    if (keys.count("m") == 0 || keys.at("m") == "0") {
+        transmit();
+    }
+}
+
+const std::map<uint32_t, KittyImage>& KittyModel::getImages() const {
+    return m_images;
+}
+
+// Describes the first thing that couldn't be replayed, empty if all went well
+const std::string& KittyModel::getError() const {
+    return m_error;
+}
+
+// NOTE: A transmission with an ID that is in use replaces that image and its
+// placement
+void KittyModel::transmit() {
+    m_isPending = false;
+    const std::map<std::string, std::string>& keys = m_pendingKeys;
+    long id = 0;
+    long width = 0;
+    long height = 0;
+    long cols = 0;
+    long rows = 0;
+    if (!getNumber(keys, "i", &id) || !getNumber(keys, "s", &width) || !getNumber(keys, "v", &height)
+        || !getNumber(keys, "c", &cols) || !getNumber(keys, "r", &rows)) {
+        setError("Image without i, s, v, c and r");
+        return;
+    }
+    if (keys.count("f") == 0 || keys.at("f") != "32" || keys.count("o") == 0 || keys.at("o") != "z") {
+        setError("Image " + std::to_string(id) + " isn't zlib compressed RGBA");
+        return;
+    }
+    if (keys.count("C") == 0 || keys.at("C") != "1") {
+        setError("Image " + std::to_string(id) + " would move the cursor");
+        return;
+    }
+    if (width <= 0 || height <= 0 || cols <= 0 || rows <= 0) {
+        setError("Image " + std::to_string(id) + " is empty");
+        return;
+    }
+
+    std::vector<uint8_t> compressed;
+    KittyImage img;
+    if (!decodeBase64(m_pendingPayload, &compressed)) {
+        setError("Image " + std::to_string(id) + " isn't valid base64");
+        return;
+    }
+    if (!Inflate::decompressZlib(compressed.data(), compressed.size(), &img.rgba)) {
+        setError("Image " + std::to_string(id) + " isn't a valid zlib stream");
+        return;
+    }
+    if (img.rgba.size() != static_cast<size_t>(width * height * 4)) {
+        setError("Image " + std::to_string(id) + " has " + std::to_string(img.rgba.size())
+            + " bytes instead of " + std::to_string(width * height * 4));
+        return;
+    }
+    img.col = m_pendingCol;
+    img.row = m_pendingRow;
+    img.cols = static_cast<size_t>(cols);
+    img.rows = static_cast<size_t>(rows);
+    img.width = static_cast<size_t>(width);
+    img.height = static_cast<size_t>(height);
+    m_images[static_cast<uint32_t>(id)] = std::move(img);
+}
+
+void KittyModel::setError(const std::string& error) {
+    if (m_error.empty()) {
+        m_error = error;
+    }
+}
+
+// Keys are comma separated key=value pairs, each key given once
+bool KittyModel::parseKeys(const std::string& keys, std::map<std::string, std::string>* outKeys) {
+    size_t pos = 0;
+    while (pos < keys.size()) {
+        size_t end = keys.find(',', pos);
+        if (end == std::string::npos) {
+            end = keys.size();
+        }
+        size_t eq = keys.find('=', pos);
+        if (eq == std::string::npos || eq >= end || eq == pos) {
+            return false;
+        }
+        if (!outKeys->emplace(keys.substr(pos, eq - pos), keys.substr(eq + 1, end - eq - 1)).second) {
+            return false;
+        }
+        pos = end + 1;
+    }
+    return true;
+}
+
+bool KittyModel::getNumber(const std::map<std::string, std::string>& keys, const std::string& key, long* outValue) {
+    auto it = keys.find(key);
+    if (it == keys.end() || it->second.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    *outValue = std::strtol(it->second.c_str(), &end, 10);
+    return *end == '\0';
+}
+
+// Padding is required, as in what KittyEncoder writes
+bool KittyModel::decodeBase64(const std::string& text, std::vector<uint8_t>* out) {
+    if (text.size() % 4 != 0) {
+        return false;
+    }
+    auto getValue = [](char c) {
+        if (c >= 'A' && c <= 'Z') {
+            return c - 'A';
+        }
+        if (c >= 'a' && c <= 'z') {
+            return c - 'a' + 26;
+        }
+        if (c >= '0' && c <= '9') {
+            return c - '0' + 52;
+        }
+        if (c == '+') {
+            return 62;
+        }
+        return c == '/' ? 63 : -1;
+    };
+    out->clear();
+    out->reserve(text.size() / 4 * 3);
+    for (size_t i = 0; i < text.size(); i += 4) {
+        bool isLast = i + 4 == text.size();
+        int padding = isLast ? (text.at(i + 3) == '=') + (text.at(i + 2) == '=') : 0;
+        uint32_t v = 0;
+        for (size_t j = 0; j < 4; j++) {
+            int value = j >= static_cast<size_t>(4 - padding) ? 0 : getValue(text.at(i + j));
+            if (value < 0) {
+                return false;
+            }
+            v = (v << 6) | static_cast<uint32_t>(value);
+        }
+        out->push_back(static_cast<uint8_t>(v >> 16));
+        if (padding < 2) {
+            out->push_back(static_cast<uint8_t>(v >> 8));
+        }
+        if (padding < 1) {
+            out->push_back(static_cast<uint8_t>(v));
+        }
+    }
+    return true;
+}
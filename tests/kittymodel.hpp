@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <cstddef>
+#include "vtmodel.hpp"
+
+// An image as the terminal shows it, stretched over cols x rows cells from
+// the cell it was placed at. Pixels are RGBA.
+struct KittyImage {
+    int col;
+    int row;
+    size_t cols;
+    size_t rows;
+    size_t width;
+    size_t height;
+    std::vector<uint8_t> rgba;
+};
+
+// Just enough of the kitty graphics protocol to replay what KittyEncoder
+// sends: transmitting and placing zlib compressed RGBA in base64 chunks at
+// the cursor, and deleting images by ID or all at once. Anything else is
+// recorded as an error.
+class KittyModel {
+public:
+    KittyModel();
+
+    void feed(const VtString& str);
+    const std::map<uint32_t, KittyImage>& getImages() const;
+    const std::string& getError() const;
+private:
+    std::map<uint32_t, KittyImage> m_images;
+    std::map<std::string, std::string> m_pendingKeys;
+    std::string m_pendingPayload;
+    int m_pendingCol;
+    int m_pendingRow;
+    bool m_isPending;
+    std::string m_error;
+
+    void transmit();
+    void setError(const std::string& error);
+    static bool parseKeys(const std::string& keys, std::map<std::string, std::string>* outKeys);
+    static bool getNumber(const std::map<std::string, std::string>& keys, const std::string& key, long* outValue);
+    static bool decodeBase64(const std::string& text, std::vector<uint8_t>* out);
+};
@@ -0,0 +1,73 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "arguments.hpp"
+#include "selfcheck.hpp"
+#define STB_IMAGE_IMPLEMENTATION
+    #include "stb_image.h"
+#undef STB_IMAGE_IMPLEMENTATION
+
+#define TESTS_FLAG "turkey"
+
+// A group of checks ctest runs as one test, with the flag drawn with fixed
+// point math or not
+struct TestCase {
+    const char* name;
+    bool isFixedPoint;
+    bool (*run)(const AppConfig& conf, std::string* outError);
+};
+
+static const TestCase TESTS[] = {
+    { "encoders", false, SelfCheck::checkEncoders },
+    { "encoders-fixed", true, SelfCheck::checkEncoders },
+    { "cost-model", false, SelfCheck::checkCostModel },
+    { "shading", false, [](const AppConfig&, std::string* outError) {
+        return SelfCheck::checkShading(outError);
+    } },
+    { "fixed-point", false, SelfCheck::checkFixedPoint },
+    { "kitty", false, [](const AppConfig&, std::string* outError) {
+        return SelfCheck::checkKitty(outError);
+    } },
+    { "sixel", false, [](const AppConfig&, std::string* outError) {
+        return SelfCheck::checkSixel(outError);
+    } },
+};
+
+static bool runTest(const TestCase& test) {
+    std::vector<const char*> args = { "wavet_tests", "--flag", TESTS_FLAG };
+    if (test.isFixedPoint) {
+        args.push_back("--math");
+        args.push_back("fixed");
+    }
+    ArgParser argParser(static_cast<int>(args.size()), args.data());
+    if (argParser.getShouldExitFail() || argParser.getShouldExitSuccess()) {
+        std::cout << "ERROR: " << test.name << ": Could not set up the flag\n";
+        return false;
+    }
+
+    std::string error;
+    if (!test.run(argParser.getAppConfig(), &error)) {
+        std::cout << "ERROR: " << test.name << ": " << error << "\n";
+        return false;
+    }
+    std::cout << test.name << " passed\n";
+    return true;
+}
+
+// Runs the test named by the first argument, or every test without one
+int main(int argc, const char** argv) {
+    bool isPassing = true;
+    bool isFound = false;
+    for (const TestCase& test : TESTS) {
+        if (argc > 1 && std::string(argv[1]) != test.name) {
+            continue;
+        }
+        isFound = true;
+        isPassing = runTest(test) && isPassing;
+    }
+    if (!isFound) {
+        std::cout << "ERROR: No test named " << argv[1] << "\n";
+        return -1;
+    }
+    return isPassing ? 0 : -1;
+}
@@ -0,0 +1,941 @@
+#include "selfcheck.hpp"
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdlib>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include "terminal.hpp"
+#include "termcaps.hpp"
+#include "vtmodel.hpp"
+#include "shading.hpp"
+#include "kittygraphics.hpp"
+#include "sixelgraphics.hpp"
+
+#define SELF_CHECK_MESSAGE "Self-check"
+
+static const SelfCheckEncoder ENCODERS[] = {
+    { "half truecolor",         GlyphMode::HALF,     ColorMode::TRUECOLOR, false, false, 0, false, RenderBackend::CELLS },
+    { "half truecolor rep/ech", GlyphMode::HALF,     ColorMode::TRUECOLOR, false, false, 0, true,  RenderBackend::CELLS },
+    { "half truecolor lossy",   GlyphMode::HALF,     ColorMode::TRUECOLOR, false, false, 6, true,  RenderBackend::CELLS },
+    { "half 256 dither",        GlyphMode::HALF,     ColorMode::COLOR_256, false, true,  0, true,  RenderBackend::CELLS },
+    { "half 16",                GlyphMode::HALF,     ColorMode::COLOR_16,  false, false, 0, false, RenderBackend::CELLS },
+    { "kitty",                  GlyphMode::HALF,     ColorMode::TRUECOLOR, false, false, 0, true,  RenderBackend::KITTY },
+    { "sixel",                  GlyphMode::HALF,     ColorMode::TRUECOLOR, false, false, 0, true,  RenderBackend::SIXEL },
+#ifndef _WIN32
+    { "half truecolor smooth",  GlyphMode::HALF,     ColorMode::TRUECOLOR, true,  false, 0, true,  RenderBackend::CELLS },
+    { "quadrant truecolor",     GlyphMode::QUADRANT, ColorMode::TRUECOLOR, false, false, 0, true,  RenderBackend::CELLS },
+    { "quadrant 256",           GlyphMode::QUADRANT, ColorMode::COLOR_256, false, false, 0, false, RenderBackend::CELLS },
+    { "sextant truecolor",      GlyphMode::SEXTANT,  ColorMode::TRUECOLOR, false, false, 0, true,  RenderBackend::CELLS },
+    { "sextant 16 dither",      GlyphMode::SEXTANT,  ColorMode::COLOR_16,  false, true,  0, true,  RenderBackend::CELLS },
+    { "kitty sextant",          GlyphMode::SEXTANT,  ColorMode::TRUECOLOR, false, false, 0, true,  RenderBackend::KITTY },
+    { "sixel quadrant",         GlyphMode::QUADRANT, ColorMode::TRUECOLOR, false, false, 0, false, RenderBackend::SIXEL },
+#endif
+};
+
+bool SelfCheck::checkEncoders(const AppConfig& conf, std::string* outError) {
+    TerminalController::requestHeadless();
+    std::cout << std::left << std::setw(26) << "Encoder" << std::right
+        << std::setw(8) << "Frames" << std::setw(14) << "Bytes/frame" << "\n";
+    for (const SelfCheckEncoder& encoder : ENCODERS) {
+        size_t bytes = 0;
+        std::string error;
+        if (!runEncoder(conf, encoder, SELF_CHECK_FRAMES, false, &bytes, &error)) {
+            *outError = std::string(encoder.name) + ": " + error;
+            return false;
+        }
+        std::cout << std::left << std::setw(26) << encoder.name << std::right
+            << std::setw(8) << SELF_CHECK_FRAMES << std::setw(14) << bytes / SELF_CHECK_FRAMES << "\n";
+    }
+    return true;
+}
+
+// NOTE: The graphics backends don't go through the cost model
+bool SelfCheck::checkCostModel(const AppConfig& conf, std::string* outError) {
+    TerminalController::requestHeadless();
+    for (const SelfCheckEncoder& encoder : ENCODERS) {
+        if (encoder.backend != RenderBackend::CELLS) {
+            continue;
+        }
+        size_t bytes = 0;
+        std::string error;
+        if (!runEncoder(conf, encoder, SELF_CHECK_COST_FRAMES, true, &bytes, &error)) {
+            *outError = std::string(encoder.name) + ": " + error;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Columns of every height up to a few vector widths, so the kernels' tails
+// are covered too
+bool SelfCheck::checkShading(std::string* outError) {
+    std::mt19937 rng(SELF_CHECK_SEED);
+    auto randInt = [&rng](int min, int max) {
+        return std::uniform_int_distribution<int>(min, max)(rng);
+    };
+    for (int i = 0; i < SELF_CHECK_SHADE_COLUMNS; i++) {
+        Image img(2, static_cast<size_t>(randInt(1, 70)));
+        for (size_t x = 0; x < img.getWidth(); x++) {
+            for (size_t y = 0; y < img.getHeight(); y++) {
+                img.setPixel(x, y, Color(
+                    static_cast<uint8_t>(randInt(0, 255)),
+                    static_cast<uint8_t>(randInt(0, 255)),
+                    static_cast<uint8_t>(randInt(0, 255)),
+                    randInt(0, 1) == 0
+                ));
+            }
+        }
+        ColumnPlanes planes;
+        planes.assign(img);
+        float light = std::uniform_real_distribution<float>(0, 1)(rng);
+        size_t x = static_cast<size_t>(randInt(0, 1));
+
+        std::vector<Color> shaded(img.getHeight());
+        for (int level = 0; level <= static_cast<int>(Shading::getSimdLevel()); level++) {
+            Shading::shadeColumn(static_cast<SimdLevel>(level), planes, x, light, shaded.data());
+            for (size_t y = 0; y < img.getHeight(); y++) {
+                if (!(shaded.at(y) == img.getPixel(x, y) * light)) {
+                    *outError = std::string(Shading::getLevelName(static_cast<SimdLevel>(level)))
+                        + " differs at row " + std::to_string(y) + " of " + std::to_string(img.getHeight());
+                    return false;
+                }
+            }
+        }
+
+        // The same column kept as palette indices, as shared flags are
+        auto storage = std::make_shared<std::pair<std::vector<Color>, std::vector<uint8_t>>>();
+        for (size_t y = 0; y < img.getHeight(); y++) {
+            for (size_t imgX = 0; imgX < img.getWidth(); imgX++) {
+                storage->first.push_back(img.getPixel(imgX, y));
+                storage->second.push_back(static_cast<uint8_t>(storage->second.size()));
+            }
+        }
+        Image indexed(storage, storage->first.data(), storage->second.data(), img.getWidth(), img.getHeight());
+        ColumnPlanes indexedPlanes;
+        indexedPlanes.assign(indexed);
+        uint32_t fixedLight = static_cast<uint32_t>(randInt(0, SHADING_FIXED_ONE));
+        std::vector<Color> shadedFixed(img.getHeight());
+        Shading::shadeColumnFixed(indexedPlanes, x, fixedLight, shadedFixed.data());
+        for (int level = 0; level <= static_cast<int>(Shading::getSimdLevel()); level++) {
+            Shading::shadeColumn(static_cast<SimdLevel>(level), indexedPlanes, x, light, shaded.data());
+            for (size_t y = 0; y < img.getHeight(); y++) {
+                if (!(shaded.at(y) == img.getPixel(x, y) * light)
+                    || !(shadedFixed.at(y) == Shading::shadePixelFixed(img.getPixel(x, y), fixedLight))) {
+                    *outError = std::string("Indexed column at ")
+                        + Shading::getLevelName(static_cast<SimdLevel>(level)) + " differs at row "
+                        + std::to_string(y) + " of " + std::to_string(img.getHeight());
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Light levels, start rows and edges in eighths may each be a step off, the
+// colors are the same for the same light level
+bool SelfCheck::checkFixedPoint(const AppConfig& conf, std::string* outError) {
+    Canvas& canvas = Canvas::getInstance();
+    std::mt19937 rng(SELF_CHECK_SEED);
+    auto randInt = [&rng](int min, int max) {
+        return std::uniform_int_distribution<int>(min, max)(rng);
+    };
+    auto randFloat = [&rng](float min, float max) {
+        return std::uniform_real_distribution<float>(min, max)(rng);
+    };
+    const GlyphMode glyphModes[] = { GlyphMode::HALF, GlyphMode::QUADRANT, GlyphMode::SEXTANT };
+    std::vector<ColumnShape> floatShapes;
+    std::vector<ColumnShape> fixedShapes;
+    for (int frame = 0; frame < SELF_CHECK_FIXED_FRAMES; frame++) {
+        canvas.setGlyphMode(glyphModes[randInt(0, 2)]);
+        WaveConfig waveConfig = conf.waveConfig;
+        waveConfig.speedMultiplier = randFloat(0.2f, 3);
+        waveConfig.gravityMultiplier = randFloat(0, 2);
+        waveConfig.amplitudeMultiplier = randFloat(0, 2);
+        waveConfig.keepLeftFixed = randInt(0, 1) == 0;
+        float ambientLight = randFloat(0, 1);
+        float time = randFloat(0, 100);
+        int originY = randInt(-20, 40);
+        canvas.getColumnShapes(conf.flag, originY, waveConfig, ambientLight, time, false, &floatShapes);
+        canvas.getColumnShapes(conf.flag, originY, waveConfig, ambientLight, time, true, &fixedShapes);
+
+        for (size_t x = 0; x < floatShapes.size(); x++) {
+            const ColumnShape& a = floatShapes.at(x);
+            const ColumnShape& b = fixedShapes.at(x);
+            int topSteps = (a.topRow * 8 - a.topEighths) - (b.topRow * 8 - b.topEighths);
+            int bottomSteps = (a.bottomRow * 8 - a.bottomEighths) - (b.bottomRow * 8 - b.bottomEighths);
+            const char* what = nullptr;
+            if (std::abs(a.light - b.light) > 1) {
+                what = "light";
+            }
+            else if (std::abs(a.yStart - b.yStart) > 1) {
+                what = "start row";
+            }
+            else if (std::abs(topSteps) > 1 || std::abs(bottomSteps) > 1) {
+                what = "edge";
+            }
+            if (what != nullptr) {
+                *outError = std::string(what) + " differs in frame " + std::to_string(frame)
+                    + " at column " + std::to_string(x);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Frames are random rectangles over the last frame, every once in a while on
+// a screen of another size or with cells of another pixel size. Like Canvas,
+// the encoder starts over after a resize.
+bool SelfCheck::checkKitty(std::string* outError) {
+    TerminalController::requestHeadless();
+    const TerminalController& term = TerminalController::getInstance();
+    std::mt19937 rng(SELF_CHECK_SEED);
+    auto randInt = [&rng](int min, int max) {
+        return std::uniform_int_distribution<int>(min, max)(rng);
+    };
+    const std::pair<size_t, size_t> cellSizes[] = { { 1, 2 }, { 2, 2 }, { 2, 3 } };
+
+    KittyEncoder encoder;
+    KittyModel kitty;
+    VtModel vt(1, 1);
+    TermState state;
+    Image prev;
+    Image canvas;
+    std::pair<size_t, size_t> cellSize;
+    std::pair<int, int> cellPixelSize;
+    for (int frame = 0; frame < SELF_CHECK_GRAPHICS_FRAMES; frame++) {
+        if (frame == 0 || randInt(1, SELF_CHECK_RESIZE_ODDS) == 1) {
+            cellSize = cellSizes[randInt(0, 2)];
+            int cols = randInt(1, SELF_CHECK_GRAPHICS_MAX_COLS);
+            int rows = randInt(1, SELF_CHECK_GRAPHICS_MAX_ROWS);
+            canvas = Image(cols * cellSize.first, rows * cellSize.second);
+            prev = canvas;
+            vt.resize(cols, rows);
+            state = TermState();
+            encoder.reset();
+        }
+        // NOTE: A new cell pixel size changes the scale without a resize
+        if (frame == 0 || randInt(1, SELF_CHECK_RESIZE_ODDS) == 1) {
+            int scale = randInt(0, KITTY_MAX_SCALE);
+            cellPixelSize = scale == 0
+                ? std::pair<int, int>(0, 0)
+                : std::pair<int, int>(
+                    static_cast<int>(cellSize.first) * scale + randInt(0, 1),
+                    static_cast<int>(cellSize.second) * scale + randInt(0, 1)
+                );
+        }
+        drawRandomRects(canvas, rng);
+
+        std::string out;
+        encoder.encodeFrame(
+            canvas,
+            cellSize,
+            getDirtyCells(prev, canvas, cellSize),
+            cellPixelSize,
+            term,
+            state,
+            &out
+        );
+        vt.feed(out);
+        for (const VtString& str : vt.takeStrings()) {
+            kitty.feed(str);
+        }
+        std::string error = vt.getError();
+        if (error.empty()) {
+            error = kitty.getError();
+        }
+        if (error.empty()) {
+            checkKittyTiles(kitty, canvas, cellSize, &error);
+        }
+        if (!error.empty()) {
+            *outError = "Frame " + std::to_string(frame) + ": " + error;
+            return false;
+        }
+        prev = canvas;
+    }
+    return true;
+}
+
+// Frames are made like checkKitty's. Each frame is also drawn in full on a
+// blank screen with a new encoder, which the incrementally updated screen has
+// to look the same as. The screen has at least 2 rows, the encoder never
+// draws the last one.
+bool SelfCheck::checkSixel(std::string* outError) {
+    TerminalController::requestHeadless();
+    TerminalController& term = TerminalController::getInstance();
+    std::mt19937 rng(SELF_CHECK_SEED);
+    auto randInt = [&rng](int min, int max) {
+        return std::uniform_int_distribution<int>(min, max)(rng);
+    };
+    const std::pair<size_t, size_t> cellSizes[] = { { 1, 2 }, { 2, 2 }, { 2, 3 } };
+    SixelEncoder encoder;
+    VtModel vt(1, 1);
+    SixelModel sixel(std::pair<int, int>(1, 1), std::pair<size_t, size_t>(1, 1));
+    TermState state;
+    Image prev;
+    Image canvas;
+    std::pair<size_t, size_t> cellSize;
+    std::pair<int, int> cellPixelSize;
+    std::pair<int, int> size;
+    for (int frame = 0; frame < SELF_CHECK_GRAPHICS_FRAMES; frame++) {
+        if (frame == 0 || randInt(1, SELF_CHECK_RESIZE_ODDS) == 1) {
+            cellSize = cellSizes[randInt(0, 2)];
+            size = std::pair<int, int>(
+                randInt(1, SELF_CHECK_GRAPHICS_MAX_COLS),
+                randInt(2, SELF_CHECK_GRAPHICS_MAX_ROWS)
+            );
+            cellPixelSize = randInt(0, 1) == 0
+                ? std::pair<int, int>(0, 0)
+                : std::pair<int, int>(randInt(1, SIXEL_DEFAULT_CELL_WIDTH), randInt(1, SIXEL_DEFAULT_CELL_HEIGHT));
+            TermCaps caps;
+            caps.hasECH = randInt(0, 1) == 0;
+            term.setCaps(caps);
+            canvas = Image(size.first * cellSize.first, size.second * cellSize.second);
+            prev = canvas;
+            vt.resize(size.first, size.second);
+            sixel = SixelModel(size, getSixelPixelSize(cellPixelSize));
+            state = TermState();
+            encoder.reset();
+        }
+        drawRandomRects(canvas, rng);
+
+        std::string out;
+        encoder.encodeFrame(
+            canvas,
+            cellSize,
+            getDirtyCells(prev, canvas, cellSize),
+            cellPixelSize,
+            term,
+            state,
+            &out
+        );
+        vt.feed(out);
+        for (const VtString& str : vt.takeStrings()) {
+            sixel.feed(str);
+        }
+
+        SixelEncoder fullEncoder;
+        VtModel fullVt(size.first, size.second);
+        SixelModel fullSixel(size, getSixelPixelSize(cellPixelSize));
+        TermState fullState;
+        std::string fullOut;
+        fullEncoder.encodeFrame(
+            canvas,
+            cellSize,
+            std::vector<bool>(size.first * size.second, true),
+            cellPixelSize,
+            term,
+            fullState,
+            &fullOut
+        );
+        fullVt.feed(fullOut);
+        for (const VtString& str : fullVt.takeStrings()) {
+            fullSixel.feed(str);
+        }
+
+        std::string error = vt.getError();
+        const std::string* errors[] = { &sixel.getError(), &fullVt.getError(), &fullSixel.getError() };
+        for (const std::string* modelError : errors) {
+            if (error.empty()) {
+                error = *modelError;
+            }
+        }
+        if (error.empty()) {
+            checkSixelScreen(vt, sixel, fullVt, fullSixel, canvas, cellSize, &error);
+        }
+        if (!error.empty()) {
+            *outError = "Frame " + std::to_string(frame) + ": " + error;
+            return false;
+        }
+        prev = canvas;
+    }
+    return true;
+}
+
+// NOTE: Every encoder gets the same random scenes, so their byte counts can be
+// compared
+bool SelfCheck::runEncoder(
+    const AppConfig& conf,
+    const SelfCheckEncoder& encoder,
+    int frameCount,
+    bool isCheckingCostModel,
+    size_t* outBytes,
+    std::string* outError
+) {
+    TerminalController& term = TerminalController::getInstance();
+    Canvas& canvas = Canvas::getInstance();
+    std::mt19937 rng(SELF_CHECK_SEED);
+    auto randInt = [&rng](int min, int max) {
+        return std::uniform_int_distribution<int>(min, max)(rng);
+    };
+    auto randFloat = [&rng](float min, float max) {
+        return std::uniform_real_distribution<float>(min, max)(rng);
+    };
+    auto randSize = [&randInt]() {
+        return std::pair<int, int>(
+            randInt(SELF_CHECK_MIN_COLS, SELF_CHECK_MAX_COLS),
+            randInt(SELF_CHECK_MIN_ROWS, SELF_CHECK_MAX_ROWS)
+        );
+    };
+
+    TermCaps caps;
+    caps.hasREP = encoder.hasREPAndECH;
+    caps.hasECH = encoder.hasREPAndECH;
+    caps.hasSyncUpdate = encoder.hasREPAndECH;
+    term.setCaps(caps);
+    term.setColorMode(encoder.colorMode);
+    Color bg = randInt(0, 1) == 0
+        ? Color()
+        : Color(
+            static_cast<uint8_t>(randInt(0, 255)),
+            static_cast<uint8_t>(randInt(0, 255)),
+            static_cast<uint8_t>(randInt(0, 255))
+        );
+    term.assignPreferredFGandBG(conf.textColor, bg);
+    std::pair<int, int> size = randSize();
+    term.setHeadlessSize(size);
+
+    canvas.setBackend(encoder.backend);
+    canvas.setDithering(encoder.dither);
+    canvas.setDiffThreshold(encoder.diffThreshold);
+    canvas.setGlyphMode(encoder.glyphMode);
+    canvas.setEdgeSmoothing(encoder.smoothEdges);
+    canvas.setFixedPoint(conf.isFixedPoint);
+    term.invalidateState();
+    term.clearScreen();
+    term.flush();
+    VtModel vt(size.first, size.second);
+    vt.feed(term.takeCaptured());
+    KittyModel kitty;
+    SixelModel sixel(size, getSixelPixelSize(term.getCellPixelSize()));
+
+    WaveConfig waveConfig = conf.waveConfig;
+    waveConfig.speedMultiplier = randFloat(0.2f, 3);
+    waveConfig.gravityMultiplier = randFloat(0, 2);
+    waveConfig.keepLeftFixed = randInt(0, 1) == 0;
+    float ambientLight = randFloat(0, 1);
+    float time = randFloat(0, 100);
+    int scene = 0;
+    std::pair<float, float> pos(0.5f, 0.5f);
+    // NOTE: Unlike the flag these stay where they are through a resize, and
+    // are drawn without a background, so whatever the resize leaves on the
+    // screen shows in the blank cells around them
+    struct StillRect {
+        std::pair<int, int> origin;
+        std::pair<size_t, size_t> size;
+        Color fill;
+    };
+    std::vector<StillRect> stillRects;
+    for (int i = 0; i < SELF_CHECK_GRAPHICS_RECTS; i++) {
+        stillRects.push_back({
+            std::pair<int, int>(randInt(0, SELF_CHECK_STILL_RECT_SIZE), randInt(0, SELF_CHECK_STILL_RECT_SIZE)),
+            std::pair<size_t, size_t>(randInt(1, SELF_CHECK_STILL_RECT_SIZE), randInt(1, SELF_CHECK_STILL_RECT_SIZE)),
+            Color(
+                static_cast<uint8_t>(randInt(0, 3) * 85),
+                static_cast<uint8_t>(randInt(0, 3) * 85),
+                static_cast<uint8_t>(randInt(0, 3) * 85)
+            )
+        });
+    }
+    for (int frame = 0; frame < frameCount; frame++) {
+        bool isResized = randInt(1, SELF_CHECK_RESIZE_ODDS) == 1;
+        if (isResized) {
+            // NOTE: Only a new height keeps what the screen shows
+            std::pair<int, int> newSize = randSize();
+            size = randInt(0, 1) == 0 ? newSize : std::pair<int, int>(size.first, newSize.second);
+            term.setHeadlessSize(size);
+            vt.resize(size.first, size.second);
+            // NOTE: SixelEncoder clears the screen after a resize, no image
+            // is left to keep
+            sixel = SixelModel(size, getSixelPixelSize(term.getCellPixelSize()));
+        }
+        if (frame == 0 || randInt(1, SELF_CHECK_SCENE_ODDS) == 1) {
+            scene = randInt(0, 3);
+            pos = std::pair<float, float>(randFloat(0, 1), randFloat(0, 1));
+        }
+        time += randFloat(0, 0.2f);
+
+        canvas.beginDrawing(scene == 3 ? Color() : bg);
+        if (scene == 0) {
+            canvas.drawSceneFlagOnly(conf.flag, waveConfig, pos.first, pos.second, ambientLight, time);
+        }
+        else if (scene == 1) {
+            canvas.drawSceneFlagAndPole(conf.flag, waveConfig, pos.first, pos.second, ambientLight, time);
+        }
+        else if (scene == 2) {
+            canvas.drawSceneFlagPoleAndMsg(conf.flag, waveConfig, ambientLight, SELF_CHECK_MESSAGE, time);
+        }
+        else {
+            for (const StillRect& rect : stillRects) {
+                canvas.drawRect(rect.origin, rect.size, rect.fill);
+            }
+        }
+        // NOTE: After a resize the canvas moves what was shown around first,
+        // the encodings only start from the screen as it is
+        bool isCheckingFrame = isCheckingCostModel && !isResized;
+        VtModel before = isCheckingFrame ? vt : VtModel(0, 0);
+        TermState state = term.getState();
+        canvas.endDrawing();
+
+        std::string out = term.takeCaptured();
+        *outBytes += out.size();
+        vt.feed(out);
+        std::string error = vt.getError();
+        for (const VtString& str : vt.takeStrings()) {
+            if (encoder.backend == RenderBackend::KITTY) {
+                kitty.feed(str);
+            }
+            else if (encoder.backend == RenderBackend::SIXEL) {
+                sixel.feed(str);
+            }
+            else if (error.empty()) {
+                error = "Unexpected string sent by the cell encoder";
+            }
+        }
+        const std::string* errors[] = { &kitty.getError(), &sixel.getError() };
+        for (const std::string* modelError : errors) {
+            if (error.empty()) {
+                error = *modelError;
+            }
+        }
+        if (error.empty()) {
+            checkScreen(vt, &error);
+        }
+        std::pair<size_t, size_t> cellSize(canvas.m_cellWidth, canvas.m_cellHeight);
+        if (error.empty() && encoder.backend == RenderBackend::KITTY) {
+            checkKittyTiles(kitty, canvas.m_currCanvas, cellSize, &error);
+        }
+        if (error.empty() && encoder.backend == RenderBackend::SIXEL) {
+            checkSixelPixels(vt, sixel, canvas.m_currCanvas, cellSize, &error);
+        }
+        if (error.empty() && isCheckingFrame) {
+            checkFrameEncodings(before, state, rng, &error);
+        }
+        if (!error.empty()) {
+            *outError = "Frame " + std::to_string(frame) + ": " + error;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Encodes the frame endDrawing just sent in every way the cost model picks
+// from, each starting from the screen and state before it: cleared and drawn
+// in full, diffed row by row as endDrawing would, every row diffed, and every
+// row rewritten. Each has to cost what it writes and leave the screen showing
+// the frame, and each row has to take the cheaper of a diff and a rewrite.
+// Then single cells are encoded over the result, to check encodeCell with
+// states the rows don't get to.
+bool SelfCheck::checkFrameEncodings(
+    const VtModel& before,
+    const TermState& state,
+    std::mt19937& rng,
+    std::string* outError
+) {
+    TerminalController& term = TerminalController::getInstance();
+    Canvas& canvas = Canvas::getInstance();
+    std::pair<size_t, size_t> cellCount = canvas.getCellCount();
+    using Encoding = std::function<size_t(TermState&, std::string*)>;
+    auto forEachRow = [&cellCount](const std::function<size_t(size_t)>& encodeRow) {
+        size_t cost = 0;
+        for (size_t row = 0; row < cellCount.second; row++) {
+            cost += encodeRow(row);
+        }
+        return cost;
+    };
+    const std::pair<const char*, Encoding> encodings[] = {
+        { "Full frame", [&](TermState& s, std::string* out) {
+            return canvas.encodeFullFrame(s, out);
+        } },
+        { "Row diff", [&](TermState& s, std::string* out) {
+            return forEachRow([&](size_t row) { return canvas.encodeRow(row, s, out); });
+        } },
+        { "Cell diff", [&](TermState& s, std::string* out) {
+            return forEachRow([&](size_t row) { return canvas.encodeRowCells(row, false, s, out); });
+        } },
+        { "Rewrite", [&](TermState& s, std::string* out) {
+            return forEachRow([&](size_t row) { return canvas.rewriteRow(row, s, out); });
+        } },
+    };
+
+    VtModel vt = before;
+    TermState vtState = state;
+    for (const std::pair<const char*, Encoding>& encoding : encodings) {
+        TermState pricedState = state;
+        size_t price = encoding.second(pricedState, nullptr);
+        TermState encodedState = state;
+        std::string out;
+        size_t cost = encoding.second(encodedState, &out);
+        if (price != cost || cost != out.size()) {
+            *outError = std::string(encoding.first) + " is priced at " + std::to_string(price)
+                + " bytes, counts " + std::to_string(cost) + " and writes " + std::to_string(out.size());
+            return false;
+        }
+        // NOTE: endDrawing writes message text over the cells last, diffs
+        // leave the cells under it alone. Only its glyphs are checked.
+        for (const TextSpan& span : canvas.getTextSpans()) {
+            out += CSI + std::to_string(span.y) + ";" + std::to_string(span.x) + "H" + span.text;
+            encodedState.cursorX = -1;
+            encodedState.cursorY = -1;
+        }
+        vt = before;
+        vt.feed(out);
+        std::string error = vt.getError();
+        if (error.empty()) {
+            checkScreen(vt, &error);
+        }
+        if (!error.empty()) {
+            *outError = std::string(encoding.first) + ": " + error;
+            return false;
+        }
+        vtState = encodedState;
+    }
+
+    TermState rowState = state;
+    for (size_t row = 0; row < cellCount.second; row++) {
+        TermState diffState = rowState;
+        TermState rewriteState = rowState;
+        size_t diffCost = canvas.encodeRowCells(row, false, diffState, nullptr);
+        size_t rewriteCost = canvas.rewriteRow(row, rewriteState, nullptr);
+        size_t cost = canvas.encodeRow(row, rowState, nullptr);
+        if (diffCost > 0 && cost > std::min(diffCost, rewriteCost)) {
+            *outError = "Row " + std::to_string(row) + " takes " + std::to_string(cost)
+                + " bytes, a diff takes " + std::to_string(diffCost)
+                + " and a rewrite " + std::to_string(rewriteCost);
+            return false;
+        }
+    }
+
+    for (int i = 0; i < SELF_CHECK_CELLS; i++) {
+        size_t col = std::uniform_int_distribution<size_t>(0, cellCount.first - 1)(rng);
+        size_t row = std::uniform_int_distribution<size_t>(0, cellCount.second - 1)(rng);
+        std::string out;
+        term.writeMove(vtState, static_cast<int>(col), static_cast<int>(row), &out);
+        size_t moveSize = out.size();
+        TermState pricedState = vtState;
+        size_t price = canvas.encodeCell(col, row, pricedState, nullptr);
+        size_t cost = canvas.encodeCell(col, row, vtState, &out);
+        std::string where = "Cell " + std::to_string(col) + "," + std::to_string(row);
+        if (price != cost || cost != out.size() - moveSize) {
+            *outError = where + " is priced at " + std::to_string(price) + " bytes, counts "
+                + std::to_string(cost) + " and writes " + std::to_string(out.size() - moveSize);
+            return false;
+        }
+        vt.feed(out);
+        std::string error = vt.getError();
+        if (error.empty()) {
+            checkCell(vt, col, row, &error);
+        }
+        if (!error.empty()) {
+            *outError = where + " on its own: " + error;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Compares what the terminal model shows with what the last frame should look
+// like. Cells count as equal when their pixels end up the same color, no
+// matter which glyph or colors drew them.
+bool SelfCheck::checkScreen(const VtModel& vt, std::string* outError) {
+    const Canvas& canvas = Canvas::getInstance();
+    std::pair<size_t, size_t> cellCount = canvas.getCellCount();
+    size_t colCount = cellCount.first;
+    size_t rowCount = cellCount.second;
+    std::pair<int, int> vtSize = vt.getSize();
+    if (static_cast<size_t>(vtSize.first) != colCount || static_cast<size_t>(vtSize.second) != rowCount) {
+        *outError = "Screen is " + std::to_string(vtSize.first) + "x" + std::to_string(vtSize.second)
+            + " but the canvas has " + std::to_string(colCount) + "x" + std::to_string(rowCount) + " cells";
+        return false;
+    }
+
+    std::vector<char> texts(colCount * rowCount, '\0');
+    for (const TextSpan& span : canvas.getTextSpans()) {
+        size_t row = static_cast<size_t>(span.y - 1);
+        for (size_t i = 0; i < span.text.size() && row < rowCount; i++) {
+            size_t col = static_cast<size_t>(span.x - 1) + i;
+            if (col < colCount) {
+                texts.at(col + row * colCount) = span.text.at(i);
+            }
+        }
+    }
+
+    for (size_t row = 0; row < rowCount; row++) {
+        for (size_t col = 0; col < colCount; col++) {
+            const VtCell& cell = vt.getCell(static_cast<int>(col), static_cast<int>(row));
+            char text = texts.at(col + row * colCount);
+            if (text == '\0' && canvas.m_backend != RenderBackend::CELLS) {
+                if (cell.glyph != " ") {
+                    *outError = "Cell " + std::to_string(col) + "," + std::to_string(row)
+                        + " shows `" + cell.glyph + "` over the image";
+                    return false;
+                }
+            }
+            else if (text == '\0') {
+                if (!checkCell(vt, col, row, outError)) {
+                    return false;
+                }
+            }
+            else if (cell.glyph != std::string(1, text)) {
+                *outError = "Cell " + std::to_string(col) + "," + std::to_string(row)
+                    + " shows `" + cell.glyph + "` instead of text `" + text + "`";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool SelfCheck::checkCell(const VtModel& vt, size_t col, size_t row, std::string* outError) {
+    const Canvas& canvas = Canvas::getInstance();
+    const VtCell& cell = vt.getCell(static_cast<int>(col), static_cast<int>(row));
+    std::string where = "Cell " + std::to_string(col) + "," + std::to_string(row);
+    CellColors shown;
+    if (!canvas.readCellColors(cell.glyph, cell.fg, cell.bg, cell.isReversed, &shown)) {
+        *outError = where + " shows unknown glyph `" + cell.glyph + "`";
+        return false;
+    }
+    CellColors expected = canvas.getExpectedColors(col, row);
+    bool isEqual = shown.mask == expected.mask && shown.eighths == expected.eighths
+        && shown.restColor == expected.restColor
+        && (shown.isUniform() || shown.maskColor == expected.maskColor);
+    if (!isEqual) {
+        *outError = where + " shows `" + cell.glyph + "` in the wrong colors";
+        return false;
+    }
+    return true;
+}
+
+// Each image has to cover whole cells, not overlap another one and show the
+// canvas pixels under it scaled up by a whole step. Cells without an image
+// have to be blank.
+bool SelfCheck::checkKittyTiles(
+    const KittyModel& kitty,
+    const Image& canvas,
+    std::pair<size_t, size_t> cellSize,
+    std::string* outError
+) {
+    size_t colCount = canvas.getWidth() / cellSize.first;
+    size_t rowCount = canvas.getHeight() / cellSize.second;
+    std::vector<bool> coveredCells(colCount * rowCount, false);
+    for (const auto& entry : kitty.getImages()) {
+        const KittyImage& img = entry.second;
+        std::string name = "Image " + std::to_string(entry.first);
+        size_t col = static_cast<size_t>(img.col);
+        size_t row = static_cast<size_t>(img.row);
+        if (col + img.cols > colCount || row + img.rows > rowCount) {
+            *outError = name + " reaches past the screen";
+            return false;
+        }
+        size_t scale = img.width / (img.cols * cellSize.first);
+        if (scale == 0 || img.width != img.cols * cellSize.first * scale
+            || img.height != img.rows * cellSize.second * scale) {
+            *outError = name + " isn't its cells scaled up by a whole step";
+            return false;
+        }
+        for (size_t y = row; y < row + img.rows; y++) {
+            for (size_t x = col; x < col + img.cols; x++) {
+                if (coveredCells.at(x + y * colCount)) {
+                    *outError = name + " overlaps another one at cell "
+                        + std::to_string(x) + "," + std::to_string(y);
+                    return false;
+                }
+                coveredCells.at(x + y * colCount) = true;
+            }
+        }
+
+        for (size_t y = 0; y < img.height; y++) {
+            for (size_t x = 0; x < img.width; x++) {
+                const uint8_t* px = &img.rgba.at((x + y * img.width) * 4);
+                size_t canvasX = col * cellSize.first + x / scale;
+                size_t canvasY = row * cellSize.second + y / scale;
+                Color c = canvas.getPixel(canvasX, canvasY);
+                bool isEqual = c.a
+                    ? px[0] == c.r && px[1] == c.g && px[2] == c.b && px[3] == 255
+                    : px[3] == 0;
+                if (!isEqual) {
+                    *outError = name + " differs from the canvas at pixel "
+                        + std::to_string(canvasX) + "," + std::to_string(canvasY);
+                    return false;
+                }
+            }
+        }
+    }
+
+    for (size_t y = 0; y < canvas.getHeight(); y++) {
+        for (size_t x = 0; x < canvas.getWidth(); x++) {
+            if (canvas.getPixel(x, y).a && !coveredCells.at(x / cellSize.first + y / cellSize.second * colCount)) {
+                *outError = "No image shows pixel " + std::to_string(x) + "," + std::to_string(y);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Colors come from a small set so that neighbouring cells often match, a
+// quarter of the rectangles are transparent. Some are noise instead, so that
+// not everything compresses to a few runs.
+void SelfCheck::drawRandomRects(Image& img, std::mt19937& rng) {
+    auto randInt = [&rng](int min, int max) {
+        return std::uniform_int_distribution<int>(min, max)(rng);
+    };
+    int width = static_cast<int>(img.getWidth());
+    int height = static_cast<int>(img.getHeight());
+    int rectCount = randInt(0, SELF_CHECK_GRAPHICS_RECTS);
+    for (int i = 0; i < rectCount; i++) {
+        int x = randInt(-2, width);
+        int y = randInt(-2, height);
+        Color fill = randInt(0, 3) == 0
+            ? Color()
+            : Color(
+                static_cast<uint8_t>(randInt(0, 3) * 85),
+                static_cast<uint8_t>(randInt(0, 3) * 85),
+                static_cast<uint8_t>(randInt(0, 3) * 85)
+            );
+        size_t rectWidth = static_cast<size_t>(randInt(1, width));
+        size_t rectHeight = static_cast<size_t>(randInt(1, height));
+        if (randInt(1, SELF_CHECK_NOISE_ODDS) != 1) {
+            img.fillRect(x, y, rectWidth, rectHeight, fill);
+            continue;
+        }
+        for (int pixelY = std::max(y, 0); pixelY < std::min<int>(y + rectHeight, height); pixelY++) {
+            for (int pixelX = std::max(x, 0); pixelX < std::min<int>(x + rectWidth, width); pixelX++) {
+                img.setPixel(pixelX, pixelY, Color(
+                    static_cast<uint8_t>(randInt(0, 255)),
+                    static_cast<uint8_t>(randInt(0, 255)),
+                    static_cast<uint8_t>(randInt(0, 255))
+                ));
+            }
+        }
+    }
+}
+
+std::vector<bool> SelfCheck::getDirtyCells(
+    const Image& prev,
+    const Image& curr,
+    std::pair<size_t, size_t> cellSize
+) {
+    size_t colCount = curr.getWidth() / cellSize.first;
+    std::vector<bool> dirtyCells(colCount * (curr.getHeight() / cellSize.second), false);
+    for (size_t y = 0; y < curr.getHeight(); y++) {
+        for (size_t x = 0; x < curr.getWidth(); x++) {
+            if (!(prev.getPixel(x, y) == curr.getPixel(x, y))) {
+                dirtyCells.at(x / cellSize.first + y / cellSize.second * colCount) = true;
+            }
+        }
+    }
+    return dirtyCells;
+}
+
+// Cells of both screens have to be blank. Pixel by pixel the screens may
+// only differ in colors where one of them was quantized to the 256 color
+// palette, and each has to show the canvas.
+bool SelfCheck::checkSixelScreen(
+    const VtModel& vt,
+    const SixelModel& sixel,
+    const VtModel& fullVt,
+    const SixelModel& fullSixel,
+    const Image& canvas,
+    std::pair<size_t, size_t> cellSize,
+    std::string* outError
+) {
+    std::pair<int, int> size = vt.getSize();
+    for (int row = 0; row < size.second; row++) {
+        for (int col = 0; col < size.first; col++) {
+            const VtCell& cell = vt.getCell(col, row);
+            const VtCell& fullCell = fullVt.getCell(col, row);
+            if (cell.glyph != " " || cell.bg.kind != TermColor::DEFAULT
+                || fullCell.glyph != " " || fullCell.bg.kind != TermColor::DEFAULT) {
+                *outError = "Cell " + std::to_string(col) + "," + std::to_string(row) + " isn't blank";
+                return false;
+            }
+        }
+    }
+
+    std::pair<size_t, size_t> pixelSize = sixel.getPixelSize();
+    size_t cellWidth = pixelSize.first / size.first;
+    size_t cellHeight = pixelSize.second / size.second;
+    for (size_t y = 0; y < pixelSize.second; y++) {
+        size_t canvasY = y / cellHeight * cellSize.second + y % cellHeight * cellSize.second / cellHeight;
+        for (size_t x = 0; x < pixelSize.first; x++) {
+            size_t canvasX = x / cellWidth * cellSize.first + x % cellWidth * cellSize.first / cellWidth;
+            Color c = canvas.getPixel(canvasX, canvasY);
+            Color shown;
+            Color fullShown;
+            bool isImage = sixel.getPixel(vt, x, y, &shown);
+            bool isFullImage = fullSixel.getPixel(fullVt, x, y, &fullShown);
+            if (isImage != isFullImage || (isImage && !(shown == fullShown)
+                && !(isSixelColor(shown, c) && isSixelColor(fullShown, c)))) {
+                *outError = "Screen differs from a full redraw at pixel "
+                    + std::to_string(x) + "," + std::to_string(y);
+                return false;
+            }
+        }
+    }
+    return checkSixelPixels(vt, sixel, canvas, cellSize, outError)
+        && checkSixelPixels(fullVt, fullSixel, canvas, cellSize, outError);
+}
+
+// Pixels are compared with the canvas pixel SixelEncoder samples for them.
+// No image may show where the canvas is transparent, on the last row, or
+// under text, which is written after the images.
+bool SelfCheck::checkSixelPixels(
+    const VtModel& vt,
+    const SixelModel& sixel,
+    const Image& canvas,
+    std::pair<size_t, size_t> cellSize,
+    std::string* outError
+) {
+    std::pair<int, int> size = vt.getSize();
+    std::pair<size_t, size_t> pixelSize = sixel.getPixelSize();
+    size_t cellWidth = pixelSize.first / size.first;
+    size_t cellHeight = pixelSize.second / size.second;
+    size_t lastRowY = (size.second - 1) * cellHeight;
+    for (size_t y = 0; y < pixelSize.second; y++) {
+        size_t canvasY = y / cellHeight * cellSize.second + y % cellHeight * cellSize.second / cellHeight;
+        for (size_t x = 0; x < pixelSize.first; x++) {
+            size_t canvasX = x / cellWidth * cellSize.first + x % cellWidth * cellSize.first / cellWidth;
+            Color c = canvas.getPixel(canvasX, canvasY);
+            const VtCell& cell = vt.getCell(static_cast<int>(x / cellWidth), static_cast<int>(y / cellHeight));
+            bool isShown = c.a && y < lastRowY && cell.glyph == " ";
+            Color shown;
+            bool isImage = sixel.getPixel(vt, x, y, &shown);
+            if (isImage != isShown || (isImage && !isSixelColor(shown, c))) {
+                *outError = "Screen differs from the canvas at pixel "
+                    + std::to_string(x) + "," + std::to_string(y);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Whether a color sent in percent stands for the canvas color or, if the
+// image had too many colors, for its closest palette color
+bool SelfCheck::isSixelColor(Color shown, Color c) {
+    auto toPercent = [](Color color) {
+        return Color(
+            static_cast<uint8_t>((color.r * 100 + 127) / 255),
+            static_cast<uint8_t>((color.g * 100 + 127) / 255),
+            static_cast<uint8_t>((color.b * 100 + 127) / 255)
+        );
+    };
+    return shown == toPercent(c)
+        || shown == toPercent(ColorQuantizer::getPaletteColor(ColorQuantizer::to256(c)));
+}
+
+// NOTE: SixelEncoder falls back to the default size when the terminal doesn't
+// report one
+std::pair<size_t, size_t> SelfCheck::getSixelPixelSize(std::pair<int, int> cellPixelSize) {
+    if (cellPixelSize.first > 0 && cellPixelSize.second > 0) {
+        return std::pair<size_t, size_t>(cellPixelSize.first, cellPixelSize.second);
+    }
+    return std::pair<size_t, size_t>(SIXEL_DEFAULT_CELL_WIDTH, SIXEL_DEFAULT_CELL_HEIGHT);
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <string>
+#include <random>
+#include "arguments.hpp"
+#include "animation.hpp"
+#include "palette.hpp"
+#include "vtmodel.hpp"
+#include "kittymodel.hpp"
+#include "sixelmodel.hpp"
+
+#define SELF_CHECK_SEED         0x57415654u
+// Random frames each encoder draws, fewer when every way of encoding them
+// is checked too
+#define SELF_CHECK_FRAMES       100
+#define SELF_CHECK_COST_FRAMES  25
+#define SELF_CHECK_MIN_COLS     10
+#define SELF_CHECK_MAX_COLS     160
+#define SELF_CHECK_MIN_ROWS     4
+#define SELF_CHECK_MAX_ROWS     60
+// One frame in this many changes the terminal size
+#define SELF_CHECK_RESIZE_ODDS  16
+// One frame in this many switches to another scene
+#define SELF_CHECK_SCENE_ODDS   8
+// Largest offset and size in pixels of the rectangles in the scene that
+// doesn't move with the screen size
+#define SELF_CHECK_STILL_RECT_SIZE 40
+// Random flag columns each shading level is compared on
+#define SELF_CHECK_SHADE_COLUMNS 2000
+// Random cells encoded on their own after each frame by checkCostModel
+#define SELF_CHECK_CELLS        16
+// Random frames the fixed point flag is compared to the float one on
+#define SELF_CHECK_FIXED_FRAMES  500
+// Random frames the graphics encoders send on their own, and the largest
+// screen they send them to
+#define SELF_CHECK_GRAPHICS_FRAMES   200
+#define SELF_CHECK_GRAPHICS_MAX_COLS 40
+#define SELF_CHECK_GRAPHICS_MAX_ROWS 20
+// Most rectangles drawn over the last frame to get the next one
+#define SELF_CHECK_GRAPHICS_RECTS    4
+// One rectangle in this many is noise
+#define SELF_CHECK_NOISE_ODDS        4
+
+// A way of encoding the canvas the self-check runs through
+struct SelfCheckEncoder {
+    const char* name;
+    GlyphMode glyphMode;
+    ColorMode colorMode;
+    bool smoothEdges;
+    bool dither;
+    int diffThreshold;
+    bool hasREPAndECH;
+    RenderBackend backend;
+};
+
+// Checks for wavet_tests, each returns false with a message on the first
+// difference. checkEncoders draws random scenes with every encoder into a
+// headless terminal, replays the output in a VtModel, and the images of the
+// graphics backends in a KittyModel or SixelModel, and checks after each frame
+// that the screen shows what the canvas holds, printing the bytes per frame
+// of each encoder. checkCostModel does the same for the cell encoders, and
+// also encodes each frame in every way the cost model picks from.
+// checkShading compares every shading level the CPU has, for plain and
+// indexed images, with the scalar one. checkFixedPoint checks that the fixed
+// point flag is within a step of the float one. checkKitty sends random frames
+// with KittyEncoder and checks that the tiles a KittyModel ends up with show
+// the canvas. checkSixel does the same with SixelEncoder and a SixelModel, and
+// also checks that the screen looks the same as after a full redraw.
+class SelfCheck {
+public:
+    static bool checkEncoders(const AppConfig& conf, std::string* outError);
+    static bool checkCostModel(const AppConfig& conf, std::string* outError);
+    static bool checkShading(std::string* outError);
+    static bool checkFixedPoint(const AppConfig& conf, std::string* outError);
+    static bool checkKitty(std::string* outError);
+    static bool checkSixel(std::string* outError);
+private:
+    static bool runEncoder(
+        const AppConfig& conf,
+        const SelfCheckEncoder& encoder,
+        int frameCount,
+        bool isCheckingCostModel,
+        size_t* outBytes,
+        std::string* outError
+    );
+    static bool checkFrameEncodings(
+        const VtModel& before,
+        const TermState& state,
+        std::mt19937& rng,
+        std::string* outError
+    );
+    static bool checkScreen(const VtModel& vt, std::string* outError);
+    static bool checkCell(const VtModel& vt, size_t col, size_t row, std::string* outError);
+    static bool checkKittyTiles(
+        const KittyModel& kitty,
+        const Image& canvas,
+        std::pair<size_t, size_t> cellSize,
+        std::string* outError
+    );
+    static bool checkSixelScreen(
+        const VtModel& vt,
+        const SixelModel& sixel,
+        const VtModel& fullVt,
+        const SixelModel& fullSixel,
+        const Image& canvas,
+        std::pair<size_t, size_t> cellSize,
+        std::string* outError
+    );
+    static bool checkSixelPixels(
+        const VtModel& vt,
+        const SixelModel& sixel,
+        const Image& canvas,
+        std::pair<size_t, size_t> cellSize,
+        std::string* outError
+    );
+    static bool isSixelColor(Color shown, Color c);
+    static std::pair<size_t, size_t> getSixelPixelSize(std::pair<int, int> cellPixelSize);
+    static void drawRandomRects(Image& img, std::mt19937& rng);
+    static std::vector<bool> getDirtyCells(
+        const Image& prev,
+        const Image& curr,
+        std::pair<size_t, size_t> cellSize
+    );
+};
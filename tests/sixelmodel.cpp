@@ -0,0 +1,172 @@
+#include "sixelmodel.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define SIXEL_MODEL_BAND_HEIGHT 6
+
+SixelModel::SixelModel(std::pair<int, int> size, std::pair<size_t, size_t> cellPixelSize)
+    : m_pixels(size.first * cellPixelSize.first * size.second * cellPixelSize.second, SixelPixel { Color(), 0 })
+    , m_width(size.first * cellPixelSize.first), m_height(size.second * cellPixelSize.second)
+    , m_cellPixelSize(cellPixelSize) {}
+
+// Images are painted from the cell the cursor is in, a band of six pixel rows
+// at a time
+void SixelModel::feed(const VtString& str) {
+    size_t pos = str.data.find('q');
+    if (str.kind != 'P' || pos == std::string::npos) {
+        setError("Unexpected string that isn't a sixel image");
+        return;
+    }
+    std::vector<int> params;
+    if (readParams(str.data, 0, &params) != pos || params.size() != 3 || params.at(1) != 1) {
+        setError("Sixel image without a transparent background");
+        return;
+    }
+    pos++;
+    std::vector<int> raster;
+    if (pos < str.data.size() && str.data.at(pos) == '"') {
+        pos = readParams(str.data, pos + 1, &raster);
+    }
+    if (raster.size() != 4 || raster.at(0) != 1 || raster.at(1) != 1 || raster.at(2) <= 0 || raster.at(3) <= 0) {
+        setError("Sixel image without 1:1 pixels and a size");
+        return;
+    }
+    size_t imgWidth = static_cast<size_t>(raster.at(2));
+    size_t imgHeight = static_cast<size_t>(raster.at(3));
+    size_t originX = static_cast<size_t>(str.cursorX) * m_cellPixelSize.first;
+    size_t originY = static_cast<size_t>(str.cursorY) * m_cellPixelSize.second;
+    size_t rowsCovered = (imgHeight + m_cellPixelSize.second - 1) / m_cellPixelSize.second;
+    if (static_cast<size_t>(str.cursorY) + rowsCovered >= m_height / m_cellPixelSize.second) {
+        setError("Sixel image at row " + std::to_string(str.cursorY) + " reaches the last row and would scroll");
+        return;
+    }
+    if (originX + imgWidth > m_width) {
+        setError("Sixel image at column " + std::to_string(str.cursorX) + " reaches past the screen");
+        return;
+    }
+
+    std::vector<Color> registers(SIXEL_MODEL_REGISTERS);
+    std::vector<bool> isDefined(SIXEL_MODEL_REGISTERS, false);
+    int reg = -1;
+    size_t x = 0;
+    size_t bandY = 0;
+    while (pos < str.data.size()) {
+        char c = str.data.at(pos);
+        size_t count = 1;
+        if (c == '#') {
+            pos = readParams(str.data, pos + 1, &params);
+            if (params.empty() || params.at(0) < 0 || params.at(0) >= SIXEL_MODEL_REGISTERS) {
+                setError("Sixel register out of range");
+                return;
+            }
+            reg = params.at(0);
+            if (params.size() == 5 && params.at(1) == 2) {
+                if (*std::max_element(params.begin() + 2, params.end()) > 100) {
+                    setError("Sixel register " + std::to_string(reg) + " isn't in percent");
+                    return;
+                }
+                registers.at(reg) = Color(
+                    static_cast<uint8_t>(params.at(2)),
+                    static_cast<uint8_t>(params.at(3)),
+                    static_cast<uint8_t>(params.at(4))
+                );
+                isDefined.at(reg) = true;
+            }
+            else if (params.size() != 1) {
+                setError("Sixel register " + std::to_string(reg) + " isn't given as RGB");
+                return;
+            }
+            continue;
+        }
+        if (c == '$' || c == '-') {
+            x = 0;
+            bandY += c == '-' ? SIXEL_MODEL_BAND_HEIGHT : 0;
+            pos++;
+            continue;
+        }
+        if (c == '!') {
+            pos = readParams(str.data, pos + 1, &params);
+            if (params.size() != 1 || params.at(0) <= 0 || pos >= str.data.size()) {
+                setError("Malformed sixel repeat");
+                return;
+            }
+            count = static_cast<size_t>(params.at(0));
+            c = str.data.at(pos);
+        }
+        if (c < '?' || c > '~') {
+            setError("Unexpected character " + std::to_string(static_cast<int>(c)) + " in sixel data");
+            return;
+        }
+        pos++;
+
+        int bits = c - '?';
+        if (bits != 0 && (reg < 0 || !isDefined.at(reg))) {
+            setError("Sixel register " + std::to_string(reg) + " is used before the image defines it");
+            return;
+        }
+        for (size_t i = 0; i < count; i++, x++) {
+            for (size_t k = 0; k < SIXEL_MODEL_BAND_HEIGHT; k++) {
+                if ((bits & (1 << k)) == 0) {
+                    continue;
+                }
+                if (x >= imgWidth || bandY + k >= imgHeight) {
+                    setError("Sixel pixel " + std::to_string(x) + "," + std::to_string(bandY + k)
+                        + " is outside of the image");
+                    return;
+                }
+                SixelPixel& pixel = m_pixels.at(originX + x + (originY + bandY + k) * m_width);
+                pixel.color = registers.at(reg);
+                pixel.serial = str.serial;
+            }
+        }
+    }
+}
+
+bool SixelModel::getPixel(const VtModel& vt, size_t x, size_t y, Color* outColor) const {
+    const SixelPixel& pixel = m_pixels.at(x + y * m_width);
+    const VtCell& cell = vt.getCell(
+        static_cast<int>(x / m_cellPixelSize.first),
+        static_cast<int>(y / m_cellPixelSize.second)
+    );
+    if (pixel.serial == 0 || pixel.serial < cell.serial) {
+        return false;
+    }
+    *outColor = pixel.color;
+    return true;
+}
+
+std::pair<size_t, size_t> SixelModel::getPixelSize() const {
+    return std::pair<size_t, size_t>(m_width, m_height);
+}
+
+// Describes the first thing that couldn't be replayed, empty if all went well
+const std::string& SixelModel::getError() const {
+    return m_error;
+}
+
+void SixelModel::setError(const std::string& error) {
+    if (m_error.empty()) {
+        m_error = error;
+    }
+}
+
+// Reads numbers separated by semicolons, a missing one is 0. Returns the
+// position after them.
+size_t SixelModel::readParams(const std::string& data, size_t pos, std::vector<int>* outParams) {
+    outParams->assign(1, 0);
+    while (pos < data.size()) {
+        char c = data.at(pos);
+        if (c >= '0' && c <= '9') {
+            outParams->back() = std::min(outParams->back() * 10 + (c - '0'), 1 << 20);
+        }
+        else if (c == ';') {
+            outParams->push_back(0);
+        }
+        else {
+            break;
+        }
+        pos++;
+    }
+    return pos;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include "image.hpp"
+#include "vtmodel.hpp"
+
+#define SIXEL_MODEL_REGISTERS 256
+
+// A pixel painted by a sixel image, serial is the image's VtString serial
+// and 0 for pixels no image painted
+struct SixelPixel {
+    Color color;
+    uint64_t serial;
+};
+
+// Just enough of a sixel terminal to replay what SixelEncoder sends: images
+// with 1:1 pixels and transparent background, RGB registers, repeats and
+// bands. Each image has to define the registers it uses and may not reach
+// the last row, which would scroll. Anything else is recorded as an error.
+// Colors are kept in percent, as they are sent.
+class SixelModel {
+public:
+    SixelModel(std::pair<int, int> size, std::pair<size_t, size_t> cellPixelSize);
+
+    void feed(const VtString& str);
+    // Whether an image shows at the pixel, or the cell it is in because that
+    // was written later
+    bool getPixel(const VtModel& vt, size_t x, size_t y, Color* outColor) const;
+    std::pair<size_t, size_t> getPixelSize() const;
+    const std::string& getError() const;
+private:
+    std::vector<SixelPixel> m_pixels;
+    size_t m_width;
+    size_t m_height;
+    std::pair<size_t, size_t> m_cellPixelSize;
+    std::string m_error;
+
+    void setError(const std::string& error);
+    static size_t readParams(const std::string& data, size_t pos, std::vector<int>* outParams);
+};
@@ -0,0 +1,373 @@
+#include "vtmodel.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+
+VtCell::VtCell()
+    : glyph(" "), fg(TermColor::byDefault()), bg(TermColor::byDefault()), isReversed(false), serial(0) {}
+
+VtModel::VtModel(int width, int height)
+    : m_cells(static_cast<size_t>(width) * height), m_width(width), m_height(height)
+    , m_cursorX(0), m_cursorY(0), m_isWrapPending(false), m_fg(TermColor::byDefault())
+    , m_bg(TermColor::byDefault()), m_isReversed(false), m_serial(0) {}
+
+// Like a terminal in the alternate screen, what fits stays where it is and
+// new cells are blank. Getting shorter scrolls the cursor's row onto the
+// screen. A new width reflows lines, which isn't modeled beyond every cell
+// being left with something in it.
+void VtModel::resize(int width, int height) {
+    for (int y = m_cursorY; y >= height; y--) {
+        scrollUp();
+        m_cursorY--;
+    }
+    std::vector<VtCell> cells(static_cast<size_t>(width) * height);
+    for (int y = 0; y < std::min(height, m_height); y++) {
+        for (int x = 0; x < std::min(width, m_width); x++) {
+            cells.at(x + y * width) = m_cells.at(x + y * m_width);
+        }
+    }
+    if (width != m_width) {
+        m_serial++;
+        for (VtCell& cell : cells) {
+            cell.glyph = "?";
+            cell.serial = m_serial;
+        }
+    }
+    m_cells.swap(cells);
+    m_width = width;
+    m_height = height;
+    m_cursorX = std::min(m_cursorX, width - 1);
+    m_cursorY = std::min(m_cursorY, height - 1);
+    m_isWrapPending = false;
+}
+
+void VtModel::feed(const std::string& bytes) {
+    size_t pos = 0;
+    while (pos < bytes.size()) {
+        unsigned char c = static_cast<unsigned char>(bytes.at(pos));
+        if (c == 0x1B) {
+            char next = pos + 1 < bytes.size() ? bytes.at(pos + 1) : '\0';
+            if (next == '[') {
+                pos = feedCSI(bytes, pos + 2);
+            }
+            else if (next == 'P' || next == '_' || next == ']') {
+                pos = feedString(bytes, next, pos + 2);
+            }
+            else {
+                if (m_error.empty()) {
+                    m_error = "Unsupported escape sequence ESC " + std::string(1, next);
+                }
+                pos += 2;
+            }
+            continue;
+        }
+        if (c == '\r') {
+            m_cursorX = 0;
+            m_isWrapPending = false;
+            pos++;
+            continue;
+        }
+        if (c == '\n') {
+            if (m_cursorY == m_height - 1) {
+                scrollUp();
+            }
+            else {
+                m_cursorY++;
+            }
+            m_isWrapPending = false;
+            pos++;
+            continue;
+        }
+        if (c < 0x20 || c == 0x7F) {
+            if (m_error.empty()) {
+                m_error = "Unexpected control character " + std::to_string(c);
+            }
+            pos++;
+            continue;
+        }
+
+        // NOTE: Bytes that aren't valid UTF-8 are taken as one character
+        // each, the Windows console code page is single byte
+        size_t len = 1;
+        if ((c & 0xE0) == 0xC0) {
+            len = 2;
+        }
+        else if ((c & 0xF0) == 0xE0) {
+            len = 3;
+        }
+        else if ((c & 0xF8) == 0xF0) {
+            len = 4;
+        }
+        for (size_t i = 1; i < len; i++) {
+            if (pos + i >= bytes.size() || (static_cast<unsigned char>(bytes.at(pos + i)) & 0xC0) != 0x80) {
+                len = 1;
+                break;
+            }
+        }
+        m_lastGlyph = bytes.substr(pos, len);
+        putGlyph(m_lastGlyph);
+        pos += len;
+    }
+}
+
+const VtCell& VtModel::getCell(int x, int y) const {
+    return m_cells.at(x + y * m_width);
+}
+
+std::pair<int, int> VtModel::getSize() const {
+    return std::pair<int, int>(m_width, m_height);
+}
+
+// Describes the first thing that couldn't be replayed, empty if all went well
+const std::string& VtModel::getError() const {
+    return m_error;
+}
+
+// Returns the DCS and APC strings fed since the last call
+std::vector<VtString> VtModel::takeStrings() {
+    std::vector<VtString> strings;
+    strings.swap(m_strings);
+    return strings;
+}
+
+// Returns the position after the sequence
+size_t VtModel::feedCSI(const std::string& bytes, size_t pos) {
+    size_t start = pos;
+    bool isPrivate = pos < bytes.size() && std::string("?<=>").find(bytes.at(pos)) != std::string::npos;
+    if (isPrivate) {
+        pos++;
+    }
+    std::vector<int> params;
+    int param = -1;
+    bool hasIntermediate = false;
+    while (pos < bytes.size()) {
+        char c = bytes.at(pos);
+        if (c >= '0' && c <= '9') {
+            param = (param < 0 ? 0 : param * 10) + (c - '0');
+        }
+        else if (c == ';') {
+            params.push_back(param);
+            param = -1;
+        }
+        else if (c >= 0x20 && c <= 0x2F) {
+            hasIntermediate = true;
+        }
+        else {
+            break;
+        }
+        pos++;
+    }
+    if (pos >= bytes.size()) {
+        if (m_error.empty()) {
+            m_error = "Unterminated CSI sequence";
+        }
+        return pos;
+    }
+    params.push_back(param);
+    char final = bytes.at(pos++);
+    if (isPrivate || hasIntermediate) {
+        return pos;
+    }
+
+    // Missing parameters and 0 mean 1 for movement
+    int count = std::max(params.front(), 1);
+    switch (final) {
+    case 'H':
+    case 'f':
+        m_cursorY = std::clamp(count, 1, m_height) - 1;
+        m_cursorX = std::clamp(params.size() > 1 ? std::max(params.at(1), 1) : 1, 1, m_width) - 1;
+        break;
+    case 'A':
+        m_cursorY = std::max(m_cursorY - count, 0);
+        break;
+    case 'B':
+        m_cursorY = std::min(m_cursorY + count, m_height - 1);
+        break;
+    case 'C':
+        m_cursorX = std::min(m_cursorX + count, m_width - 1);
+        break;
+    case 'D':
+        m_cursorX = std::max(m_cursorX - count, 0);
+        break;
+    case 'G':
+        m_cursorX = std::min(count, m_width) - 1;
+        break;
+    case 'J':
+        if (params.front() == 2 || params.front() == 3) {
+            eraseCells(0, 0, m_width * m_height);
+        }
+        else if (params.front() == 1) {
+            eraseCells(0, 0, m_cursorX + 1 + m_cursorY * m_width);
+        }
+        else {
+            eraseCells(m_cursorX, m_cursorY, m_width * m_height);
+        }
+        break;
+    case 'K':
+        if (params.front() == 2) {
+            eraseCells(0, m_cursorY, m_width);
+        }
+        else if (params.front() == 1) {
+            eraseCells(0, m_cursorY, m_cursorX + 1);
+        }
+        else {
+            eraseCells(m_cursorX, m_cursorY, m_width - m_cursorX);
+        }
+        break;
+    case 'X':
+        eraseCells(m_cursorX, m_cursorY, std::min(count, m_width - m_cursorX));
+        break;
+    case 'b':
+        if (m_lastGlyph.empty()) {
+            if (m_error.empty()) {
+                m_error = "REP without a character to repeat";
+            }
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            putGlyph(m_lastGlyph);
+        }
+        return pos;
+    case 'm':
+        applySGR(params);
+        return pos;
+    case 'c':
+    case 'n':
+    case 't':
+        return pos;
+    default:
+        if (m_error.empty()) {
+            m_error = "Unsupported CSI sequence `" + bytes.substr(start, pos - start) + "`";
+        }
+        return pos;
+    }
+    m_isWrapPending = false;
+    return pos;
+}
+
+// DCS, OSC and APC strings end with ST or, for OSC, with BEL. OSC strings
+// aren't kept.
+size_t VtModel::feedString(const std::string& bytes, char kind, size_t pos) {
+    size_t start = pos;
+    while (pos < bytes.size()) {
+        size_t end = pos;
+        if (bytes.at(pos) == '\a') {
+            pos++;
+        }
+        else if (bytes.at(pos) == 0x1B && pos + 1 < bytes.size() && bytes.at(pos + 1) == '\\') {
+            pos += 2;
+        }
+        else {
+            pos++;
+            continue;
+        }
+        if (kind != ']') {
+            m_strings.push_back(VtString {
+                kind, bytes.substr(start, end - start), m_cursorX, m_cursorY, ++m_serial
+            });
+        }
+        return pos;
+    }
+    if (m_error.empty()) {
+        m_error = "Unterminated string sequence";
+    }
+    return pos;
+}
+
+void VtModel::applySGR(const std::vector<int>& params) {
+    for (size_t i = 0; i < params.size(); i++) {
+        int p = std::max(params.at(i), 0);
+        if (p == 0) {
+            m_fg = TermColor::byDefault();
+            m_bg = TermColor::byDefault();
+            m_isReversed = false;
+        }
+        else if (p == 7 || p == 27) {
+            m_isReversed = p == 7;
+        }
+        else if (p == 39 || p == 49) {
+            (p == 39 ? m_fg : m_bg) = TermColor::byDefault();
+        }
+        else if ((p >= 30 && p <= 37) || (p >= 90 && p <= 97)
+            || (p >= 40 && p <= 47) || (p >= 100 && p <= 107)) {
+            TermColor c;
+            c.kind = TermColor::INDEXED;
+            c.idx = static_cast<uint8_t>(p % 10 + (p >= 90 ? 8 : 0));
+            (p < 40 || (p >= 90 && p < 100) ? m_fg : m_bg) = c;
+        }
+        else if ((p == 38 || p == 48) && i + 2 < params.size() && params.at(i + 1) == 5) {
+            TermColor c;
+            c.kind = TermColor::INDEXED;
+            c.idx = static_cast<uint8_t>(params.at(i + 2));
+            (p == 38 ? m_fg : m_bg) = c;
+            i += 2;
+        }
+        else if ((p == 38 || p == 48) && i + 4 < params.size() && params.at(i + 1) == 2) {
+            TermColor c;
+            c.kind = TermColor::RGB;
+            c.rgb = Color(
+                static_cast<uint8_t>(params.at(i + 2)),
+                static_cast<uint8_t>(params.at(i + 3)),
+                static_cast<uint8_t>(params.at(i + 4))
+            );
+            (p == 38 ? m_fg : m_bg) = c;
+            i += 4;
+        }
+        else {
+            if (m_error.empty()) {
+                m_error = "Unsupported SGR parameter " + std::to_string(p);
+            }
+            return;
+        }
+    }
+}
+
+// Writing to the last column leaves the cursor there until the next glyph,
+// which then goes to the start of the next line
+void VtModel::putGlyph(const std::string& glyph) {
+    if (m_isWrapPending) {
+        m_cursorX = 0;
+        if (m_cursorY == m_height - 1) {
+            scrollUp();
+        }
+        else {
+            m_cursorY++;
+        }
+        m_isWrapPending = false;
+    }
+    VtCell& cell = m_cells.at(m_cursorX + m_cursorY * m_width);
+    cell.glyph = glyph;
+    cell.fg = m_fg;
+    cell.bg = m_bg;
+    cell.isReversed = m_isReversed;
+    cell.serial = ++m_serial;
+    if (m_cursorX == m_width - 1) {
+        m_isWrapPending = true;
+    }
+    else {
+        m_cursorX++;
+    }
+}
+
+// NOTE: Graphics don't scroll along in the models, the new line is newer
+// than any of them
+void VtModel::scrollUp() {
+    m_cells.erase(m_cells.begin(), m_cells.begin() + m_width);
+    m_cells.resize(m_cells.size() + m_width);
+    m_serial++;
+    for (size_t i = m_cells.size() - m_width; i < m_cells.size(); i++) {
+        m_cells.at(i).serial = m_serial;
+    }
+}
+
+// Erased cells take the current background, reverse video doesn't apply
+void VtModel::eraseCells(int x, int y, int count) {
+    size_t start = static_cast<size_t>(x + y * m_width);
+    size_t end = std::min(m_cells.size(), start + std::max(count, 0));
+    m_serial++;
+    for (size_t i = start; i < end; i++) {
+        m_cells.at(i) = VtCell();
+        m_cells.at(i).bg = m_bg;
+        m_cells.at(i).serial = m_serial;
+    }
+}
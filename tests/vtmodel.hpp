@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "terminal.hpp"
+
+// A cell as the terminal holds it, glyph is the UTF-8 bytes of one character.
+// serial tells when it was last written or erased, see VtString.
+struct VtCell {
+    std::string glyph;
+    TermColor fg;
+    TermColor bg;
+    bool isReversed;
+    uint64_t serial;
+
+    VtCell();
+};
+
+// A DCS or APC string as it was sent, for the graphics models to replay.
+// kind is the character after ESC, data what comes before ST, and the cursor
+// is where the string was sent at. Strings and cell writes share a counter
+// for serial, so a graphics model can tell whether its pixels were drawn
+// before or after the text cells they are under.
+struct VtString {
+    char kind;
+    std::string data;
+    int cursorX;
+    int cursorY;
+    uint64_t serial;
+};
+
+// Just enough of a terminal to replay what we send: cursor movement, erasing,
+// REP, SGR colors and reverse video, and UTF-8 text that is one cell wide.
+// Mode switches and queries are skipped, DCS and APC strings are kept for
+// takeStrings, anything else is recorded as an error. Used to check the
+// encoders without a real terminal.
+class VtModel {
+public:
+    VtModel(int width, int height);
+
+    void resize(int width, int height);
+    void feed(const std::string& bytes);
+    const VtCell& getCell(int x, int y) const;
+    std::pair<int, int> getSize() const;
+    const std::string& getError() const;
+    std::vector<VtString> takeStrings();
+private:
+    std::vector<VtCell> m_cells;
+    int m_width;
+    int m_height;
+    int m_cursorX;
+    int m_cursorY;
+    bool m_isWrapPending;
+    TermColor m_fg;
+    TermColor m_bg;
+    bool m_isReversed;
+    std::string m_lastGlyph;
+    std::string m_error;
+    std::vector<VtString> m_strings;
+    uint64_t m_serial;
+
+    size_t feedCSI(const std::string& bytes, size_t pos);
+    size_t feedString(const std::string& bytes, char kind, size_t pos);
+    void applySGR(const std::vector<int>& params);
+    void putGlyph(const std::string& glyph);
+    void eraseCells(int x, int y, int count);
+    void scrollUp();
+};
@@ -0,0 +1,407 @@
+// Runs wavet on a pseudo-terminal whose reading end behaves like a slow link,
+// to see how wavet copes without a real SSH session. Bytes leave the pty only
+// as fast as the link's rate allows and reach the "screen" after its latency.
+// A bounded link buffer makes the pty back up when the link can't keep up,
+// the same pressure a real slow terminal puts on TerminalController::flush.
+//
+// Frames are told apart by their synchronized update markers, so the
+// capability probe is answered right away as a terminal that has them.
+// Linux only.
+#include <pty.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <iomanip>
+
+#define PTYSIM_FRAME_BEGIN   "\x1b[?2026h"
+#define PTYSIM_FRAME_END     "\x1b[?2026l"
+#define PTYSIM_PROBE_END     "\x1b[c"
+#define PTYSIM_PROBE_REPLY   "\x1b[?2026;2$y\x1b[?62;22c"
+#define PTYSIM_TICK_MS       1
+// The link sends at most this much time worth of its rate at once
+#define PTYSIM_BURST_SEC     0.01
+#define PTYSIM_DRAIN_SEC     2.0
+#define PTYSIM_READ_SIZE     4096
+
+struct SimConfig {
+    double rate;
+    double latency;
+    size_t bufferSize;
+    double duration;
+    int fps;
+    unsigned short cols;
+    unsigned short rows;
+    std::vector<char*> command;
+};
+
+// Finds a byte sequence in a stream that arrives in pieces. The patterns
+// start with ESC, which doesn't appear in them again.
+struct StreamMatcher {
+    std::string pattern;
+    size_t matchedLen;
+
+    StreamMatcher(const char* pattern);
+    bool feed(char c);
+};
+
+// Bytes read from the pty, waiting to cross the link
+struct LinkChunk {
+    std::string bytes;
+    size_t offset;
+    int64_t arrivalNs;
+};
+
+class PtySim {
+public:
+    PtySim(const SimConfig& conf);
+    bool run();
+    void printReport() const;
+private:
+    SimConfig m_conf;
+    int m_masterFd;
+    pid_t m_childPid;
+    std::deque<LinkChunk> m_link;
+    size_t m_linkSize;
+    double m_credit;
+    int64_t m_startNs;
+    int64_t m_lastTickNs;
+    StreamMatcher m_probeMatcher;
+    StreamMatcher m_beginMatcher;
+    StreamMatcher m_endMatcher;
+    int64_t m_frameArrivalNs;
+    size_t m_frameBytes;
+    int64_t m_firstFrameNs;
+    int64_t m_interruptNs;
+    std::vector<int64_t> m_frameEndNs;
+    std::vector<int64_t> m_lagsNs;
+    std::vector<size_t> m_frameSizes;
+    size_t m_totalBytes;
+
+    static int64_t getNowNs();
+    bool spawn(const std::string& cacheDir);
+    void readPty(int64_t nowNs);
+    void deliver(int64_t nowNs);
+};
+
+StreamMatcher::StreamMatcher(const char* pattern)
+    : pattern(pattern), matchedLen(0) {}
+
+bool StreamMatcher::feed(char c) {
+    if (c == pattern.at(matchedLen)) {
+        matchedLen++;
+        if (matchedLen == pattern.size()) {
+            matchedLen = 0;
+            return true;
+        }
+        return false;
+    }
+    matchedLen = c == pattern.front() ? 1 : 0;
+    return false;
+}
+
+PtySim::PtySim(const SimConfig& conf)
+    : m_conf(conf), m_masterFd(-1), m_childPid(-1), m_linkSize(0), m_credit(0)
+    , m_startNs(0), m_lastTickNs(0), m_probeMatcher(PTYSIM_PROBE_END)
+    , m_beginMatcher(PTYSIM_FRAME_BEGIN), m_endMatcher(PTYSIM_FRAME_END)
+    , m_frameArrivalNs(-1), m_frameBytes(0), m_firstFrameNs(-1), m_interruptNs(-1)
+    , m_totalBytes(0) {}
+
+int64_t PtySim::getNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+// NOTE: wavet caches probed capabilities, a private cache directory keeps the
+// user's cache out of it
+bool PtySim::spawn(const std::string& cacheDir) {
+    struct winsize ws;
+    memset(&ws, 0, sizeof(ws));
+    ws.ws_col = m_conf.cols;
+    ws.ws_row = m_conf.rows;
+    m_childPid = forkpty(&m_masterFd, nullptr, nullptr, &ws);
+    if (m_childPid < 0) {
+        std::cout << "ERROR: Couldn't open a pseudo-terminal: " << strerror(errno) << "\n";
+        return false;
+    }
+    if (m_childPid == 0) {
+        setenv("XDG_CACHE_HOME", cacheDir.c_str(), 1);
+        setenv("TERM", "xterm-256color", 1);
+        m_conf.command.push_back(nullptr);
+        execvp(m_conf.command.front(), m_conf.command.data());
+        std::cout << "ERROR: Couldn't run " << m_conf.command.front() << ": " << strerror(errno) << "\n";
+        _exit(127);
+    }
+    return true;
+}
+
+bool PtySim::run() {
+    char cacheTemplate[] = "/tmp/ptysim-XXXXXX";
+    if (mkdtemp(cacheTemplate) == nullptr) {
+        std::cout << "ERROR: Couldn't create a cache directory: " << strerror(errno) << "\n";
+        return false;
+    }
+    std::string cacheDir = cacheTemplate;
+    if (!spawn(cacheDir)) {
+        std::filesystem::remove_all(cacheDir);
+        return false;
+    }
+
+    m_startNs = getNowNs();
+    m_lastTickNs = m_startNs;
+    bool hasExited = false;
+    int status = 0;
+    while (true) {
+        int64_t nowNs = getNowNs();
+        if (m_interruptNs < 0 && nowNs - m_startNs >= m_conf.duration * 1e9) {
+            kill(m_childPid, SIGINT);
+            m_interruptNs = nowNs;
+        }
+        if (m_interruptNs >= 0 && nowNs - m_interruptNs >= PTYSIM_DRAIN_SEC * 1e9) {
+            break;
+        }
+        if (!hasExited && waitpid(m_childPid, &status, WNOHANG) == m_childPid) {
+            hasExited = true;
+        }
+        if (hasExited && m_masterFd < 0 && m_link.empty()) {
+            break;
+        }
+
+        // Reading stops while the link is full, then the pty fills up and
+        // wavet's writes start failing
+        struct pollfd pfd;
+        pfd.fd = m_masterFd;
+        pfd.events = m_linkSize < m_conf.bufferSize ? POLLIN : 0;
+        if (m_masterFd >= 0 && pfd.events != 0) {
+            poll(&pfd, 1, PTYSIM_TICK_MS);
+            if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+                readPty(getNowNs());
+            }
+        }
+        else {
+            usleep(PTYSIM_TICK_MS * 1000);
+        }
+        deliver(getNowNs());
+    }
+
+    if (!hasExited) {
+        kill(m_childPid, SIGKILL);
+        waitpid(m_childPid, &status, 0);
+    }
+    if (m_masterFd >= 0) {
+        close(m_masterFd);
+    }
+    std::filesystem::remove_all(cacheDir);
+    return true;
+}
+
+void PtySim::readPty(int64_t nowNs) {
+    char buff[PTYSIM_READ_SIZE];
+    size_t space = std::min<size_t>(sizeof(buff), m_conf.bufferSize - m_linkSize);
+    ssize_t got = read(m_masterFd, buff, space);
+    if (got <= 0) {
+        // NOTE: Linux reports a closed slave side as EIO
+        if (got == 0 || errno != EINTR) {
+            close(m_masterFd);
+            m_masterFd = -1;
+        }
+        return;
+    }
+    for (ssize_t i = 0; i < got; i++) {
+        if (m_probeMatcher.feed(buff[i])) {
+            ssize_t written = write(m_masterFd, PTYSIM_PROBE_REPLY, strlen(PTYSIM_PROBE_REPLY));
+            (void)written;
+        }
+    }
+    m_link.push_back(LinkChunk{ std::string(buff, got), 0, nowNs });
+    m_linkSize += got;
+}
+
+// Sends what the rate allows of the bytes that have been on the link for at
+// least the latency
+void PtySim::deliver(int64_t nowNs) {
+    m_credit = std::min(
+        m_credit + m_conf.rate * (nowNs - m_lastTickNs) / 1e9,
+        std::max(m_conf.rate * PTYSIM_BURST_SEC, 1.0)
+    );
+    m_lastTickNs = nowNs;
+    while (!m_link.empty() && m_credit >= 1) {
+        LinkChunk& chunk = m_link.front();
+        if (nowNs - chunk.arrivalNs < m_conf.latency * 1e9) {
+            break;
+        }
+        size_t count = std::min(static_cast<size_t>(m_credit), chunk.bytes.size() - chunk.offset);
+        for (size_t i = chunk.offset; i < chunk.offset + count; i++) {
+            m_frameBytes++;
+            if (m_beginMatcher.feed(chunk.bytes.at(i))) {
+                m_frameArrivalNs = chunk.arrivalNs;
+                m_frameBytes = strlen(PTYSIM_FRAME_BEGIN);
+                if (m_firstFrameNs < 0) {
+                    m_firstFrameNs = chunk.arrivalNs;
+                }
+            }
+            if (m_endMatcher.feed(chunk.bytes.at(i)) && m_frameArrivalNs >= 0) {
+                m_frameEndNs.push_back(nowNs);
+                m_lagsNs.push_back(nowNs - m_frameArrivalNs);
+                m_frameSizes.push_back(m_frameBytes);
+                m_frameArrivalNs = -1;
+            }
+        }
+        chunk.offset += count;
+        m_credit -= count;
+        m_totalBytes += count;
+        m_linkSize -= count;
+        if (chunk.offset == chunk.bytes.size()) {
+            m_link.pop_front();
+        }
+    }
+}
+
+// Frames wavet should have drawn are counted from its first frame until it
+// was interrupted, the ones that never showed up were dropped
+void PtySim::printReport() const {
+    size_t frameCount = m_frameEndNs.size();
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Link:               " << m_conf.rate / 1000 << " kB/s, "
+        << m_conf.latency * 1000 << " ms latency, " << m_conf.bufferSize << " byte buffer\n";
+    if (frameCount == 0) {
+        std::cout << "No frames arrived, is the command wavet?\n";
+        return;
+    }
+
+    int64_t endNs = m_interruptNs >= 0 ? m_interruptNs : getNowNs();
+    double activeSec = (endNs - m_firstFrameNs) / 1e9;
+    long expected = std::lround(activeSec * m_conf.fps);
+    size_t frameBytes = 0;
+    for (size_t size : m_frameSizes) {
+        frameBytes += size;
+    }
+    std::vector<int64_t> lags = m_lagsNs;
+    std::sort(lags.begin(), lags.end());
+    int64_t lagSumNs = 0;
+    for (int64_t lag : lags) {
+        lagSumNs += lag;
+    }
+    int64_t maxGapNs = 0;
+    for (size_t i = 1; i < frameCount; i++) {
+        maxGapNs = std::max(maxGapNs, m_frameEndNs.at(i) - m_frameEndNs.at(i - 1));
+    }
+    double spanSec = (m_frameEndNs.back() - m_frameEndNs.front()) / 1e9;
+
+    std::cout << "Frames delivered:   " << frameCount << " of " << expected << " expected at "
+        << m_conf.fps << " fps\n";
+    std::cout << "Frames dropped:     " << std::max<long>(expected - static_cast<long>(frameCount), 0) << "\n";
+    std::cout << "Delivered rate:     "
+        << (frameCount > 1 && spanSec > 0 ? (frameCount - 1) / spanSec : 0) << " fps\n";
+    std::cout << "Bytes per frame:    " << frameBytes / frameCount << "\n";
+    std::cout << "Frame gap (max):    " << maxGapNs / 1e6 << " ms\n";
+    std::cout << "Lag (avg/p95/max):  " << lagSumNs / 1e6 / frameCount << " / "
+        << lags.at(lags.size() * 95 / 100) / 1e6 << " / " << lags.back() / 1e6 << " ms\n";
+    std::cout << "Total bytes:        " << m_totalBytes << "\n";
+}
+
+static void printUsage() {
+    std::cout <<
+        "Usage: ptysim [options] -- <wavet> [wavet options]\n"
+        "Runs wavet on a pseudo-terminal that reads like a slow link and reports\n"
+        "frame delivery, dropped frames and lag. Frames are expected at the rate\n"
+        "wavet is given with --fps or -r.\n\n"
+        "Options:\n"
+        "  --rate {bytes per second}    Link rate (default 100000)\n"
+        "  --latency {ms}               Link latency (default 50)\n"
+        "  --buffer {bytes}             Bytes in flight on the link (default 16384)\n"
+        "  --duration {seconds}         How long to run wavet (default 10)\n"
+        "  --size {cols} {rows}         Terminal size (default 120 40)\n";
+}
+
+int main(int argc, char** argv) {
+    SimConfig conf;
+    conf.rate = 100000;
+    conf.latency = 0.05;
+    conf.bufferSize = 16384;
+    conf.duration = 10;
+    conf.fps = 24;
+    conf.cols = 120;
+    conf.rows = 40;
+
+    int idx = 1;
+    for (; idx < argc; idx++) {
+        std::string label = argv[idx];
+        int argCount = label == "--size" ? 2 : 1;
+        if (label == "--") {
+            idx++;
+            break;
+        }
+        if (label == "--help" || label == "-h") {
+            printUsage();
+            return 0;
+        }
+        if (idx + argCount >= argc) {
+            std::cout << "ERROR: Expected (more) argument(s) after " << label << "\n";
+            return -1;
+        }
+        if (label == "--rate") {
+            conf.rate = atof(argv[++idx]);
+        }
+        else if (label == "--latency") {
+            conf.latency = atof(argv[++idx]) / 1000;
+        }
+        else if (label == "--buffer") {
+            conf.bufferSize = static_cast<size_t>(atol(argv[++idx]));
+        }
+        else if (label == "--duration") {
+            conf.duration = atof(argv[++idx]);
+        }
+        else if (label == "--size") {
+            conf.cols = static_cast<unsigned short>(atoi(argv[++idx]));
+            conf.rows = static_cast<unsigned short>(atoi(argv[++idx]));
+        }
+        else {
+            std::cout << "ERROR: Unknown option `" << label << "`\n";
+            return -1;
+        }
+    }
+    if (idx >= argc) {
+        printUsage();
+        return -1;
+    }
+    if (conf.rate <= 0 || conf.bufferSize == 0) {
+        std::cout << "ERROR: Rate and buffer must be positive\n";
+        return -1;
+    }
+    for (; idx < argc; idx++) {
+        conf.command.push_back(argv[idx]);
+    }
+    // NOTE: The expected frame count comes from the rate wavet runs at, the
+    // last one given wins as in wavet
+    for (size_t i = 1; i + 1 < conf.command.size(); i++) {
+        std::string label = conf.command.at(i);
+        if (label == "--fps" || label == "-r") {
+            conf.fps = atoi(conf.command.at(++i));
+        }
+    }
+    if (conf.fps <= 0) {
+        std::cout << "ERROR: Frame rate after --fps or -r must be positive\n";
+        return -1;
+    }
+
+    PtySim sim(conf);
+    if (!sim.run()) {
+        return -1;
+    }
+    sim.printReport();
+    return 0;
+}